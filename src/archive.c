@@ -0,0 +1,212 @@
+#include <stdio.h>
+#include <string.h> // memcpy
+
+#include "archive.h"
+#include "inflate.h"
+#include "crc32.h"
+
+#define GZIP_HEADER_SIZE 10
+#define GZIP_TRAILER_SIZE 8
+#define GZIP_DEFLATE 8
+#define GZIP_FLAG_HEADER_CRC (1 << 1)
+#define GZIP_FLAG_EXTRA (1 << 2)
+#define GZIP_FLAG_NAME (1 << 3)
+#define GZIP_FLAG_COMMENT (1 << 4)
+
+#define ZIP_LOCAL_HEADER_SIGNATURE 0x04034B50
+#define ZIP_CENTRAL_HEADER_SIGNATURE 0x02014B50
+#define ZIP_END_SIGNATURE 0x06054B50
+#define ZIP_LOCAL_HEADER_SIZE 30
+#define ZIP_CENTRAL_HEADER_SIZE 46
+#define ZIP_END_SIZE 22
+#define ZIP_MAX_COMMENT_SIZE 0xFFFF
+#define ZIP_STORED 0
+#define ZIP_DEFLATE 8
+#define ZIP_FLAG_ENCRYPTED (1 << 0)
+#define ZIP64_SIZE 0xFFFFFFFF
+
+internal uint16_t
+read_u16(uint8_t *bytes)
+{
+    uint16_t result = (uint16_t)(bytes[0] | (bytes[1] << 8));
+    return result;
+}
+
+internal uint32_t
+read_u32(uint8_t *bytes)
+{
+    uint32_t result = (uint32_t)bytes[0] | ((uint32_t)bytes[1] << 8) | ((uint32_t)bytes[2] << 16) | ((uint32_t)bytes[3] << 24);
+    return result;
+}
+
+ArchiveType
+archive_detect(uint8_t *data, int64_t size)
+{
+    ArchiveType result = ARCHIVE_NONE;
+    if ((size >= GZIP_HEADER_SIZE + GZIP_TRAILER_SIZE) && (data[0] == 0x1F) && (data[1] == 0x8B)) {
+        result = ARCHIVE_GZIP;
+    }
+    else if ((size >= ZIP_END_SIZE) && (read_u32(data) == ZIP_LOCAL_HEADER_SIGNATURE)) {
+        result = ARCHIVE_ZIP;
+    }
+    return result;
+}
+
+// Decodes `compressedSize` bytes at `compressed` into a new arena buffer of `size` bytes.
+internal bool
+extract(Arena *arena, uint8_t *compressed, int64_t compressedSize, int32_t method, int64_t size, uint32_t crc,
+        Str8 path, uint8_t **image, int32_t *imageSize)
+{
+    if ((size <= 0) || (size > arena->cap - arena->pos)) {
+        fprintf(stderr, "ROM in archive '%.*s' is too large\n", STR8_VARG(path));
+        return false;
+    }
+
+    uint8_t *out = arena_push(arena, (int32_t)size);
+    bool result = false;
+    if (method == ZIP_STORED) {
+        result = (compressedSize == size);
+        if (result) {
+            memcpy(out, compressed, size);
+        }
+    }
+    else {
+        result = (inflate_decode(compressed, compressedSize, out, size) >= 0);
+    }
+    if (!result || (crc32_update(0, out, size) != crc)) {
+        fprintf(stderr, "Corrupted archive '%.*s'\n", STR8_VARG(path));
+        arena_pop(arena, (int32_t)size);
+        return false;
+    }
+
+    *image = out;
+    *imageSize = (int32_t)size;
+    return true;
+}
+
+// GZIP MEMBER:
+// +---+---+----+-----+-------+-----+----+   +---------+   +-------+-------+
+// | 1F| 8B| CM | FLG | MTIME | XFL | OS |...| DEFLATE |...| CRC32 | ISIZE |
+// +---+---+----+-----+-------+-----+----+   +---------+   +-------+-------+
+// FLG tells which optional fields (extra, name, comment, header CRC) sit before the data.
+internal bool
+extract_gzip(Arena *arena, uint8_t *data, int64_t size, Str8 path, uint8_t **image, int32_t *imageSize)
+{
+    uint8_t flags = data[3];
+    if (data[2] != GZIP_DEFLATE) {
+        fprintf(stderr, "Unsupported compression in '%.*s'\n", STR8_VARG(path));
+        return false;
+    }
+
+    int64_t pos = GZIP_HEADER_SIZE;
+    int64_t end = size - GZIP_TRAILER_SIZE;
+    if (flags & GZIP_FLAG_EXTRA) {
+        pos += (pos + 2 <= end) ? 2 + read_u16(data + pos) : end;
+    }
+    if (flags & GZIP_FLAG_NAME) {
+        while ((pos < end) && data[pos++]) {
+        }
+    }
+    if (flags & GZIP_FLAG_COMMENT) {
+        while ((pos < end) && data[pos++]) {
+        }
+    }
+    if (flags & GZIP_FLAG_HEADER_CRC) {
+        pos += 2;
+    }
+    if (pos >= end) {
+        fprintf(stderr, "Corrupted archive '%.*s'\n", STR8_VARG(path));
+        return false;
+    }
+
+    // ISIZE is the size modulo 4GB, ROMs are much smaller
+    uint32_t crc = read_u32(data + end);
+    int64_t romSize = read_u32(data + end + 4);
+    bool result = extract(arena, data + pos, end - pos, ZIP_DEFLATE, romSize, crc, path, image, imageSize);
+    return result;
+}
+
+internal bool
+has_nes_extension(uint8_t *name, int32_t nameLength)
+{
+    Str8 extension = STR8_LITERAL(".nes");
+    bool result = (nameLength >= extension.length) &&
+                  str8_is_equal(str8(name + nameLength - extension.length, extension.length), extension, CASE_INSENSITIVE);
+    return result;
+}
+
+// Walks the central directory (found through the end record at the very end of the file) for
+// the first .nes entry, whose sizes and CRC are always there, even when the local header
+// defers them to a data descriptor.
+internal bool
+extract_zip(Arena *arena, uint8_t *data, int64_t size, Str8 path, uint8_t **image, int32_t *imageSize)
+{
+    int64_t endPos = size - ZIP_END_SIZE;
+    int64_t minEndPos = MAX(size - ZIP_END_SIZE - ZIP_MAX_COMMENT_SIZE, 0);
+    while ((endPos >= minEndPos) && (read_u32(data + endPos) != ZIP_END_SIGNATURE)) {
+        endPos--;
+    }
+    if (endPos < minEndPos) {
+        fprintf(stderr, "Corrupted archive '%.*s'\n", STR8_VARG(path));
+        return false;
+    }
+
+    int32_t entriesCount = read_u16(data + endPos + 10);
+    int64_t pos = read_u32(data + endPos + 16);
+    for (int32_t i = 0; i < entriesCount; i++) {
+        if ((pos + ZIP_CENTRAL_HEADER_SIZE > endPos) || (read_u32(data + pos) != ZIP_CENTRAL_HEADER_SIGNATURE)) {
+            break;
+        }
+        uint8_t *entry = data + pos;
+        int32_t nameLength = read_u16(entry + 28);
+        pos += ZIP_CENTRAL_HEADER_SIZE + nameLength + read_u16(entry + 30) + read_u16(entry + 32);
+        if ((pos > endPos) || !has_nes_extension(entry + ZIP_CENTRAL_HEADER_SIZE, nameLength)) {
+            continue;
+        }
+
+        uint16_t flags = read_u16(entry + 8);
+        int32_t method = read_u16(entry + 10);
+        uint32_t crc = read_u32(entry + 16);
+        uint32_t compressedSize = read_u32(entry + 20);
+        uint32_t romSize = read_u32(entry + 24);
+        int64_t localPos = read_u32(entry + 42);
+        if ((flags & ZIP_FLAG_ENCRYPTED) || ((method != ZIP_STORED) && (method != ZIP_DEFLATE)) ||
+            (compressedSize == ZIP64_SIZE) || (romSize == ZIP64_SIZE)) {
+            fprintf(stderr, "Unsupported zip entry '%.*s' in '%.*s'\n", nameLength, entry + ZIP_CENTRAL_HEADER_SIZE, STR8_VARG(path));
+            return false;
+        }
+        if ((localPos + ZIP_LOCAL_HEADER_SIZE > size) || (read_u32(data + localPos) != ZIP_LOCAL_HEADER_SIGNATURE)) {
+            fprintf(stderr, "Corrupted archive '%.*s'\n", STR8_VARG(path));
+            return false;
+        }
+        int64_t dataPos = localPos + ZIP_LOCAL_HEADER_SIZE + read_u16(data + localPos + 26) + read_u16(data + localPos + 28);
+        if (dataPos + compressedSize > size) {
+            fprintf(stderr, "Corrupted archive '%.*s'\n", STR8_VARG(path));
+            return false;
+        }
+
+        bool result = extract(arena, data + dataPos, compressedSize, method, romSize, crc, path, image, imageSize);
+        return result;
+    }
+
+    fprintf(stderr, "No .nes file in archive '%.*s'\n", STR8_VARG(path));
+    return false;
+}
+
+bool
+archive_extract_rom(Arena *arena, uint8_t *data, int64_t size, Str8 path, uint8_t **image, int32_t *imageSize)
+{
+    bool result = false;
+    switch (archive_detect(data, size)) {
+        case ARCHIVE_GZIP: {
+            result = extract_gzip(arena, data, size, path, image, imageSize);
+        } break;
+        case ARCHIVE_ZIP: {
+            result = extract_zip(arena, data, size, path, image, imageSize);
+        } break;
+        default: {
+            fprintf(stderr, "Not an archive '%.*s'\n", STR8_VARG(path));
+        } break;
+    }
+    return result;
+}
@@ -0,0 +1,23 @@
+#ifndef ARCHIVE_H
+#define ARCHIVE_H
+
+#include <stdint.h>
+
+#include "utils.h"
+#include "arena.h"
+#include "str8.h"
+
+typedef int32_t ArchiveType;
+enum ArchiveType
+{
+    ARCHIVE_NONE,
+    ARCHIVE_GZIP,
+    ARCHIVE_ZIP,
+};
+
+ArchiveType archive_detect(uint8_t *data, int64_t size);
+// Decompresses a gzip'd ROM, or the first .nes entry of a zip, into a buffer pushed on the
+// arena, checked against the CRC-32 stored in the archive.
+bool archive_extract_rom(Arena *arena, uint8_t *data, int64_t size, Str8 path, uint8_t **image, int32_t *imageSize);
+
+#endif //ARCHIVE_H
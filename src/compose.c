@@ -0,0 +1,179 @@
+#include "utils.h"
+#include "compose.h"
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+internal bool
+compose_scalar(uint8_t *background, uint8_t *sprites, uint8_t *palette, uint8_t *line)
+{
+    bool isSprite0Hit = false;
+    for (int32_t x = 0; x < COMPOSE_LINE_WIDTH_PX; x++) {
+        uint8_t sprite = sprites[x];
+        uint8_t paletteIdx = background[x];
+        if (sprite) {
+            // never at x = 255
+            if ((sprite & COMPOSE_SPRITE_0) && paletteIdx && (x < COMPOSE_LINE_WIDTH_PX - 1)) {
+                isSprite0Hit = true;
+            }
+            if (!paletteIdx || !(sprite & COMPOSE_SPRITE_BEHIND_BACKGROUND)) {
+                paletteIdx = sprite & 0x1F;
+            }
+        }
+        line[x] = palette[paletteIdx];
+    }
+    return isSprite0Hit;
+}
+
+internal void
+convert_scalar(uint8_t *line, uint32_t *rgba, uint32_t *row)
+{
+    for (int32_t x = 0; x < COMPOSE_LINE_WIDTH_PX; x++) {
+        row[x] = rgba[line[x]];
+    }
+}
+
+#if defined(__x86_64__)
+
+// SSE2 has no byte shuffle, so only the priority is resolved 16 pixels at a time and the
+// colours are looked up one by one, as the conversion to RGBA is.
+internal bool
+compose_sse2(uint8_t *background, uint8_t *sprites, uint8_t *palette, uint8_t *line)
+{
+    __m128i zero = _mm_setzero_si128();
+    __m128i paletteMask = _mm_set1_epi8(0x1F);
+    __m128i behindMask = _mm_set1_epi8(COMPOSE_SPRITE_BEHIND_BACKGROUND);
+    __m128i sprite0Mask = _mm_set1_epi8(COMPOSE_SPRITE_0);
+
+    bool result = false;
+    for (int32_t x = 0; x < COMPOSE_LINE_WIDTH_PX; x += 16) {
+        __m128i bg = _mm_loadu_si128((__m128i *)(background + x));
+        __m128i sp = _mm_loadu_si128((__m128i *)(sprites + x));
+
+        __m128i isBgTransparent = _mm_cmpeq_epi8(bg, zero);
+        __m128i isSpTransparent = _mm_cmpeq_epi8(sp, zero);
+        __m128i isSpBehind = _mm_cmpeq_epi8(_mm_and_si128(sp, behindMask), behindMask);
+        // opaque sprite pixels win unless they are behind an opaque background pixel
+        __m128i isSpShown = _mm_andnot_si128(isSpTransparent, _mm_or_si128(isBgTransparent, _mm_xor_si128(isSpBehind, _mm_set1_epi8(-1))));
+        __m128i idx = _mm_or_si128(_mm_andnot_si128(isSpShown, bg), _mm_and_si128(isSpShown, _mm_and_si128(sp, paletteMask)));
+
+        __m128i isSp0 = _mm_cmpeq_epi8(_mm_and_si128(sp, sprite0Mask), sprite0Mask);
+        int32_t hitBits = _mm_movemask_epi8(_mm_andnot_si128(isBgTransparent, isSp0));
+        if (x == COMPOSE_LINE_WIDTH_PX - 16) {
+            // never at x = 255
+            hitBits &= 0x7FFF;
+        }
+        result |= (hitBits != 0);
+
+        uint8_t indexes[16];
+        _mm_storeu_si128((__m128i *)indexes, idx);
+        for (int32_t i = 0; i < 16; i++) {
+            line[x + i] = palette[indexes[i]];
+        }
+    }
+    return result;
+}
+
+// Loads 16-entry lookup tables in both 128-bit lanes, for vpshufb.
+__attribute__((target("avx2"))) internal __m256i
+load_table(uint8_t *table)
+{
+    __m256i result = _mm256_broadcastsi128_si256(_mm_loadu_si128((__m128i *)table));
+    return result;
+}
+
+// Looks `idx` (below 32) up in two 16-entry tables. Shifting the 16-bit lanes moves
+// bit 4 up to bit 7, which is all vpblendvb looks at, without carrying into the next byte.
+__attribute__((target("avx2"))) internal __m256i
+lookup_32(__m256i *tables, __m256i idx)
+{
+    __m256i isHi = _mm256_slli_epi16(idx, 3);
+    __m256i result = _mm256_blendv_epi8(_mm256_shuffle_epi8(tables[0], idx), _mm256_shuffle_epi8(tables[1], idx), isHi);
+    return result;
+}
+
+// 32 pixels at a time, the palette lookup is two 16-entry shuffles.
+__attribute__((target("avx2"))) internal bool
+compose_avx2(uint8_t *background, uint8_t *sprites, uint8_t *palette, uint8_t *line)
+{
+    __m256i paletteTables[2] = {load_table(palette), load_table(palette + 16)};
+
+    __m256i zero = _mm256_setzero_si256();
+    __m256i paletteMask = _mm256_set1_epi8(0x1F);
+    __m256i behindMask = _mm256_set1_epi8(COMPOSE_SPRITE_BEHIND_BACKGROUND);
+    __m256i sprite0Mask = _mm256_set1_epi8(COMPOSE_SPRITE_0);
+
+    bool result = false;
+    for (int32_t x = 0; x < COMPOSE_LINE_WIDTH_PX; x += 32) {
+        __m256i bg = _mm256_loadu_si256((__m256i *)(background + x));
+        __m256i sp = _mm256_loadu_si256((__m256i *)(sprites + x));
+
+        __m256i isBgTransparent = _mm256_cmpeq_epi8(bg, zero);
+        __m256i isSpTransparent = _mm256_cmpeq_epi8(sp, zero);
+        __m256i isSpBehind = _mm256_cmpeq_epi8(_mm256_and_si256(sp, behindMask), behindMask);
+        __m256i isSpShown = _mm256_andnot_si256(isSpTransparent, _mm256_or_si256(isBgTransparent, _mm256_xor_si256(isSpBehind, _mm256_set1_epi8(-1))));
+        __m256i idx = _mm256_blendv_epi8(bg, _mm256_and_si256(sp, paletteMask), isSpShown);
+
+        __m256i isSp0 = _mm256_cmpeq_epi8(_mm256_and_si256(sp, sprite0Mask), sprite0Mask);
+        uint32_t hitBits = (uint32_t)_mm256_movemask_epi8(_mm256_andnot_si256(isBgTransparent, isSp0));
+        if (x == COMPOSE_LINE_WIDTH_PX - 32) {
+            // never at x = 255
+            hitBits &= 0x7FFFFFFF;
+        }
+        result |= (hitBits != 0);
+
+        _mm256_storeu_si256((__m256i *)(line + x), lookup_32(paletteTables, idx));
+    }
+    return result;
+}
+
+// 8 pixels per gather. Splitting the RGBA values in byte planes and looking each up with
+// shuffles, as compose_avx2 does for the palette, takes too many of them for 64 entries.
+__attribute__((target("avx2"))) internal void
+convert_avx2(uint8_t *line, uint32_t *rgba, uint32_t *row)
+{
+    for (int32_t x = 0; x < COMPOSE_LINE_WIDTH_PX; x += 8) {
+        __m256i idx = _mm256_cvtepu8_epi32(_mm_loadl_epi64((__m128i *)(line + x)));
+        _mm256_storeu_si256((__m256i *)(row + x), _mm256_i32gather_epi32((const int *)rgba, idx, 4));
+    }
+}
+
+#endif
+
+global const ComposeKernels composeKernels[COMPOSE_KERNELS_COUNT] = {
+    [COMPOSE_SCALAR] = {"scalar", compose_scalar, convert_scalar},
+#if defined(__x86_64__)
+    [COMPOSE_SSE2] = {"sse2", compose_sse2, convert_scalar},
+    [COMPOSE_AVX2] = {"avx2", compose_avx2, convert_avx2},
+#endif
+};
+
+const ComposeKernels *
+compose_get(ComposeKernel kernel)
+{
+    ASSERT((kernel >= 0) && (kernel < COMPOSE_KERNELS_COUNT));
+
+    const ComposeKernels *result = &composeKernels[kernel];
+#if defined(__x86_64__)
+    // SSE2 is part of x86-64
+    if ((kernel == COMPOSE_AVX2) && !__builtin_cpu_supports("avx2")) {
+        result = NULL;
+    }
+#else
+    if (kernel != COMPOSE_SCALAR) {
+        result = NULL;
+    }
+#endif
+    return result;
+}
+
+const ComposeKernels *
+compose_get_best(void)
+{
+    const ComposeKernels *result = NULL;
+    for (ComposeKernel kernel = COMPOSE_KERNELS_COUNT - 1; !result; kernel--) {
+        result = compose_get(kernel);
+    }
+    return result;
+}
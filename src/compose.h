@@ -0,0 +1,47 @@
+#ifndef COMPOSE_H
+#define COMPOSE_H
+
+#include <stdint.h>
+
+#define COMPOSE_LINE_WIDTH_PX 256
+#define COMPOSE_PALETTE_COUNT 32 // palette RAM entries
+#define COMPOSE_COLORS_COUNT 64  // 2C02 colours
+
+// Sprite line buffer entries: palette RAM index in the low 5 bits (sprite palettes start at
+// $3F10, 0 for no sprite) and flags. Background line buffer entries are the palette RAM index
+// alone, 0 being transparent.
+#define COMPOSE_SPRITE_PALETTE 0x10
+#define COMPOSE_SPRITE_BEHIND_BACKGROUND 0x20
+#define COMPOSE_SPRITE_0 0x40
+
+typedef int32_t ComposeKernel;
+enum ComposeKernel
+{
+    COMPOSE_SCALAR,
+    COMPOSE_SSE2,
+    COMPOSE_AVX2,
+
+    COMPOSE_KERNELS_COUNT,
+};
+
+// Resolves sprite/background priority over a scanline and writes each pixel's colour
+// (0-63), `palette` being the colour of every palette RAM index. Returns whether an opaque
+// sprite 0 pixel overlaps an opaque background pixel (sprite 0 hit), x = 255 aside.
+typedef bool ComposeFn(uint8_t *background, uint8_t *sprites, uint8_t *palette, uint8_t *line);
+// Maps a scanline of colours to `rgba`, 64 RGBA8888 values.
+typedef void ComposeConvertFn(uint8_t *line, uint32_t *rgba, uint32_t *row);
+
+typedef struct ComposeKernels ComposeKernels;
+struct ComposeKernels
+{
+    const char *name;
+    ComposeFn *compose;
+    ComposeConvertFn *convert;
+};
+
+// NULL when the CPU lacks what `kernel` needs.
+const ComposeKernels *compose_get(ComposeKernel kernel);
+// The fastest kernels this CPU runs.
+const ComposeKernels *compose_get_best(void);
+
+#endif //COMPOSE_H
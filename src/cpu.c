@@ -1,7 +1,9 @@
 #include <stdlib.h>
+#include <string.h> // memset
 
 #include "utils.h"
 #include "cpu.h"
+#include "jit.h"
 
 #define CPU_NMI_ADDR_LO 0xFFFA
 #define CPU_NMI_ADDR_HI 0xFFFB
@@ -10,6 +12,12 @@
 #define CPU_IRQ_ADDR_LO 0xFFFE
 #define CPU_IRQ_ADDR_HI 0xFFFF
 
+#if CPU_PROFILE
+#define CPU_PROFILE_RECORD(cpu, pc, opcode, cyclesCount) profile_record((cpu)->profile, (pc), (opcode), (cyclesCount))
+#else
+#define CPU_PROFILE_RECORD(cpu, pc, opcode, cyclesCount) (void)(pc)
+#endif
+
 #define CPU_STATUS_GET(cpu, flag) (!!((cpu)->p & (flag)))
 #define CPU_STATUS_SET(cpu, flag) (cpu)->p |= (uint8_t)(flag)
 #define CPU_STATUS_CLEAR(cpu, flag) (cpu)->p &= (uint8_t)(~(flag))
@@ -23,71 +31,93 @@ struct CpuInstructionEncoding
     int32_t baseCyclesCount;
 };
 
+// X(opcode, code, addrMode, baseCyclesCount)
+#define CPU_INSTRUCTION_ENCODINGS(X) \
+    X(0x00, BRK, IMP, 7) X(0x01, ORA, IDX, 6) X(0x02, JAM, IMP, 0) X(0x03, SLO, IDX, 8) \
+    X(0x04, NOP, ZPG, 3) X(0x05, ORA, ZPG, 3) X(0x06, ASL, ZPG, 5) X(0x07, SLO, ZPG, 5) \
+    X(0x08, PHP, IMP, 3) X(0x09, ORA, IMM, 2) X(0x0A, ASL, ACC, 2) X(0x0B, ANC, IMM, 2) \
+    X(0x0C, NOP, ABS, 4) X(0x0D, ORA, ABS, 4) X(0x0E, ASL, ABS, 6) X(0x0F, SLO, ABS, 6) \
+    X(0x10, BPL, REL, 2) X(0x11, ORA, IDY, 5) X(0x12, JAM, IMP, 0) X(0x13, SLO, IDY, 8) \
+    X(0x14, NOP, ZPX, 4) X(0x15, ORA, ZPX, 4) X(0x16, ASL, ZPX, 6) X(0x17, SLO, ZPX, 6) \
+    X(0x18, CLC, IMP, 2) X(0x19, ORA, ABY, 4) X(0x1A, NOP, IMP, 2) X(0x1B, SLO, ABY, 7) \
+    X(0x1C, NOP, ABX, 4) X(0x1D, ORA, ABX, 4) X(0x1E, ASL, ABX, 7) X(0x1F, SLO, ABX, 7) \
+    X(0x20, JSR, ABS, 6) X(0x21, AND, IDX, 6) X(0x22, JAM, IMP, 0) X(0x23, RLA, IDX, 8) \
+    X(0x24, BIT, ZPG, 3) X(0x25, AND, ZPG, 3) X(0x26, ROL, ZPG, 5) X(0x27, RLA, ZPG, 5) \
+    X(0x28, PLP, IMP, 4) X(0x29, AND, IMM, 2) X(0x2A, ROL, ACC, 2) X(0x2B, ANC, IMM, 2) \
+    X(0x2C, BIT, ABS, 4) X(0x2D, AND, ABS, 4) X(0x2E, ROL, ABS, 6) X(0x2F, RLA, ABS, 6) \
+    X(0x30, BMI, REL, 2) X(0x31, AND, IDY, 5) X(0x32, JAM, IMP, 0) X(0x33, RLA, IDY, 8) \
+    X(0x34, NOP, ZPX, 4) X(0x35, AND, ZPX, 4) X(0x36, ROL, ZPX, 6) X(0x37, RLA, ZPX, 6) \
+    X(0x38, SEC, IMP, 2) X(0x39, AND, ABY, 4) X(0x3A, NOP, IMP, 2) X(0x3B, RLA, ABY, 7) \
+    X(0x3C, NOP, ABX, 4) X(0x3D, AND, ABX, 4) X(0x3E, ROL, ABX, 7) X(0x3F, RLA, ABX, 7) \
+    X(0x40, RTI, IMP, 6) X(0x41, EOR, IDX, 6) X(0x42, JAM, IMP, 0) X(0x43, SRE, IDX, 8) \
+    X(0x44, NOP, ZPG, 3) X(0x45, EOR, ZPG, 3) X(0x46, LSR, ZPG, 5) X(0x47, SRE, ZPG, 5) \
+    X(0x48, PHA, IMP, 3) X(0x49, EOR, IMM, 2) X(0x4A, LSR, ACC, 2) X(0x4B, ALR, IMM, 2) \
+    X(0x4C, JMP, ABS, 3) X(0x4D, EOR, ABS, 4) X(0x4E, LSR, ABS, 6) X(0x4F, SRE, ABS, 6) \
+    X(0x50, BVC, REL, 2) X(0x51, EOR, IDY, 5) X(0x52, JAM, IMP, 0) X(0x53, SRE, IDY, 8) \
+    X(0x54, NOP, ZPX, 4) X(0x55, EOR, ZPX, 4) X(0x56, LSR, ZPX, 6) X(0x57, SRE, ZPX, 6) \
+    X(0x58, CLI, IMP, 2) X(0x59, EOR, ABY, 4) X(0x5A, NOP, IMP, 2) X(0x5B, SRE, ABY, 7) \
+    X(0x5C, NOP, ABX, 4) X(0x5D, EOR, ABX, 4) X(0x5E, LSR, ABX, 7) X(0x5F, SRE, ABX, 7) \
+    X(0x60, RTS, IMP, 6) X(0x61, ADC, IDX, 6) X(0x62, JAM, IMP, 0) X(0x63, RRA, IDX, 8) \
+    X(0x64, NOP, ZPG, 3) X(0x65, ADC, ZPG, 3) X(0x66, ROR, ZPG, 5) X(0x67, RRA, ZPG, 5) \
+    X(0x68, PLA, IMP, 4) X(0x69, ADC, IMM, 2) X(0x6A, ROR, ACC, 2) X(0x6B, ARR, IMM, 2) \
+    X(0x6C, JMP, IDR, 5) X(0x6D, ADC, ABS, 4) X(0x6E, ROR, ABS, 6) X(0x6F, RRA, ABS, 6) \
+    X(0x70, BVS, REL, 2) X(0x71, ADC, IDY, 5) X(0x72, JAM, IMP, 0) X(0x73, RRA, IDY, 8) \
+    X(0x74, NOP, ZPX, 4) X(0x75, ADC, ZPX, 4) X(0x76, ROR, ZPX, 6) X(0x77, RRA, ZPX, 6) \
+    X(0x78, SEI, IMP, 2) X(0x79, ADC, ABY, 4) X(0x7A, NOP, IMP, 2) X(0x7B, RRA, ABY, 7) \
+    X(0x7C, NOP, ABX, 4) X(0x7D, ADC, ABX, 4) X(0x7E, ROR, ABX, 7) X(0x7F, RRA, ABX, 7) \
+    X(0x80, NOP, IMM, 2) X(0x81, STA, IDX, 6) X(0x82, NOP, IMM, 2) X(0x83, SAX, IDX, 6) \
+    X(0x84, STY, ZPG, 3) X(0x85, STA, ZPG, 3) X(0x86, STX, ZPG, 3) X(0x87, SAX, ZPG, 3) \
+    X(0x88, DEY, IMP, 2) X(0x89, NOP, IMM, 2) X(0x8A, TXA, IMP, 2) X(0x8B, ANE, IMM, 2) \
+    X(0x8C, STY, ABS, 4) X(0x8D, STA, ABS, 4) X(0x8E, STX, ABS, 4) X(0x8F, SAX, ABS, 4) \
+    X(0x90, BCC, REL, 2) X(0x91, STA, IDY, 6) X(0x92, JAM, IMP, 0) X(0x93, SHA, IDY, 6) \
+    X(0x94, STY, ZPX, 4) X(0x95, STA, ZPX, 4) X(0x96, STX, ZPY, 4) X(0x97, SAX, ZPY, 4) \
+    X(0x98, TYA, IMP, 2) X(0x99, STA, ABY, 5) X(0x9A, TXS, IMP, 2) X(0x9B, TAS, ABY, 5) \
+    X(0x9C, SHY, ABX, 5) X(0x9D, STA, ABX, 5) X(0x9E, SHX, ABY, 5) X(0x9F, SHA, ABY, 5) \
+    X(0xA0, LDY, IMM, 2) X(0xA1, LDA, IDX, 6) X(0xA2, LDX, IMM, 2) X(0xA3, LAX, IDX, 6) \
+    X(0xA4, LDY, ZPG, 3) X(0xA5, LDA, ZPG, 3) X(0xA6, LDX, ZPG, 3) X(0xA7, LAX, ZPG, 3) \
+    X(0xA8, TAY, IMP, 2) X(0xA9, LDA, IMM, 2) X(0xAA, TAX, IMP, 2) X(0xAB, LXA, IMM, 2) \
+    X(0xAC, LDY, ABS, 4) X(0xAD, LDA, ABS, 4) X(0xAE, LDX, ABS, 4) X(0xAF, LAX, ABS, 4) \
+    X(0xB0, BCS, REL, 2) X(0xB1, LDA, IDY, 5) X(0xB2, JAM, IMP, 0) X(0xB3, LAX, IDY, 5) \
+    X(0xB4, LDY, ZPX, 4) X(0xB5, LDA, ZPX, 4) X(0xB6, LDX, ZPY, 4) X(0xB7, LAX, ZPY, 4) \
+    X(0xB8, CLV, IMP, 2) X(0xB9, LDA, ABY, 4) X(0xBA, TSX, IMP, 2) X(0xBB, LAS, ABY, 4) \
+    X(0xBC, LDY, ABX, 4) X(0xBD, LDA, ABX, 4) X(0xBE, LDX, ABY, 4) X(0xBF, LAX, ABY, 4) \
+    X(0xC0, CPY, IMM, 2) X(0xC1, CMP, IDX, 6) X(0xC2, NOP, IMM, 2) X(0xC3, DCP, IDX, 8) \
+    X(0xC4, CPY, ZPG, 3) X(0xC5, CMP, ZPG, 3) X(0xC6, DEC, ZPG, 5) X(0xC7, DCP, ZPG, 5) \
+    X(0xC8, INY, IMP, 2) X(0xC9, CMP, IMM, 2) X(0xCA, DEX, IMP, 2) X(0xCB, SBX, IMM, 2) \
+    X(0xCC, CPY, ABS, 4) X(0xCD, CMP, ABS, 4) X(0xCE, DEC, ABS, 6) X(0xCF, DCP, ABS, 6) \
+    X(0xD0, BNE, REL, 2) X(0xD1, CMP, IDY, 5) X(0xD2, JAM, IMP, 0) X(0xD3, DCP, IDY, 8) \
+    X(0xD4, NOP, ZPX, 4) X(0xD5, CMP, ZPX, 4) X(0xD6, DEC, ZPX, 6) X(0xD7, DCP, ZPX, 6) \
+    X(0xD8, CLD, IMP, 2) X(0xD9, CMP, ABY, 4) X(0xDA, NOP, IMP, 2) X(0xDB, DCP, ABY, 7) \
+    X(0xDC, NOP, ABX, 4) X(0xDD, CMP, ABX, 4) X(0xDE, DEC, ABX, 7) X(0xDF, DCP, ABX, 7) \
+    X(0xE0, CPX, IMM, 2) X(0xE1, SBC, IDX, 6) X(0xE2, NOP, IMM, 2) X(0xE3, ISB, IDX, 8) \
+    X(0xE4, CPX, ZPG, 3) X(0xE5, SBC, ZPG, 3) X(0xE6, INC, ZPG, 5) X(0xE7, ISB, ZPG, 5) \
+    X(0xE8, INX, IMP, 2) X(0xE9, SBC, IMM, 2) X(0xEA, NOP, IMP, 2) X(0xEB, USB, IMM, 2) \
+    X(0xEC, CPX, ABS, 4) X(0xED, SBC, ABS, 4) X(0xEE, INC, ABS, 6) X(0xEF, ISB, ABS, 6) \
+    X(0xF0, BEQ, REL, 2) X(0xF1, SBC, IDY, 5) X(0xF2, JAM, IMP, 0) X(0xF3, ISB, IDY, 8) \
+    X(0xF4, NOP, ZPX, 4) X(0xF5, SBC, ZPX, 4) X(0xF6, INC, ZPX, 6) X(0xF7, ISB, ZPX, 6) \
+    X(0xF8, SED, IMP, 2) X(0xF9, SBC, ABY, 4) X(0xFA, NOP, IMP, 2) X(0xFB, ISB, ABY, 7) \
+    X(0xFC, NOP, ABX, 4) X(0xFD, SBC, ABX, 4) X(0xFE, INC, ABX, 7) X(0xFF, ISB, ABX, 7)
+
+#define CPU_INSTRUCTION_ENCODING(opcode, code, addrMode, baseCyclesCount) [opcode] = {code, addrMode, baseCyclesCount},
+
 global CpuInstructionEncoding instructionEncodings[256] = {
-        {BRK, IMP, 7}, {ORA, IDX, 6}, {JAM, IMP, 0}, {SLO, IDX, 8}, // $00-$03
-        {NOP, ZPG, 3}, {ORA, ZPG, 3}, {ASL, ZPG, 5}, {SLO, ZPG, 5}, // $04-$07
-        {PHP, IMP, 3}, {ORA, IMM, 2}, {ASL, ACC, 2}, {ANC, IMM, 2}, // $08-$0B
-        {NOP, ABS, 4}, {ORA, ABS, 4}, {ASL, ABS, 6}, {SLO, ABS, 6}, // $0C-$0F
-        {BPL, REL, 2}, {ORA, IDY, 5}, {JAM, IMP, 0}, {SLO, IDY, 8}, // $10-$13
-        {NOP, ZPX, 4}, {ORA, ZPX, 4}, {ASL, ZPX, 6}, {SLO, ZPX, 6}, // $14-$17
-        {CLC, IMP, 2}, {ORA, ABY, 4}, {NOP, IMP, 2}, {SLO, ABY, 7}, // $18-$1B
-        {NOP, ABX, 4}, {ORA, ABX, 4}, {ASL, ABX, 7}, {SLO, ABX, 7}, // $1C-$1F
-        {JSR, ABS, 6}, {AND, IDX, 6}, {JAM, IMP, 0}, {RLA, IDX, 8}, // $20-$23
-        {BIT, ZPG, 3}, {AND, ZPG, 3}, {ROL, ZPG, 5}, {RLA, ZPG, 5}, // $24-$27
-        {PLP, IMP, 4}, {AND, IMM, 2}, {ROL, ACC, 2}, {ANC, IMM, 2}, // $28-$2B
-        {BIT, ABS, 4}, {AND, ABS, 4}, {ROL, ABS, 6}, {RLA, ABS, 6}, // $2C-$2F
-        {BMI, REL, 2}, {AND, IDY, 5}, {JAM, IMP, 0}, {RLA, IDY, 8}, // $30-$33
-        {NOP, ZPX, 4}, {AND, ZPX, 4}, {ROL, ZPX, 6}, {RLA, ZPX, 6}, // $34-$37
-        {SEC, IMP, 2}, {AND, ABY, 4}, {NOP, IMP, 2}, {RLA, ABY, 7}, // $38-$3B
-        {NOP, ABX, 4}, {AND, ABX, 4}, {ROL, ABX, 7}, {RLA, ABX, 7}, // $3C-$3F
-        {RTI, IMP, 6}, {EOR, IDX, 6}, {JAM, IMP, 0}, {SRE, IDX, 8}, // $40-$43
-        {NOP, ZPG, 3}, {EOR, ZPG, 3}, {LSR, ZPG, 5}, {SRE, ZPG, 5}, // $44-$47
-        {PHA, IMP, 3}, {EOR, IMM, 2}, {LSR, ACC, 2}, {ALR, IMM, 2}, // $48-$4B
-        {JMP, ABS, 3}, {EOR, ABS, 4}, {LSR, ABS, 6}, {SRE, ABS, 6}, // $4C-$4F
-        {BVC, REL, 2}, {EOR, IDY, 5}, {JAM, IMP, 0}, {SRE, IDY, 8}, // $50-$53
-        {NOP, ZPX, 4}, {EOR, ZPX, 4}, {LSR, ZPX, 6}, {SRE, ZPX, 6}, // $54-$57
-        {CLI, IMP, 2}, {EOR, ABY, 4}, {NOP, IMP, 2}, {SRE, ABY, 7}, // $58-$5B
-        {NOP, ABX, 4}, {EOR, ABX, 4}, {LSR, ABX, 7}, {SRE, ABX, 7}, // $5C-$5F
-        {RTS, IMP, 6}, {ADC, IDX, 6}, {JAM, IMP, 0}, {RRA, IDX, 8}, // $60-$63
-        {NOP, ZPG, 3}, {ADC, ZPG, 3}, {ROR, ZPG, 5}, {RRA, ZPG, 5}, // $64-$67
-        {PLA, IMP, 4}, {ADC, IMM, 2}, {ROR, ACC, 2}, {ARR, IMM, 2}, // $68-$6B
-        {JMP, IDR, 5}, {ADC, ABS, 4}, {ROR, ABS, 6}, {RRA, ABS, 6}, // $6C-$6F
-        {BVS, REL, 2}, {ADC, IDY, 5}, {JAM, IMP, 0}, {RRA, IDY, 8}, // $70-$73
-        {NOP, ZPX, 4}, {ADC, ZPX, 4}, {ROR, ZPX, 6}, {RRA, ZPX, 6}, // $74-$77
-        {SEI, IMP, 2}, {ADC, ABY, 4}, {NOP, IMP, 2}, {RRA, ABY, 7}, // $78-$7B
-        {NOP, ABX, 4}, {ADC, ABX, 4}, {ROR, ABX, 7}, {RRA, ABX, 7}, // $7C-$7F
-        {NOP, IMM, 2}, {STA, IDX, 6}, {NOP, IMM, 2}, {SAX, IDX, 6}, // $80-$83
-        {STY, ZPG, 3}, {STA, ZPG, 3}, {STX, ZPG, 3}, {SAX, ZPG, 3}, // $84-$87
-        {DEY, IMP, 2}, {NOP, IMM, 2}, {TXA, IMP, 2}, {ANE, IMM, 2}, // $88-$8B
-        {STY, ABS, 4}, {STA, ABS, 4}, {STX, ABS, 4}, {SAX, ABS, 4}, // $8C-$8F
-        {BCC, REL, 2}, {STA, IDY, 6}, {JAM, IMP, 0}, {SHA, IDY, 6}, // $90-$93
-        {STY, ZPX, 4}, {STA, ZPX, 4}, {STX, ZPY, 4}, {SAX, ZPY, 4}, // $94-$97
-        {TYA, IMP, 2}, {STA, ABY, 5}, {TXS, IMP, 2}, {TAS, ABY, 5}, // $98-$9B
-        {SHY, ABX, 5}, {STA, ABX, 5}, {SHX, ABY, 5}, {SHA, ABY, 5}, // $9C-$9F
-        {LDY, IMM, 2}, {LDA, IDX, 6}, {LDX, IMM, 2}, {LAX, IDX, 6}, // $A0-$A3
-        {LDY, ZPG, 3}, {LDA, ZPG, 3}, {LDX, ZPG, 3}, {LAX, ZPG, 3}, // $A4-$A7
-        {TAY, IMP, 2}, {LDA, IMM, 2}, {TAX, IMP, 2}, {LXA, IMM, 2}, // $A8-$AB
-        {LDY, ABS, 4}, {LDA, ABS, 4}, {LDX, ABS, 4}, {LAX, ABS, 4}, // $AC-$AF
-        {BCS, REL, 2}, {LDA, IDY, 5}, {JAM, IMP, 0}, {LAX, IDY, 5}, // $B0-$B3
-        {LDY, ZPX, 4}, {LDA, ZPX, 4}, {LDX, ZPY, 4}, {LAX, ZPY, 4}, // $B4-$B7
-        {CLV, IMP, 2}, {LDA, ABY, 4}, {TSX, IMP, 2}, {LAS, ABY, 4}, // $B8-$BB
-        {LDY, ABX, 4}, {LDA, ABX, 4}, {LDX, ABY, 4}, {LAX, ABY, 4}, // $BC-$BF
-        {CPY, IMM, 2}, {CMP, IDX, 6}, {NOP, IMM, 2}, {DCP, IDX, 8}, // $C0-$C3
-        {CPY, ZPG, 3}, {CMP, ZPG, 3}, {DEC, ZPG, 5}, {DCP, ZPG, 5}, // $C4-$C7
-        {INY, IMP, 2}, {CMP, IMM, 2}, {DEX, IMP, 2}, {SBX, IMM, 2}, // $C8-$CB
-        {CPY, ABS, 4}, {CMP, ABS, 4}, {DEC, ABS, 6}, {DCP, ABS, 6}, // $CC-$CF
-        {BNE, REL, 2}, {CMP, IDY, 5}, {JAM, IMP, 0}, {DCP, IDY, 8}, // $D0-$D3
-        {NOP, ZPX, 4}, {CMP, ZPX, 4}, {DEC, ZPX, 6}, {DCP, ZPX, 6}, // $D4-$D7
-        {CLD, IMP, 2}, {CMP, ABY, 4}, {NOP, IMP, 2}, {DCP, ABY, 7}, // $D8-$DB
-        {NOP, ABX, 4}, {CMP, ABX, 4}, {DEC, ABX, 7}, {DCP, ABX, 7}, // $DC-$DF
-        {CPX, IMM, 2}, {SBC, IDX, 6}, {NOP, IMM, 2}, {ISB, IDX, 8}, // $E0-$E3
-        {CPX, ZPG, 3}, {SBC, ZPG, 3}, {INC, ZPG, 5}, {ISB, ZPG, 5}, // $E4-$E7
-        {INX, IMP, 2}, {SBC, IMM, 2}, {NOP, IMP, 2}, {USB, IMM, 2}, // $E8-$EB
-        {CPX, ABS, 4}, {SBC, ABS, 4}, {INC, ABS, 6}, {ISB, ABS, 6}, // $EC-$EF
-        {BEQ, REL, 2}, {SBC, IDY, 5}, {JAM, IMP, 0}, {ISB, IDY, 8}, // $F0-$F3
-        {NOP, ZPX, 4}, {SBC, ZPX, 4}, {INC, ZPX, 6}, {ISB, ZPX, 6}, // $F4-$F7
-        {SED, IMP, 2}, {SBC, ABY, 4}, {NOP, IMP, 2}, {ISB, ABY, 7}, // $F8-$FB
-        {NOP, ABX, 4}, {SBC, ABX, 4}, {INC, ABX, 7}, {ISB, ABX, 7}, // $FC-$FF
+    CPU_INSTRUCTION_ENCODINGS(CPU_INSTRUCTION_ENCODING)
+};
+
+global const int32_t cpuAddressingModeOperandSizes[CPU_ADDRESSING_MODE_COUNT] = {
+    [IMP] = 0,
+    [ACC] = 0,
+    [IMM] = 1,
+    [ZPG] = 1,
+    [ZPX] = 1,
+    [ZPY] = 1,
+    [REL] = 1,
+    [ABS] = 2,
+    [ABX] = 2,
+    [ABY] = 2,
+    [IDR] = 2,
+    [IDX] = 1,
+    [IDY] = 1,
 };
 
 global const char *cpuInstructionCodeNames[CPU_INSTRUCTION_CODE_COUNT] = {
@@ -102,6 +132,127 @@ global const char *cpuInstructionCodeNames[CPU_INSTRUCTION_CODE_COUNT] = {
     "SHA", "SHX", "SHY", "SLO", "SRE", "TAS", "SBC",
 };
 
+#if CPU_PROFILE
+global const char *cpuAddressingModeNames[CPU_ADDRESSING_MODE_COUNT] = {
+    "IMP", "ACC", "IMM", "ZPG", "ZPX", "ZPY", "REL", "ABS", "ABX", "ABY", "IDR", "IDX", "IDY",
+};
+
+// Cycles past the base count come from page crosses, or for branches from being taken (+1)
+// and landing on another page (+1).
+internal FORCE_INLINE void
+profile_record(CpuProfile *profile, uint16_t pc, uint8_t opcode, uint32_t cyclesCount)
+{
+    profile->opcodeExecutionsCounts[opcode]++;
+    profile->opcodeCyclesCounts[opcode] += cyclesCount;
+    profile->pcExecutionsCounts[pc]++;
+    profile->pcCyclesCounts[pc] += cyclesCount;
+
+    CpuInstructionEncoding enc = instructionEncodings[opcode];
+    uint32_t extraCyclesCount = cyclesCount - enc.baseCyclesCount;
+    if (enc.addrMode == REL) {
+        profile->opcodeBranchesTakenCounts[opcode] += (extraCyclesCount >= 1);
+        profile->opcodePageCrossesCounts[opcode] += (extraCyclesCount >= 2);
+    }
+    else {
+        profile->opcodePageCrossesCounts[opcode] += (extraCyclesCount >= 1);
+    }
+}
+#endif
+
+// With lazy flags N and Z are derived from the last results and C/V are kept unpacked,
+// they are only folded into `p` when it's read. `isLazyFlags` is a compile-time constant
+// in the generated executors, so each flag update boils down to a single store.
+internal FORCE_INLINE uint8_t
+status_read(Cpu *cpu, bool isLazyFlags)
+{
+    uint8_t result = cpu->p;
+    if (isLazyFlags) {
+        result &= (uint8_t)~(CARRY | ZERO | OVERFLOW | NEGATIVE);
+        result |= (uint8_t)cpu->carry;
+        result |= (uint8_t)(cpu->zResult ? 0 : ZERO);
+        result |= (uint8_t)(cpu->overflow << 6);
+        result |= (uint8_t)(cpu->nResult & NEGATIVE);
+    }
+    return result;
+}
+
+internal FORCE_INLINE void
+status_write(Cpu *cpu, bool isLazyFlags, uint8_t value)
+{
+    cpu->p = value;
+    if (isLazyFlags) {
+        cpu->carry = value & CARRY;
+        cpu->zResult = !(value & ZERO);
+        cpu->overflow = value & OVERFLOW;
+        cpu->nResult = value & NEGATIVE;
+    }
+}
+
+internal FORCE_INLINE bool
+status_get(Cpu *cpu, bool isLazyFlags, CpuStatusFlag flag)
+{
+    bool result = CPU_STATUS_GET(cpu, flag);
+    if (isLazyFlags) {
+        switch (flag) {
+            case CARRY: {
+                result = cpu->carry;
+            } break;
+            case ZERO: {
+                result = !cpu->zResult;
+            } break;
+            case OVERFLOW: {
+                result = cpu->overflow;
+            } break;
+            case NEGATIVE: {
+                result = cpu->nResult & NEGATIVE;
+            } break;
+            default: {
+            }
+        }
+    }
+    return result;
+}
+
+internal FORCE_INLINE void
+status_update(Cpu *cpu, bool isLazyFlags, CpuStatusFlag flag, bool cond)
+{
+    if (isLazyFlags) {
+        switch (flag) {
+            case CARRY: {
+                cpu->carry = cond;
+            } break;
+            case ZERO: {
+                cpu->zResult = !cond;
+            } break;
+            case OVERFLOW: {
+                cpu->overflow = cond;
+            } break;
+            case NEGATIVE: {
+                cpu->nResult = cond ? NEGATIVE : 0;
+            } break;
+            default: {
+                CPU_STATUS_UPDATE(cpu, flag, cond);
+            }
+        }
+    }
+    else {
+        CPU_STATUS_UPDATE(cpu, flag, cond);
+    }
+}
+
+internal FORCE_INLINE void
+status_update_nz(Cpu *cpu, bool isLazyFlags, uint8_t r)
+{
+    if (isLazyFlags) {
+        cpu->nResult = r;
+        cpu->zResult = r;
+    }
+    else {
+        CPU_STATUS_UPDATE(cpu, ZERO, !r);
+        CPU_STATUS_UPDATE(cpu, NEGATIVE, r & NEGATIVE);
+    }
+}
+
 internal int32_t
 branch(Cpu *cpu, uint16_t newAddr)
 {
@@ -151,7 +302,7 @@ internal uint32_t
 handle_interrupt(Cpu *cpu)
 {
     push16(cpu, cpu->pc);
-    push(cpu, cpu->p | UNUSED);
+    push(cpu, cpu_status(cpu) | UNUSED);
 
     CPU_STATUS_SET(cpu, INTERRUPT_INHIBIT);
 
@@ -175,56 +326,100 @@ handle_interrupt(Cpu *cpu)
     return 7;
 }
 
-internal uint32_t
-handle_opcode(Cpu *cpu, uint8_t opcode)
+// The IRQ line is level-triggered: it's taken whenever it's asserted and I is clear, however
+// long it's been asserted.
+internal FORCE_INLINE void
+poll_irq(Cpu *cpu)
 {
-    CpuInstructionEncoding enc = instructionEncodings[opcode];
+    if (cpu->isIrqAsserted && (cpu->interrupt == NOI) && !CPU_STATUS_GET(cpu, INTERRUPT_INHIBIT)) {
+        cpu->interrupt = IRQ;
+    }
+}
 
-    uint32_t cyclesCount = enc.baseCyclesCount;
+internal FORCE_INLINE uint8_t
+load(Cpu *cpu, CpuAddressingMode addrMode, uint16_t addr)
+{
+    // Immediate operands are resolved to the value itself, everything else to an address.
+    uint8_t result = (addrMode == IMM) ? (uint8_t)addr : mmu_cpu_read(cpu->mmu, addr);
+    return result;
+}
+
+// Reads the byte at `pc` and moves past it, straight from the fetch page unless `pc` left it.
+internal FORCE_INLINE uint8_t
+fetch(Cpu *cpu, bool isOpcode)
+{
+    uint16_t pc = cpu->pc++;
+    if ((pc >> 8) != cpu->fetchPageIndex) {
+        cpu->fetchPageIndex = pc >> 8;
+        cpu->fetchPage = cpu->mmu->fetchPages[pc >> 8];
+    }
+    uint8_t result = cpu->fetchPage ? cpu->fetchPage[pc & 0xFF] : mmu_cpu_fetch(cpu->mmu, pc, isOpcode);
+    return result;
+}
+
+internal FORCE_INLINE uint16_t
+fetch_operand(Cpu *cpu, CpuAddressingMode addrMode)
+{
+    uint16_t operand = 0;
+    int32_t operandSize = cpuAddressingModeOperandSizes[addrMode];
+    if (operandSize == 1) {
+        operand = fetch(cpu, false);
+    }
+    else if (operandSize == 2) {
+        uint8_t lo = fetch(cpu, false);
+        uint8_t hi = fetch(cpu, false);
+        operand = (uint16_t)((hi << 8) | lo);
+    }
+    return operand;
+}
+
+// Expects the operand to be already fetched, i.e. `pc` pointing to the next instruction.
+// Always inlined so that the per-opcode handlers get both switches folded away.
+internal FORCE_INLINE uint32_t
+execute(Cpu *cpu, CpuInstructionCode code, CpuAddressingMode addrMode, uint32_t baseCyclesCount, uint16_t operand,
+        bool isLazyFlags)
+{
+    uint32_t cyclesCount = baseCyclesCount;
     uint16_t addr = 0;
     bool pageCrossed = false;
-    switch (enc.addrMode) {
+    switch (addrMode) {
         case IMP:
         case ACC: {
         } break;
         case IMM: {
-            addr = cpu->pc++;
+            addr = operand;
         } break;
         case ZPG: {
-            addr = mmu_cpu_read(cpu->mmu, cpu->pc++);
+            addr = operand;
         } break;
         case ZPX: {
-            uint8_t arg = mmu_cpu_read(cpu->mmu, cpu->pc++);
+            uint8_t arg = (uint8_t)operand;
             addr = (arg + cpu->x) & 0xFF;
         } break;
         case ZPY: {
-            uint8_t arg = mmu_cpu_read(cpu->mmu, cpu->pc++);
+            uint8_t arg = (uint8_t)operand;
             addr = (arg + cpu->y) & 0xFF;
         } break;
         case REL: {
-            uint8_t arg = mmu_cpu_read(cpu->mmu, cpu->pc++);
+            uint8_t arg = (uint8_t)operand;
             int32_t offset = (int32_t)(*((int8_t *)&arg));
             addr = (uint16_t)((int32_t)cpu->pc + offset);
         } break;
         case ABS: {
-            addr = mmu_cpu_read16(cpu->mmu, cpu->pc);
-            cpu->pc += 2;
+            addr = operand;
         } break;
         case ABX: {
-            uint16_t arg = mmu_cpu_read16(cpu->mmu, cpu->pc);
-            cpu->pc += 2;
+            uint16_t arg = operand;
             addr = arg + cpu->x;
             pageCrossed = ((arg & 0xFF00) != (addr & 0xFF00));
         } break;
         case ABY: {
-            uint16_t arg = mmu_cpu_read16(cpu->mmu, cpu->pc);
-            cpu->pc += 2;
+            uint16_t arg = operand;
             addr = arg + cpu->y;
             pageCrossed = ((arg & 0xFF00) != (addr & 0xFF00));
         } break;
         case IDR: {
-            uint16_t arg = mmu_cpu_read16(cpu->mmu, cpu->pc);
-            cpu->pc += 2;
+            uint16_t arg = operand;
 
             if ((arg & 0x00FF) == 0x00FF) {
                 // HW bug when the page boundary is crossed
@@ -235,7 +430,7 @@ handle_opcode(Cpu *cpu, uint8_t opcode)
             }
         } break;
         case IDX: {
-            uint8_t arg = mmu_cpu_read(cpu->mmu, cpu->pc++);
+            uint8_t arg = (uint8_t)operand;
 
             uint16_t loAddr = (arg + cpu->x) & 0xFF;
             uint8_t loAddrAbs = mmu_cpu_read(cpu->mmu, loAddr);
@@ -246,7 +441,7 @@ handle_opcode(Cpu *cpu, uint8_t opcode)
             addr = (uint16_t)((hiAddrAbs << 8) | loAddrAbs);
         } break;
         case IDY: {
-            uint8_t arg = mmu_cpu_read(cpu->mmu, cpu->pc++);
+            uint8_t arg = (uint8_t)operand;
 
             uint16_t loAddr = arg;
             uint8_t loAddrTmp = mmu_cpu_read(cpu->mmu, loAddr);
@@ -263,16 +458,15 @@ handle_opcode(Cpu *cpu, uint8_t opcode)
         }
     }
 
-    switch (enc.code) {
+    switch (code) {
         // official
         case ADC: {
             uint16_t a = cpu->a;
-            uint16_t m = mmu_cpu_read(cpu->mmu, addr);
-            uint16_t r = (uint16_t)(a + m + (uint16_t)CPU_STATUS_GET(cpu, CARRY));
+            uint16_t m = load(cpu, addrMode, addr);
+            uint16_t r = (uint16_t)(a + m + (uint16_t)status_get(cpu, isLazyFlags, CARRY));
 
-            CPU_STATUS_UPDATE(cpu, CARRY, r & 0xFF00);
-            CPU_STATUS_UPDATE(cpu, ZERO, !(r & 0xFF));
-            CPU_STATUS_UPDATE(cpu, NEGATIVE, r & NEGATIVE);
+            status_update(cpu, isLazyFlags, CARRY, r & 0xFF00);
+            status_update_nz(cpu, isLazyFlags, (uint8_t)(r & 0xFF));
             //   A + M = R
             //   +   +   +
             //   +   +   -  <- overflow
@@ -282,7 +476,7 @@ handle_opcode(Cpu *cpu, uint8_t opcode)
             //   -   +   -
             //   -   -   +  <- overflow
             //   -   -   -
-            CPU_STATUS_UPDATE(cpu, OVERFLOW, (a ^ r) & (m ^ r) & 0x80);
+            status_update(cpu, isLazyFlags, OVERFLOW, (a ^ r) & (m ^ r) & 0x80);
 
             cpu->a = (uint8_t)(r & 0xFF);
 
@@ -291,11 +485,10 @@ handle_opcode(Cpu *cpu, uint8_t opcode)
             }
         } break;
         case AND: {
-            uint8_t m = mmu_cpu_read(cpu->mmu, addr);
+            uint8_t m = load(cpu, addrMode, addr);
             uint8_t r = cpu->a & m;
 
-            CPU_STATUS_UPDATE(cpu, ZERO, !r);
-            CPU_STATUS_UPDATE(cpu, NEGATIVE, r & NEGATIVE);
+            status_update_nz(cpu, isLazyFlags, r);
 
             cpu->a = r;
 
@@ -304,155 +497,147 @@ handle_opcode(Cpu *cpu, uint8_t opcode)
             }
         } break;
         case ASL: {
-            if (enc.addrMode == ACC) {
+            if (addrMode == ACC) {
                 uint16_t a = cpu->a;
                 uint16_t r = a << 1;
 
-                CPU_STATUS_UPDATE(cpu, CARRY, r & 0xFF00);
-                CPU_STATUS_UPDATE(cpu, ZERO, !(r & 0xFF));
-                CPU_STATUS_UPDATE(cpu, NEGATIVE, r & NEGATIVE);
+                status_update(cpu, isLazyFlags, CARRY, r & 0xFF00);
+                status_update_nz(cpu, isLazyFlags, (uint8_t)(r & 0xFF));
 
                 cpu->a = (uint8_t)(r & 0xFF);
             }
             else {
-                uint16_t m = mmu_cpu_read(cpu->mmu, addr);
+                uint16_t m = load(cpu, addrMode, addr);
                 uint16_t r = m << 1;
 
-                CPU_STATUS_UPDATE(cpu, CARRY, r & 0xFF00);
-                CPU_STATUS_UPDATE(cpu, ZERO, !(r & 0xFF));
-                CPU_STATUS_UPDATE(cpu, NEGATIVE, r & NEGATIVE);
+                status_update(cpu, isLazyFlags, CARRY, r & 0xFF00);
+                status_update_nz(cpu, isLazyFlags, (uint8_t)(r & 0xFF));
 
                 mmu_cpu_write(cpu->mmu, addr, (uint8_t)(r & 0xFF));
             }
         } break;
         case BCC: {
-            if (!CPU_STATUS_GET(cpu, CARRY)) {
+            if (!status_get(cpu, isLazyFlags, CARRY)) {
                 cyclesCount += branch(cpu, addr);
             }
         } break;
         case BCS: {
-            if (CPU_STATUS_GET(cpu, CARRY)) {
+            if (status_get(cpu, isLazyFlags, CARRY)) {
                 cyclesCount += branch(cpu, addr);
             }
         } break;
         case BEQ: {
-            if (CPU_STATUS_GET(cpu, ZERO)) {
+            if (status_get(cpu, isLazyFlags, ZERO)) {
                 cyclesCount += branch(cpu, addr);
             }
         } break;
         case BIT: {
-            uint8_t m = mmu_cpu_read(cpu->mmu, addr);
+            uint8_t m = load(cpu, addrMode, addr);
             uint8_t r = cpu->a & m;
 
-            CPU_STATUS_UPDATE(cpu, ZERO, !r);
-            CPU_STATUS_UPDATE(cpu, OVERFLOW, m & OVERFLOW);
-            CPU_STATUS_UPDATE(cpu, NEGATIVE, m & NEGATIVE);
+            status_update(cpu, isLazyFlags, ZERO, !r);
+            status_update(cpu, isLazyFlags, OVERFLOW, m & OVERFLOW);
+            status_update(cpu, isLazyFlags, NEGATIVE, m & NEGATIVE);
         } break;
         case BMI: {
-            if (CPU_STATUS_GET(cpu, NEGATIVE)) {
+            if (status_get(cpu, isLazyFlags, NEGATIVE)) {
                 cyclesCount += branch(cpu, addr);
             }
         } break;
         case BNE: {
-            if (!CPU_STATUS_GET(cpu, ZERO)) {
+            if (!status_get(cpu, isLazyFlags, ZERO)) {
                 cyclesCount += branch(cpu, addr);
             }
         } break;
         case BPL: {
-            if (!CPU_STATUS_GET(cpu, NEGATIVE)) {
+            if (!status_get(cpu, isLazyFlags, NEGATIVE)) {
                 cyclesCount += branch(cpu, addr);
             }
         } break;
         case BRK: {
             push16(cpu,  cpu->pc + 1);
-            push(cpu, cpu->p | BREAK | UNUSED);
+            push(cpu, status_read(cpu, isLazyFlags) | BREAK | UNUSED);
 
             CPU_STATUS_SET(cpu, INTERRUPT_INHIBIT);
 
             cpu->pc = mmu_cpu_read16(cpu->mmu, CPU_IRQ_ADDR_LO);
         } break;
         case BVC: {
-            if (!CPU_STATUS_GET(cpu, OVERFLOW)) {
+            if (!status_get(cpu, isLazyFlags, OVERFLOW)) {
                 cyclesCount += branch(cpu, addr);
             }
         } break;
         case BVS: {
-            if (CPU_STATUS_GET(cpu, OVERFLOW)) {
+            if (status_get(cpu, isLazyFlags, OVERFLOW)) {
                 cyclesCount += branch(cpu, addr);
             }
         } break;
         case CLC: {
-            CPU_STATUS_CLEAR(cpu, CARRY);
+            status_update(cpu, isLazyFlags, CARRY, false);
         } break;
         case CLD: {
             CPU_STATUS_CLEAR(cpu, DECIMAL_MODE);
         } break;
         case CLI: {
             CPU_STATUS_CLEAR(cpu, INTERRUPT_INHIBIT);
+            poll_irq(cpu);
         } break;
         case CLV: {
-            CPU_STATUS_CLEAR(cpu, OVERFLOW);
+            status_update(cpu, isLazyFlags, OVERFLOW, false);
         } break;
         case CMP: {
-            uint8_t m = mmu_cpu_read(cpu->mmu, addr);
+            uint8_t m = load(cpu, addrMode, addr);
             uint8_t r = cpu->a - m;
 
-            CPU_STATUS_UPDATE(cpu, CARRY, cpu->a >= m);
-            CPU_STATUS_UPDATE(cpu, ZERO, cpu->a == m);
-            CPU_STATUS_UPDATE(cpu, NEGATIVE, r & NEGATIVE);
+            status_update(cpu, isLazyFlags, CARRY, cpu->a >= m);
+            status_update_nz(cpu, isLazyFlags, r);
 
             if (pageCrossed) {
                 cyclesCount++;
             }
         } break;
         case CPX: {
-            uint8_t m = mmu_cpu_read(cpu->mmu, addr);
+            uint8_t m = load(cpu, addrMode, addr);
             uint8_t r = cpu->x - m;
 
-            CPU_STATUS_UPDATE(cpu, CARRY, cpu->x >= m);
-            CPU_STATUS_UPDATE(cpu, ZERO, cpu->x == m);
-            CPU_STATUS_UPDATE(cpu, NEGATIVE, r & NEGATIVE);
+            status_update(cpu, isLazyFlags, CARRY, cpu->x >= m);
+            status_update_nz(cpu, isLazyFlags, r);
         } break;
         case CPY: {
-            uint8_t m = mmu_cpu_read(cpu->mmu, addr);
+            uint8_t m = load(cpu, addrMode, addr);
             uint8_t r = cpu->y - m;
 
-            CPU_STATUS_UPDATE(cpu, CARRY, cpu->y >= m);
-            CPU_STATUS_UPDATE(cpu, ZERO, cpu->y == m);
-            CPU_STATUS_UPDATE(cpu, NEGATIVE, r & NEGATIVE);
+            status_update(cpu, isLazyFlags, CARRY, cpu->y >= m);
+            status_update_nz(cpu, isLazyFlags, r);
         } break;
         case DEC: {
-            uint8_t m = mmu_cpu_read(cpu->mmu, addr);
+            uint8_t m = load(cpu, addrMode, addr);
             uint8_t r = (uint8_t)(m - 1);
 
-            CPU_STATUS_UPDATE(cpu, ZERO, !r);
-            CPU_STATUS_UPDATE(cpu, NEGATIVE, r & NEGATIVE);
+            status_update_nz(cpu, isLazyFlags, r);
 
             mmu_cpu_write(cpu->mmu, addr, r);
         } break;
         case DEX: {
             uint8_t r = cpu->x - 1;
 
-            CPU_STATUS_UPDATE(cpu, ZERO, !r);
-            CPU_STATUS_UPDATE(cpu, NEGATIVE, r & NEGATIVE);
+            status_update_nz(cpu, isLazyFlags, r);
 
             cpu->x = r;
         } break;
         case DEY: {
             uint8_t r = cpu->y - 1;
 
-            CPU_STATUS_UPDATE(cpu, ZERO, !r);
-            CPU_STATUS_UPDATE(cpu, NEGATIVE, r & NEGATIVE);
+            status_update_nz(cpu, isLazyFlags, r);
 
             cpu->y = r;
         } break;
         case EOR: {
             uint8_t a = cpu->a;
-            uint8_t m = mmu_cpu_read(cpu->mmu, addr);
+            uint8_t m = load(cpu, addrMode, addr);
             uint8_t r = a ^ m;
 
-            CPU_STATUS_UPDATE(cpu, ZERO, !r);
-            CPU_STATUS_UPDATE(cpu, NEGATIVE, r & NEGATIVE);
+            status_update_nz(cpu, isLazyFlags, r);
 
             cpu->a = r;
 
@@ -461,27 +646,24 @@ handle_opcode(Cpu *cpu, uint8_t opcode)
             }
         } break;
         case INC: {
-            uint8_t m = mmu_cpu_read(cpu->mmu, addr);
+            uint8_t m = load(cpu, addrMode, addr);
             uint8_t r = m + 1;
 
-            CPU_STATUS_UPDATE(cpu, ZERO, !r);
-            CPU_STATUS_UPDATE(cpu, NEGATIVE, r & NEGATIVE);
+            status_update_nz(cpu, isLazyFlags, r);
 
             mmu_cpu_write(cpu->mmu, addr, r);
         } break;
         case INX: {
             uint8_t r = cpu->x + 1;
 
-            CPU_STATUS_UPDATE(cpu, ZERO, !r);
-            CPU_STATUS_UPDATE(cpu, NEGATIVE, r & NEGATIVE);
+            status_update_nz(cpu, isLazyFlags, r);
 
             cpu->x = r;
         } break;
         case INY: {
             uint8_t r = cpu->y + 1;
 
-            CPU_STATUS_UPDATE(cpu, ZERO, !r);
-            CPU_STATUS_UPDATE(cpu, NEGATIVE, r & NEGATIVE);
+            status_update_nz(cpu, isLazyFlags, r);
 
             cpu->y = r;
         } break;
@@ -493,10 +675,9 @@ handle_opcode(Cpu *cpu, uint8_t opcode)
             cpu->pc = addr;
         } break;
         case LDA: {
-            uint8_t m = mmu_cpu_read(cpu->mmu, addr);
+            uint8_t m = load(cpu, addrMode, addr);
 
-            CPU_STATUS_UPDATE(cpu, ZERO, !m);
-            CPU_STATUS_UPDATE(cpu, NEGATIVE, m & 0x80);
+            status_update_nz(cpu, isLazyFlags, m);
 
             cpu->a = m;
 
@@ -505,10 +686,9 @@ handle_opcode(Cpu *cpu, uint8_t opcode)
             }
         } break;
         case LDX: {
-            uint8_t m = mmu_cpu_read(cpu->mmu, addr);
+            uint8_t m = load(cpu, addrMode, addr);
 
-            CPU_STATUS_UPDATE(cpu, ZERO, !m);
-            CPU_STATUS_UPDATE(cpu, NEGATIVE, m & 0x80);
+            status_update_nz(cpu, isLazyFlags, m);
 
             cpu->x = m;
 
@@ -517,10 +697,9 @@ handle_opcode(Cpu *cpu, uint8_t opcode)
             }
         } break;
         case LDY: {
-            uint8_t m = mmu_cpu_read(cpu->mmu, addr);
+            uint8_t m = load(cpu, addrMode, addr);
 
-            CPU_STATUS_UPDATE(cpu, ZERO, !m);
-            CPU_STATUS_UPDATE(cpu, NEGATIVE, m & 0x80);
+            status_update_nz(cpu, isLazyFlags, m);
 
             cpu->y = m;
 
@@ -529,23 +708,21 @@ handle_opcode(Cpu *cpu, uint8_t opcode)
             }
         } break;
         case LSR: {
-            if (enc.addrMode == ACC) {
+            if (addrMode == ACC) {
                 uint8_t a = cpu->a;
                 uint8_t r = a >> 1;
 
-                CPU_STATUS_UPDATE(cpu, CARRY, a & 1);
-                CPU_STATUS_UPDATE(cpu, ZERO, !r);
-                CPU_STATUS_UPDATE(cpu, NEGATIVE, r & NEGATIVE);
+                status_update(cpu, isLazyFlags, CARRY, a & 1);
+                status_update_nz(cpu, isLazyFlags, r);
 
                 cpu->a = r;
             }
             else {
-                uint8_t m = mmu_cpu_read(cpu->mmu, addr);
+                uint8_t m = load(cpu, addrMode, addr);
                 uint8_t r = m >> 1;
 
-                CPU_STATUS_UPDATE(cpu, CARRY, m & 1);
-                CPU_STATUS_UPDATE(cpu, ZERO, !r);
-                CPU_STATUS_UPDATE(cpu, NEGATIVE, r & NEGATIVE);
+                status_update(cpu, isLazyFlags, CARRY, m & 1);
+                status_update_nz(cpu, isLazyFlags, r);
 
                 mmu_cpu_write(cpu->mmu, addr, r);
             }
@@ -556,11 +733,10 @@ handle_opcode(Cpu *cpu, uint8_t opcode)
             }
         } break;
         case ORA: {
-            uint8_t m = mmu_cpu_read(cpu->mmu, addr);
+            uint8_t m = load(cpu, addrMode, addr);
             uint8_t r = cpu->a | m;
 
-            CPU_STATUS_UPDATE(cpu, ZERO, !r);
-            CPU_STATUS_UPDATE(cpu, NEGATIVE, r & NEGATIVE);
+            status_update_nz(cpu, isLazyFlags, r);
 
             cpu->a = r;
 
@@ -572,80 +748,74 @@ handle_opcode(Cpu *cpu, uint8_t opcode)
             push(cpu, cpu->a);
         } break;
         case PHP: {
-            push(cpu, cpu->p | BREAK | UNUSED);
+            push(cpu, status_read(cpu, isLazyFlags) | BREAK | UNUSED);
         } break;
         case PLA: {
             uint8_t r = pop(cpu);
 
-            CPU_STATUS_UPDATE(cpu, ZERO, !r);
-            CPU_STATUS_UPDATE(cpu, NEGATIVE, r & NEGATIVE);
+            status_update_nz(cpu, isLazyFlags, r);
 
             cpu->a = r;
         } break;
         case PLP: {
-            cpu->p = pop(cpu) | UNUSED;
-            CPU_STATUS_CLEAR(cpu, BREAK);
+            status_write(cpu, isLazyFlags, (uint8_t)((pop(cpu) | UNUSED) & ~BREAK));
+            poll_irq(cpu);
         } break;
         case ROL: {
-            if (enc.addrMode == ACC) {
+            if (addrMode == ACC) {
                 uint8_t a = cpu->a;
-                uint8_t r = (uint8_t)((a << 1) | (uint8_t)CPU_STATUS_GET(cpu, CARRY));
+                uint8_t r = (uint8_t)((a << 1) | (uint8_t)status_get(cpu, isLazyFlags, CARRY));
 
-                CPU_STATUS_UPDATE(cpu, CARRY, a & 0x80);
-                CPU_STATUS_UPDATE(cpu, ZERO, !r);
-                CPU_STATUS_UPDATE(cpu, NEGATIVE, r & NEGATIVE);
+                status_update(cpu, isLazyFlags, CARRY, a & 0x80);
+                status_update_nz(cpu, isLazyFlags, r);
 
                 cpu->a = r;
             }
             else {
-                uint8_t m = mmu_cpu_read(cpu->mmu, addr);
-                uint8_t r = (uint8_t)((m << 1) | (uint8_t)CPU_STATUS_GET(cpu, CARRY));
+                uint8_t m = load(cpu, addrMode, addr);
+                uint8_t r = (uint8_t)((m << 1) | (uint8_t)status_get(cpu, isLazyFlags, CARRY));
 
-                CPU_STATUS_UPDATE(cpu, CARRY, m & 0x80);
-                CPU_STATUS_UPDATE(cpu, ZERO, !r);
-                CPU_STATUS_UPDATE(cpu, NEGATIVE, r & NEGATIVE);
+                status_update(cpu, isLazyFlags, CARRY, m & 0x80);
+                status_update_nz(cpu, isLazyFlags, r);
 
                 mmu_cpu_write(cpu->mmu, addr, r);
             }
         } break;
         case ROR: {
-            if (enc.addrMode == ACC) {
+            if (addrMode == ACC) {
                 uint8_t a = cpu->a;
-                uint8_t r = (uint8_t)((a >> 1) | ((uint8_t)CPU_STATUS_GET(cpu, CARRY) << 7));
+                uint8_t r = (uint8_t)((a >> 1) | ((uint8_t)status_get(cpu, isLazyFlags, CARRY) << 7));
 
-                CPU_STATUS_UPDATE(cpu, CARRY, a & 1);
-                CPU_STATUS_UPDATE(cpu, ZERO, !r);
-                CPU_STATUS_UPDATE(cpu, NEGATIVE, r & NEGATIVE);
+                status_update(cpu, isLazyFlags, CARRY, a & 1);
+                status_update_nz(cpu, isLazyFlags, r);
 
                 cpu->a = r;
             }
             else {
-                uint8_t m = mmu_cpu_read(cpu->mmu, addr);
-                uint8_t r = (uint8_t)((m >> 1) | ((uint8_t)CPU_STATUS_GET(cpu, CARRY) << 7));
+                uint8_t m = load(cpu, addrMode, addr);
+                uint8_t r = (uint8_t)((m >> 1) | ((uint8_t)status_get(cpu, isLazyFlags, CARRY) << 7));
 
-                CPU_STATUS_UPDATE(cpu, CARRY, m & 1);
-                CPU_STATUS_UPDATE(cpu, ZERO, !r);
-                CPU_STATUS_UPDATE(cpu, NEGATIVE, r & NEGATIVE);
+                status_update(cpu, isLazyFlags, CARRY, m & 1);
+                status_update_nz(cpu, isLazyFlags, r);
 
                 mmu_cpu_write(cpu->mmu, addr, r);
             }
         } break;
         case RTI: {
-            cpu->p = pop(cpu) | UNUSED;
+            status_write(cpu, isLazyFlags, (uint8_t)((pop(cpu) | UNUSED) & ~BREAK));
             cpu->pc = pop16(cpu);
-            CPU_STATUS_CLEAR(cpu, BREAK);
+            poll_irq(cpu);
         } break;
         case RTS: {
             cpu->pc = pop16(cpu) + 1;
         } break;
         case SBC: {
             uint16_t a = cpu->a;
-            uint16_t m = mmu_cpu_read(cpu->mmu, addr);
-            uint16_t r = (uint16_t)(a - m - (uint16_t)!CPU_STATUS_GET(cpu, CARRY));
+            uint16_t m = load(cpu, addrMode, addr);
+            uint16_t r = (uint16_t)(a - m - (uint16_t)!status_get(cpu, isLazyFlags, CARRY));
 
-            CPU_STATUS_UPDATE(cpu, CARRY, !(r & 0xFF00));
-            CPU_STATUS_UPDATE(cpu, ZERO, !(r & 0xFF));
-            CPU_STATUS_UPDATE(cpu, NEGATIVE, r & NEGATIVE);
+            status_update(cpu, isLazyFlags, CARRY, !(r & 0xFF00));
+            status_update_nz(cpu, isLazyFlags, (uint8_t)(r & 0xFF));
             //   A - M = R
             //   +   +   +
             //   +   +   -
@@ -655,7 +825,7 @@ handle_opcode(Cpu *cpu, uint8_t opcode)
             //   -   +   -
             //   -   -   +
             //   -   -   -
-            CPU_STATUS_UPDATE(cpu, OVERFLOW, (a ^ m) & (a ^ r) & 0x80);
+            status_update(cpu, isLazyFlags, OVERFLOW, (a ^ m) & (a ^ r) & 0x80);
 
             cpu->a = (uint8_t)(r & 0xFF);
 
@@ -664,7 +834,7 @@ handle_opcode(Cpu *cpu, uint8_t opcode)
             }
         } break;
         case SEC: {
-            CPU_STATUS_SET(cpu, CARRY);
+            status_update(cpu, isLazyFlags, CARRY, true);
         } break;
         case SED: {
             CPU_STATUS_SET(cpu, DECIMAL_MODE);
@@ -684,32 +854,28 @@ handle_opcode(Cpu *cpu, uint8_t opcode)
         case TAX: {
             uint8_t r = cpu->a;
 
-            CPU_STATUS_UPDATE(cpu, ZERO, !r);
-            CPU_STATUS_UPDATE(cpu, NEGATIVE, r & NEGATIVE);
+            status_update_nz(cpu, isLazyFlags, r);
 
             cpu->x = r;
         } break;
         case TAY: {
             uint8_t r = cpu->a;
 
-            CPU_STATUS_UPDATE(cpu, ZERO, !r);
-            CPU_STATUS_UPDATE(cpu, NEGATIVE, r & NEGATIVE);
+            status_update_nz(cpu, isLazyFlags, r);
 
             cpu->y = r;
         } break;
         case TSX: {
             uint8_t r = cpu->sp;
 
-            CPU_STATUS_UPDATE(cpu, ZERO, !r);
-            CPU_STATUS_UPDATE(cpu, NEGATIVE, r & NEGATIVE);
+            status_update_nz(cpu, isLazyFlags, r);
 
             cpu->x = r;
         } break;
         case TXA: {
             uint8_t r = cpu->x;
 
-            CPU_STATUS_UPDATE(cpu, ZERO, !r);
-            CPU_STATUS_UPDATE(cpu, NEGATIVE, r & NEGATIVE);
+            status_update_nz(cpu, isLazyFlags, r);
 
             cpu->a = r;
         } break;
@@ -720,8 +886,7 @@ handle_opcode(Cpu *cpu, uint8_t opcode)
         case TYA: {
             uint8_t r = cpu->y;
 
-            CPU_STATUS_UPDATE(cpu, ZERO, !r);
-            CPU_STATUS_UPDATE(cpu, NEGATIVE, r & NEGATIVE);
+            status_update_nz(cpu, isLazyFlags, r);
 
             cpu->a = r;
         } break;
@@ -729,25 +894,25 @@ handle_opcode(Cpu *cpu, uint8_t opcode)
         // unofficial
         case ALR: {
             uint8_t a = cpu->a;
-            uint8_t m = mmu_cpu_read(cpu->mmu, addr);
+            uint8_t m = load(cpu, addrMode, addr);
             uint8_t r = (uint8_t)(a & m);
 
-            CPU_STATUS_UPDATE(cpu, CARRY, r & 1);
+            status_update(cpu, isLazyFlags, CARRY, r & 1);
 
             r >>= 1;
 
-            CPU_STATUS_UPDATE(cpu, ZERO, !r);
-            CPU_STATUS_CLEAR(cpu, NEGATIVE);
+            status_update_nz(cpu, isLazyFlags, r); // bit 7 is always clear after the shift
 
             cpu->a = r;
         } break;
         case ANC: {
             uint8_t a = cpu->a;
-            uint8_t m = mmu_cpu_read(cpu->mmu, addr);
+            uint8_t m = load(cpu, addrMode, addr);
             uint8_t r = (uint8_t)(a & m);
 
-            CPU_STATUS_UPDATE(cpu, ZERO, !r);
-            CPU_STATUS_UPDATE(cpu, CARRY | NEGATIVE, r & NEGATIVE);
+            status_update(cpu, isLazyFlags, ZERO, !r);
+            status_update(cpu, isLazyFlags, CARRY, r & NEGATIVE);
+            status_update(cpu, isLazyFlags, NEGATIVE, r & NEGATIVE);
 
             cpu->a = r;
         } break;
@@ -755,47 +920,43 @@ handle_opcode(Cpu *cpu, uint8_t opcode)
             uint8_t a = cpu->a;
             uint8_t v = 0xFF; // could be 0x00, 0xEE, 0xEF, 0xFE or 0xFF
             uint8_t x = cpu->x;
-            uint8_t m = mmu_cpu_read(cpu->mmu, addr);
+            uint8_t m = load(cpu, addrMode, addr);
             uint8_t r = (uint8_t)((a | v) & x & m);
 
-            CPU_STATUS_UPDATE(cpu, ZERO, !r);
-            CPU_STATUS_UPDATE(cpu, NEGATIVE, r & NEGATIVE);
+            status_update_nz(cpu, isLazyFlags, r);
 
             cpu->a = r;
         } break;
         case ARR: {
             uint8_t a = cpu->a;
-            uint8_t m = mmu_cpu_read(cpu->mmu, addr);
-            uint8_t r = ((uint8_t)((a & m) >> 1)) | ((uint8_t)CPU_STATUS_GET(cpu, CARRY) << 7);
+            uint8_t m = load(cpu, addrMode, addr);
+            uint8_t r = ((uint8_t)((a & m) >> 1)) | ((uint8_t)status_get(cpu, isLazyFlags, CARRY) << 7);
 
-            CPU_STATUS_UPDATE(cpu, CARRY, r & 0x40);
-            CPU_STATUS_UPDATE(cpu, OVERFLOW, ((r >> 6) ^ (r >> 5)) & 1);
-            CPU_STATUS_UPDATE(cpu, ZERO, !r);
-            CPU_STATUS_UPDATE(cpu, NEGATIVE, r & NEGATIVE);
+            status_update(cpu, isLazyFlags, CARRY, r & 0x40);
+            status_update(cpu, isLazyFlags, OVERFLOW, ((r >> 6) ^ (r >> 5)) & 1);
+            status_update_nz(cpu, isLazyFlags, r);
 
             cpu->a = r;
         } break;
         case DCP: {
             uint8_t a = cpu->a;
-            uint8_t m = mmu_cpu_read(cpu->mmu, addr);
+            uint8_t m = load(cpu, addrMode, addr);
             uint8_t r = (uint8_t)(m - 1);
             uint8_t d = (uint8_t)(a - r);
 
-            CPU_STATUS_UPDATE(cpu, CARRY, a >= r);
-            CPU_STATUS_UPDATE(cpu, ZERO, a == r);
-            CPU_STATUS_UPDATE(cpu, NEGATIVE, d & NEGATIVE);
+            status_update(cpu, isLazyFlags, CARRY, a >= r);
+            status_update_nz(cpu, isLazyFlags, d);
 
             mmu_cpu_write(cpu->mmu, addr, r);
         } break;
         case ISB: {
             uint16_t a = cpu->a;
-            uint16_t m = mmu_cpu_read(cpu->mmu, addr);
+            uint16_t m = load(cpu, addrMode, addr);
             uint16_t m1 = (uint16_t)((m + 1) & 0xFF);
-            uint16_t r = (uint16_t)(a - m1 - (uint16_t)!CPU_STATUS_GET(cpu, CARRY));
+            uint16_t r = (uint16_t)(a - m1 - (uint16_t)!status_get(cpu, isLazyFlags, CARRY));
 
-            CPU_STATUS_UPDATE(cpu, CARRY, !(r & 0xFF00));
-            CPU_STATUS_UPDATE(cpu, ZERO, !(r & 0xFF));
-            CPU_STATUS_UPDATE(cpu, NEGATIVE, r & NEGATIVE);
+            status_update(cpu, isLazyFlags, CARRY, !(r & 0xFF00));
+            status_update_nz(cpu, isLazyFlags, (uint8_t)(r & 0xFF));
             //   A - M = R
             //   +   +   +
             //   +   +   -
@@ -805,7 +966,7 @@ handle_opcode(Cpu *cpu, uint8_t opcode)
             //   -   +   -
             //   -   -   +
             //   -   -   -
-            CPU_STATUS_UPDATE(cpu, OVERFLOW, (a ^ m1) & (a ^ r) & 0x80);
+            status_update(cpu, isLazyFlags, OVERFLOW, (a ^ m1) & (a ^ r) & 0x80);
 
             mmu_cpu_write(cpu->mmu, addr, (uint8_t)(m1 & 0xFF));
             cpu->a = (uint8_t)(r & 0xFF);
@@ -815,11 +976,10 @@ handle_opcode(Cpu *cpu, uint8_t opcode)
         } break;
         case LAS: {
             uint8_t sp = cpu->sp;
-            uint8_t m = mmu_cpu_read(cpu->mmu, addr);
+            uint8_t m = load(cpu, addrMode, addr);
             uint8_t r = sp & m;
 
-            CPU_STATUS_UPDATE(cpu, ZERO, !r);
-            CPU_STATUS_UPDATE(cpu, NEGATIVE, r & NEGATIVE);
+            status_update_nz(cpu, isLazyFlags, r);
 
             cpu->sp = cpu->a = cpu->x = r;
 
@@ -828,10 +988,9 @@ handle_opcode(Cpu *cpu, uint8_t opcode)
             }
         } break;
         case LAX: {
-            uint8_t m = mmu_cpu_read(cpu->mmu, addr);
+            uint8_t m = load(cpu, addrMode, addr);
 
-            CPU_STATUS_UPDATE(cpu, ZERO, !m);
-            CPU_STATUS_UPDATE(cpu, NEGATIVE, m & NEGATIVE);
+            status_update_nz(cpu, isLazyFlags, m);
 
             cpu->a = cpu->x = m;
 
@@ -842,11 +1001,10 @@ handle_opcode(Cpu *cpu, uint8_t opcode)
         case LXA: {
             uint8_t a = cpu->a;
             uint8_t v = 0xFF; // could be 0x00, 0xEE, 0xEF, 0xFE or 0xFF
-            uint8_t m = mmu_cpu_read(cpu->mmu, addr);
+            uint8_t m = load(cpu, addrMode, addr);
             uint8_t r = (uint8_t)((a | v) & m);
 
-            CPU_STATUS_UPDATE(cpu, ZERO, !r);
-            CPU_STATUS_UPDATE(cpu, NEGATIVE, r & NEGATIVE);
+            status_update_nz(cpu, isLazyFlags, r);
 
             cpu->a = cpu->x = r;
 
@@ -856,29 +1014,27 @@ handle_opcode(Cpu *cpu, uint8_t opcode)
         } break;
         case RLA: {
             uint8_t a = cpu->a;
-            uint8_t m = mmu_cpu_read(cpu->mmu, addr);
-            uint8_t m1 = (uint8_t)((m << 1) | (uint8_t)CPU_STATUS_GET(cpu, CARRY));
+            uint8_t m = load(cpu, addrMode, addr);
+            uint8_t m1 = (uint8_t)((m << 1) | (uint8_t)status_get(cpu, isLazyFlags, CARRY));
             uint8_t r = (uint8_t)(a & m1);
 
-            CPU_STATUS_UPDATE(cpu, CARRY, m & 0x80);
-            CPU_STATUS_UPDATE(cpu, ZERO, !r);
-            CPU_STATUS_UPDATE(cpu, NEGATIVE, r & NEGATIVE);
+            status_update(cpu, isLazyFlags, CARRY, m & 0x80);
+            status_update_nz(cpu, isLazyFlags, r);
 
             mmu_cpu_write(cpu->mmu, addr, m1);
             cpu->a = r;
         } break;
         case RRA: {
             uint16_t a = cpu->a;
-            uint16_t m = mmu_cpu_read(cpu->mmu, addr);
-            uint16_t m1 = (uint16_t)((m >> 1) | ((uint16_t)CPU_STATUS_GET(cpu, CARRY) << 7));
+            uint16_t m = load(cpu, addrMode, addr);
+            uint16_t m1 = (uint16_t)((m >> 1) | ((uint16_t)status_get(cpu, isLazyFlags, CARRY) << 7));
 
-            CPU_STATUS_UPDATE(cpu, CARRY, m & 1);
+            status_update(cpu, isLazyFlags, CARRY, m & 1);
 
-            uint16_t r = (uint16_t)(a + m1 + (uint16_t)CPU_STATUS_GET(cpu, CARRY));
+            uint16_t r = (uint16_t)(a + m1 + (uint16_t)status_get(cpu, isLazyFlags, CARRY));
 
-            CPU_STATUS_UPDATE(cpu, CARRY, r & 0xFF00);
-            CPU_STATUS_UPDATE(cpu, ZERO, !(r & 0xFF));
-            CPU_STATUS_UPDATE(cpu, NEGATIVE, r & NEGATIVE);
+            status_update(cpu, isLazyFlags, CARRY, r & 0xFF00);
+            status_update_nz(cpu, isLazyFlags, (uint8_t)(r & 0xFF));
             //   A + M = R
             //   +   +   +
             //   +   +   -  <- overflow
@@ -888,7 +1044,7 @@ handle_opcode(Cpu *cpu, uint8_t opcode)
             //   -   +   -
             //   -   -   +  <- overflow
             //   -   -   -
-            CPU_STATUS_UPDATE(cpu, OVERFLOW, (a ^ r) & (m1 ^ r) & 0x80);
+            status_update(cpu, isLazyFlags, OVERFLOW, (a ^ r) & (m1 ^ r) & 0x80);
 
             mmu_cpu_write(cpu->mmu, addr, (uint8_t)(m1 & 0xFF));
             cpu->a = (uint8_t)(r & 0xFF);
@@ -903,12 +1059,11 @@ handle_opcode(Cpu *cpu, uint8_t opcode)
             uint8_t a = cpu->a;
             uint8_t x = cpu->x;
             uint8_t b = (uint8_t)(a & x);
-            uint8_t m = mmu_cpu_read(cpu->mmu, addr);
+            uint8_t m = load(cpu, addrMode, addr);
             uint8_t r = b - m;
 
-            CPU_STATUS_UPDATE(cpu, CARRY, b >= m);
-            CPU_STATUS_UPDATE(cpu, ZERO, b == m);
-            CPU_STATUS_UPDATE(cpu, NEGATIVE, r & NEGATIVE);
+            status_update(cpu, isLazyFlags, CARRY, b >= m);
+            status_update_nz(cpu, isLazyFlags, r);
 
             cpu->x = r;
         } break;
@@ -936,26 +1091,24 @@ handle_opcode(Cpu *cpu, uint8_t opcode)
         } break;
         case SLO: {
             uint8_t a = cpu->a;
-            uint8_t m = mmu_cpu_read(cpu->mmu, addr);
+            uint8_t m = load(cpu, addrMode, addr);
             uint8_t m1 = (uint8_t)(m << 1);
             uint8_t r = (uint8_t)(a | m1);
 
-            CPU_STATUS_UPDATE(cpu, CARRY, m & 0x80);
-            CPU_STATUS_UPDATE(cpu, ZERO, !r);
-            CPU_STATUS_UPDATE(cpu, NEGATIVE, r & NEGATIVE);
+            status_update(cpu, isLazyFlags, CARRY, m & 0x80);
+            status_update_nz(cpu, isLazyFlags, r);
 
             mmu_cpu_write(cpu->mmu, addr, m1);
             cpu->a = r;
         } break;
         case SRE: {
             uint8_t a = cpu->a;
-            uint8_t m = mmu_cpu_read(cpu->mmu, addr);
+            uint8_t m = load(cpu, addrMode, addr);
             uint8_t m1 = (uint8_t)(m >> 1);
             uint8_t r = (uint8_t)(a ^ m1);
 
-            CPU_STATUS_UPDATE(cpu, CARRY, m & 1);
-            CPU_STATUS_UPDATE(cpu, ZERO, !r);
-            CPU_STATUS_UPDATE(cpu, NEGATIVE, r & NEGATIVE);
+            status_update(cpu, isLazyFlags, CARRY, m & 1);
+            status_update_nz(cpu, isLazyFlags, r);
 
             mmu_cpu_write(cpu->mmu, addr, m1);
             cpu->a = r;
@@ -972,12 +1125,11 @@ handle_opcode(Cpu *cpu, uint8_t opcode)
         } break;
         case USB: {
             uint16_t a = cpu->a;
-            uint16_t m = mmu_cpu_read(cpu->mmu, addr);
-            uint16_t r = (uint16_t)(a - m - (uint16_t)!CPU_STATUS_GET(cpu, CARRY));
+            uint16_t m = load(cpu, addrMode, addr);
+            uint16_t r = (uint16_t)(a - m - (uint16_t)!status_get(cpu, isLazyFlags, CARRY));
 
-            CPU_STATUS_UPDATE(cpu, CARRY, !(r & 0xFF00));
-            CPU_STATUS_UPDATE(cpu, ZERO, !(r & 0xFF));
-            CPU_STATUS_UPDATE(cpu, NEGATIVE, r & NEGATIVE);
+            status_update(cpu, isLazyFlags, CARRY, !(r & 0xFF00));
+            status_update_nz(cpu, isLazyFlags, (uint8_t)(r & 0xFF));
             //   A - M = R
             //   +   +   +
             //   +   +   -
@@ -987,7 +1139,7 @@ handle_opcode(Cpu *cpu, uint8_t opcode)
             //   -   +   -
             //   -   -   +
             //   -   -   -
-            CPU_STATUS_UPDATE(cpu, OVERFLOW, (a ^ m) & (a ^ r) & 0x80);
+            status_update(cpu, isLazyFlags, OVERFLOW, (a ^ m) & (a ^ r) & 0x80);
 
             cpu->a = (uint8_t)(r & 0xFF);
         } break;
@@ -999,42 +1151,607 @@ handle_opcode(Cpu *cpu, uint8_t opcode)
     return cyclesCount;
 }
 
+#if CPU_SWITCH_DISPATCH
+internal uint32_t
+handle_opcode(Cpu *cpu, uint8_t opcode)
+{
+    CpuInstructionEncoding enc = instructionEncodings[opcode];
+    uint16_t operand = fetch_operand(cpu, enc.addrMode);
+    uint32_t cyclesCount = execute(cpu, enc.code, enc.addrMode, enc.baseCyclesCount, operand, cpu->isLazyFlags);
+    return cyclesCount;
+}
+#else
+typedef uint32_t CpuOpcodeHandler(Cpu *cpu);
+
+// One executor per opcode and flags mode with the encoding baked in, so the compiler can fold
+// the addressing mode and instruction switches of `execute` into straight-line code. Handlers
+// additionally fetch the operand from `pc`, executors get it from the block cache.
+#define CPU_OPCODE_EXECUTOR_FLAGS(flags, isLazyFlags, opcode, code, addrMode, baseCyclesCount)          \
+    internal uint32_t                                                                                 \
+    execute_opcode_##flags##_##opcode(Cpu *cpu, uint16_t operand)                                     \
+    {                                                                                                 \
+        uint32_t cyclesCount = execute(cpu, code, addrMode, baseCyclesCount, operand, isLazyFlags);   \
+        return cyclesCount;                                                                           \
+    }                                                                                                 \
+                                                                                                      \
+    internal uint32_t                                                                                 \
+    handle_opcode_##flags##_##opcode(Cpu *cpu)                                                        \
+    {                                                                                                 \
+        uint16_t operand = fetch_operand(cpu, addrMode);                                              \
+        uint32_t cyclesCount = execute_opcode_##flags##_##opcode(cpu, operand);                       \
+        return cyclesCount;                                                                           \
+    }
+
+#define CPU_OPCODE_EXECUTOR(opcode, code, addrMode, baseCyclesCount)                    \
+    CPU_OPCODE_EXECUTOR_FLAGS(eager, false, opcode, code, addrMode, baseCyclesCount)    \
+    CPU_OPCODE_EXECUTOR_FLAGS(lazy, true, opcode, code, addrMode, baseCyclesCount)
+
+CPU_INSTRUCTION_ENCODINGS(CPU_OPCODE_EXECUTOR)
+
+#define CPU_EAGER_OPCODE_HANDLER_ENTRY(opcode, code, addrMode, baseCyclesCount) [opcode] = handle_opcode_eager_##opcode,
+#define CPU_LAZY_OPCODE_HANDLER_ENTRY(opcode, code, addrMode, baseCyclesCount) [opcode] = handle_opcode_lazy_##opcode,
+#define CPU_EAGER_OPCODE_EXECUTOR_ENTRY(opcode, code, addrMode, baseCyclesCount) [opcode] = execute_opcode_eager_##opcode,
+#define CPU_LAZY_OPCODE_EXECUTOR_ENTRY(opcode, code, addrMode, baseCyclesCount) [opcode] = execute_opcode_lazy_##opcode,
+
+global CpuOpcodeHandler *eagerOpcodeHandlers[256] = {
+    CPU_INSTRUCTION_ENCODINGS(CPU_EAGER_OPCODE_HANDLER_ENTRY)
+};
+
+global CpuOpcodeHandler *lazyOpcodeHandlers[256] = {
+    CPU_INSTRUCTION_ENCODINGS(CPU_LAZY_OPCODE_HANDLER_ENTRY)
+};
+
+global CpuOpcodeExecutor *eagerOpcodeExecutors[256] = {
+    CPU_INSTRUCTION_ENCODINGS(CPU_EAGER_OPCODE_EXECUTOR_ENTRY)
+};
+
+global CpuOpcodeExecutor *lazyOpcodeExecutors[256] = {
+    CPU_INSTRUCTION_ENCODINGS(CPU_LAZY_OPCODE_EXECUTOR_ENTRY)
+};
+
+internal bool
+is_block_end(CpuInstructionCode code)
+{
+    bool result = false;
+    switch (code) {
+        case BCC:
+        case BCS:
+        case BEQ:
+        case BMI:
+        case BNE:
+        case BPL:
+        case BRK:
+        case BVC:
+        case BVS:
+        case JAM:
+        case JMP:
+        case JSR:
+        case RTI:
+        case RTS: {
+            result = true;
+        } break;
+        default: {
+        }
+    }
+    return result;
+}
+
+// Registers and flags an instruction of an idle loop reads or writes.
+typedef int32_t CpuIdleDependency;
+enum CpuIdleDependency
+{
+    IDLE_A = (1 << 0),
+    IDLE_X = (1 << 1),
+    IDLE_Y = (1 << 2),
+    IDLE_N = (1 << 3),
+    IDLE_Z = (1 << 4),
+    IDLE_C = (1 << 5),
+    IDLE_V = (1 << 6),
+};
+
+// Reads that can be repeated (or skipped) without anyone noticing until the next event.
+internal bool
+is_idle_read(CpuDecodedInstruction *instr)
+{
+    bool result = false;
+    switch (instr->addrMode) {
+        case IMP:
+        case IMM:
+        case ZPG:
+        case ZPX:
+        case ZPY: {
+            result = true;
+        } break;
+        case ABS: {
+            // RAM, PPU status polling, PRG RAM/ROM
+            result = (instr->operand <= 0x1FFF) ||
+                     ((instr->operand <= 0x3FFF) && ((instr->operand & 0x7) == 0x2)) ||
+                     (instr->operand >= 0x6000);
+        } break;
+        case ABX:
+        case ABY: {
+            result = (instr->operand + 0xFF <= 0x1FFF) || (instr->operand >= 0x6000);
+        } break;
+        default: {
+        }
+    }
+    return result;
+}
+
+// Detects polling loops (e.g. `LDA $2002 / BPL -5`, `JMP *`) that only read memory and branch
+// back to their own start. Once such a loop has run one iteration, every following iteration
+// leaves the CPU in the same state and takes the same cycles until some event changes what it
+// reads.
+internal bool
+is_idle_loop(CpuBlock *block)
+{
+    if (block->instructionsCount > CPU_IDLE_LOOP_MAX_INSTRUCTIONS) {
+        return false;
+    }
+
+    int32_t reads[CPU_IDLE_LOOP_MAX_INSTRUCTIONS] = {};
+    int32_t writes[CPU_IDLE_LOOP_MAX_INSTRUCTIONS] = {};
+    uint16_t pc = block->addr;
+    for (int32_t i = 0; i < block->instructionsCount; i++) {
+        CpuDecodedInstruction *instr = &block->instructions[i];
+        pc += instr->size;
+        if (!is_idle_read(instr) && (instr->addrMode != REL)) {
+            return false;
+        }
+
+        if ((instr->addrMode == ZPX) || (instr->addrMode == ABX)) {
+            reads[i] |= IDLE_X;
+        }
+        else if ((instr->addrMode == ZPY) || (instr->addrMode == ABY)) {
+            reads[i] |= IDLE_Y;
+        }
+
+        bool isLast = (i == block->instructionsCount - 1);
+        uint16_t branchTarget = (uint16_t)(pc + (int8_t)(instr->operand & 0xFF));
+        switch (instr->code) {
+            case LDA: writes[i] |= IDLE_A | IDLE_N | IDLE_Z; break;
+            case LDX: writes[i] |= IDLE_X | IDLE_N | IDLE_Z; break;
+            case LDY: writes[i] |= IDLE_Y | IDLE_N | IDLE_Z; break;
+            case AND:
+            case EOR:
+            case ORA: reads[i] |= IDLE_A; writes[i] |= IDLE_A | IDLE_N | IDLE_Z; break;
+            case BIT: reads[i] |= IDLE_A; writes[i] |= IDLE_N | IDLE_V | IDLE_Z; break;
+            case CMP: reads[i] |= IDLE_A; writes[i] |= IDLE_N | IDLE_Z | IDLE_C; break;
+            case CPX: reads[i] |= IDLE_X; writes[i] |= IDLE_N | IDLE_Z | IDLE_C; break;
+            case CPY: reads[i] |= IDLE_Y; writes[i] |= IDLE_N | IDLE_Z | IDLE_C; break;
+            case TAX: reads[i] |= IDLE_A; writes[i] |= IDLE_X | IDLE_N | IDLE_Z; break;
+            case TAY: reads[i] |= IDLE_A; writes[i] |= IDLE_Y | IDLE_N | IDLE_Z; break;
+            case TXA: reads[i] |= IDLE_X; writes[i] |= IDLE_A | IDLE_N | IDLE_Z; break;
+            case TYA: reads[i] |= IDLE_Y; writes[i] |= IDLE_A | IDLE_N | IDLE_Z; break;
+            case NOP: break;
+            case BCC:
+            case BCS: reads[i] |= IDLE_C; if (!isLast || (branchTarget != block->addr)) return false; break;
+            case BEQ:
+            case BNE: reads[i] |= IDLE_Z; if (!isLast || (branchTarget != block->addr)) return false; break;
+            case BMI:
+            case BPL: reads[i] |= IDLE_N; if (!isLast || (branchTarget != block->addr)) return false; break;
+            case BVC:
+            case BVS: reads[i] |= IDLE_V; if (!isLast || (branchTarget != block->addr)) return false; break;
+            case JMP: if ((instr->addrMode != ABS) || (instr->operand != block->addr)) return false; break;
+            default: return false;
+        }
+    }
+
+    CpuInstructionCode lastCode = block->instructions[block->instructionsCount - 1].code;
+    if (!is_block_end(lastCode)) {
+        return false;
+    }
+
+    // Everything the loop reads must either be left alone by the loop or be produced by it first.
+    int32_t loopWrites = 0;
+    for (int32_t i = 0; i < block->instructionsCount; i++) {
+        loopWrites |= writes[i];
+    }
+    int32_t iterationWrites = 0;
+    for (int32_t i = 0; i < block->instructionsCount; i++) {
+        if (reads[i] & loopWrites & ~iterationWrites) {
+            return false;
+        }
+        iterationWrites |= writes[i];
+    }
+    return true;
+}
+
+// Whether any read of the block may land on a page with read watchpoints, whose hits the
+// iterations of an idle loop skipped by `run_idle_loop` would not report.
+internal bool
+is_block_read_watched(Mmu *mmu, CpuBlock *block)
+{
+    for (int32_t i = 0; i < block->instructionsCount; i++) {
+        CpuDecodedInstruction *instr = &block->instructions[i];
+        int32_t firstPage = 0;
+        int32_t lastPage = 0;
+        switch (instr->addrMode) {
+            case ZPG:
+            case ZPX:
+            case ZPY: {
+            } break;
+            case ABS: {
+                firstPage = lastPage = instr->operand >> 8;
+            } break;
+            case ABX:
+            case ABY: {
+                firstPage = instr->operand >> 8;
+                lastPage = (uint16_t)(instr->operand + 0xFF) >> 8;
+            } break;
+            default: {
+                continue;
+            }
+        }
+        if ((mmu->pageWatchFlags[firstPage] | mmu->pageWatchFlags[lastPage]) & MMU_WATCH_READ) {
+            return true;
+        }
+    }
+    return false;
+}
+
+internal void
+flush_blocks(Cpu *cpu)
+{
+    CpuBlockCache *cache = &cpu->blockCache;
+    memset(cache->blocksByAddr, 0, KB(32) * sizeof(CpuBlock *));
+    cache->blocksCount = 0;
+    cache->instructionsCount = 0;
+
+    // native code belongs to the blocks
+    if (cpu->jit.code) {
+        jit_reset(&cpu->jit);
+    }
+}
+
+internal CpuBlock *
+decode_block(Cpu *cpu, uint16_t addr)
+{
+    CpuBlockCache *cache = &cpu->blockCache;
+    if ((cache->blocksCount == CPU_BLOCK_CACHE_BLOCKS_CAP) ||
+        (cache->instructionsCount + CPU_BLOCK_MAX_INSTRUCTIONS > CPU_BLOCK_CACHE_INSTRUCTIONS_CAP) ||
+        cpu->jit.isFull) {
+        flush_blocks(cpu);
+    }
+
+    int32_t prgWindow = (addr - CPU_PRG_ADDR_OFFSET) / ROM_PRG_WINDOW_SIZE;
+    int32_t prgWindowEnd = CPU_PRG_ADDR_OFFSET + (prgWindow + 1) * ROM_PRG_WINDOW_SIZE;
+
+    CpuBlock *block = &cache->blocks[cache->blocksCount];
+    block->addr = addr;
+    block->instructions = &cache->instructions[cache->instructionsCount];
+    block->instructionsCount = 0;
+    block->prgWindow = prgWindow;
+    block->prgWindowVersion = cpu->mmu->rom->prgWindowVersions[prgWindow];
+    block->native = NULL;
+    block->hitsCount = 0;
+    block->isNativeRejected = cpu->mmu->isRamWatched;
+    block->isIdleLoop = false;
+
+    // Blocks never leave their PRG window, so a bank switch only affects the blocks of that window.
+    // Watched opcodes are left to `cpu_step`, which reports their fetch.
+    int32_t pc = addr;
+    while (block->instructionsCount < CPU_BLOCK_MAX_INSTRUCTIONS) {
+        uint8_t opcode = mmu_cpu_peek(cpu->mmu, (uint16_t)pc);
+        CpuInstructionEncoding enc = instructionEncodings[opcode];
+        int32_t size = 1 + cpuAddressingModeOperandSizes[enc.addrMode];
+        if ((pc + size > prgWindowEnd) || (cpu->mmu->watchFlags[pc] & MMU_WATCH_EXECUTE)) {
+            break;
+        }
+
+        uint16_t operand = 0;
+        if (size == 2) {
+            operand = mmu_cpu_peek(cpu->mmu, (uint16_t)(pc + 1));
+        }
+        else if (size == 3) {
+            operand = (uint16_t)((mmu_cpu_peek(cpu->mmu, (uint16_t)(pc + 2)) << 8) | mmu_cpu_peek(cpu->mmu, (uint16_t)(pc + 1)));
+        }
+
+        CpuDecodedInstruction *instr = &block->instructions[block->instructionsCount++];
+        instr->execute = cpu->isLazyFlags ? lazyOpcodeExecutors[opcode] : eagerOpcodeExecutors[opcode];
+        instr->operand = operand;
+        instr->opcode = opcode;
+        instr->size = (uint8_t)size;
+        instr->baseCyclesCount = (uint8_t)enc.baseCyclesCount;
+        instr->code = enc.code;
+        instr->addrMode = enc.addrMode;
+
+        pc += size;
+        if (is_block_end(enc.code)) {
+            break;
+        }
+    }
+
+    if (block->instructionsCount == 0) {
+        // the very first instruction straddles two windows or is watched
+        return NULL;
+    }
+
+    block->isIdleLoop = is_idle_loop(block) && !is_block_read_watched(cpu->mmu, block);
+
+    cache->blocksCount++;
+    cache->instructionsCount += block->instructionsCount;
+    cache->blocksByAddr[addr - CPU_PRG_ADDR_OFFSET] = block;
+
+    return block;
+}
+
+// Whether the bank now mapped in holds the same instructions as the one the block was
+// decoded from, as it often does when banks share code at the same address.
+internal bool
+is_block_unchanged(Cpu *cpu, CpuBlock *block)
+{
+    uint16_t pc = block->addr;
+    for (int32_t i = 0; i < block->instructionsCount; i++) {
+        CpuDecodedInstruction *instr = &block->instructions[i];
+        uint16_t operand = 0;
+        if (instr->size == 2) {
+            operand = mmu_cpu_peek(cpu->mmu, (uint16_t)(pc + 1));
+        }
+        else if (instr->size == 3) {
+            operand = (uint16_t)((mmu_cpu_peek(cpu->mmu, (uint16_t)(pc + 2)) << 8) | mmu_cpu_peek(cpu->mmu, (uint16_t)(pc + 1)));
+        }
+        if ((mmu_cpu_peek(cpu->mmu, pc) != instr->opcode) || (operand != instr->operand)) {
+            return false;
+        }
+        pc += instr->size;
+    }
+    return true;
+}
+
+internal CpuBlock *
+find_block(Cpu *cpu, uint16_t addr)
+{
+    CpuBlock *block = cpu->blockCache.blocksByAddr[addr - CPU_PRG_ADDR_OFFSET];
+    uint32_t prgWindowVersion = block ? cpu->mmu->rom->prgWindowVersions[block->prgWindow] : 0;
+    if (block && (block->prgWindowVersion != prgWindowVersion)) {
+        // a bank switch keeps the block (and its native code) if the code didn't change
+        if (is_block_unchanged(cpu, block)) {
+            block->prgWindowVersion = prgWindowVersion;
+        }
+        else {
+            block = NULL;
+        }
+    }
+    if (!block) {
+        block = decode_block(cpu, addr);
+    }
+    return block;
+}
+
+internal int64_t
+run_block(Cpu *cpu, CpuBlock *block, int64_t cyclesBudget)
+{
+    uint32_t *prgWindowVersion = &cpu->mmu->rom->prgWindowVersions[block->prgWindow];
+
+    int64_t cyclesCount = 0;
+    for (int32_t i = 0; i < block->instructionsCount; i++) {
+        CpuDecodedInstruction *instr = &block->instructions[i];
+
+        uint16_t pc = cpu->pc;
+        cpu->pc += instr->size;
+        uint32_t instrCyclesCount = instr->execute(cpu, instr->operand);
+        CPU_PROFILE_RECORD(cpu, pc, instr->opcode, instrCyclesCount);
+        cpu->cyclesCount += instrCyclesCount;
+        cpu->instructionsCount++;
+        cyclesCount += instrCyclesCount;
+
+        // Leave as soon as the rest of the block can't run uninterrupted (or became stale).
+        if ((cyclesCount >= cyclesBudget) ||
+            (cpu->interrupt != NOI) ||
+            (cpu->pendingCyclesCount != 0) ||
+            cpu->isStopRequested ||
+            (*prgWindowVersion != block->prgWindowVersion)) {
+            break;
+        }
+    }
+    return cyclesCount;
+}
+
+// Runs one iteration of an idle loop and then skips all the iterations that fit in the budget
+// but the last one, which is interpreted again so the budget overshoot stays the same.
+internal int64_t
+run_idle_loop(Cpu *cpu, CpuBlock *block, int64_t cyclesBudget)
+{
+    uint64_t instructionsCount = cpu->instructionsCount;
+    int64_t iterationCyclesCount = run_block(cpu, block, cyclesBudget);
+
+    int64_t cyclesCount = iterationCyclesCount;
+    if ((cpu->pc == block->addr) &&
+        (cyclesCount < cyclesBudget) &&
+        (cpu->interrupt == NOI) &&
+        (cpu->pendingCyclesCount == 0) &&
+        !cpu->isStopRequested) {
+        int64_t iterationsCount = (cyclesBudget - cyclesCount - 1) / iterationCyclesCount;
+        int64_t skippedCyclesCount = iterationsCount * iterationCyclesCount;
+        cpu->cyclesCount += (uint64_t)skippedCyclesCount;
+        cpu->instructionsCount += (uint64_t)iterationsCount * (cpu->instructionsCount - instructionsCount);
+        cpu->idleCyclesCount += (uint64_t)skippedCyclesCount;
+        cyclesCount += skippedCyclesCount;
+    }
+    return cyclesCount;
+}
+
+internal int64_t
+run_native_block(Cpu *cpu, CpuBlock *block, int64_t cyclesBudget)
+{
+    int64_t cyclesCount = cyclesBudget - block->native(cpu, cpu->mmu->cpuRam, cyclesBudget);
+    cpu->cyclesCount += (uint64_t)cyclesCount;
+    return cyclesCount;
+}
+
+// Hot blocks get compiled once they've been run enough times through the interpreter.
+internal void
+promote_block(Cpu *cpu, CpuBlock *block)
+{
+    if (block->isNativeRejected || (++block->hitsCount < CPU_JIT_HOT_BLOCK_HITS_COUNT)) {
+        return;
+    }
+    block->native = jit_compile(&cpu->jit, block);
+    // a full code buffer is flushed with the blocks on the next decode, so give it another try then
+    block->isNativeRejected = !block->native && !cpu->jit.isFull;
+}
+#endif
+
 bool
-cpu_init(Cpu *cpu)
+cpu_init(Arena *arena, Cpu *cpu)
 {
     cpu->pc = 0;
     cpu->a = 0;
     cpu->x = 0;
     cpu->y = 0;
-    cpu->p = 0 | UNUSED;
     cpu->sp = 0;
+    cpu->fetchPage = NULL;
+    cpu->fetchPageIndex = -1;
+    cpu->isLazyFlags = true;
+    cpu->jit.isEnabled = false;
+    status_write(cpu, cpu->isLazyFlags, 0 | UNUSED);
     cpu->cyclesCount = 0;
+    cpu->pendingCyclesCount = 0;
+    cpu->isOamDmaPending = false;
+    cpu->isIrqAsserted = false;
+    cpu->instructionsCount = 0;
+    cpu->idleCyclesCount = 0;
+    cpu->isStopRequested = false;
     cpu->isJammed = false;
 
+#if CPU_PROFILE
+    cpu->profile = arena_push_zero(arena, sizeof(CpuProfile));
+#endif
+
+#if !CPU_SWITCH_DISPATCH
+    CpuBlockCache *cache = &cpu->blockCache;
+    cache->blocksByAddr = arena_push_zero(arena, KB(32) * sizeof(CpuBlock *));
+    cache->blocks = arena_push(arena, CPU_BLOCK_CACHE_BLOCKS_CAP * sizeof(CpuBlock));
+    cache->instructions = arena_push(arena, CPU_BLOCK_CACHE_INSTRUCTIONS_CAP * sizeof(CpuDecodedInstruction));
+    cache->blocksCount = 0;
+    cache->instructionsCount = 0;
+#endif
+
     // RESET
     cpu->interrupt = RES;
-    cpu->pendingCyclesCount = handle_interrupt(cpu);
+    cpu->cyclesCount += handle_interrupt(cpu);
 
     return true;
 }
 
-void
-cpu_tick(Cpu *cpu)
+uint32_t
+cpu_step(Cpu *cpu)
 {
     if (cpu->isJammed) {
-        return;
+        return 0;
     }
-    if (cpu->pendingCyclesCount == 0) {
-        if (cpu->interrupt != NOI) {
-            cpu->pendingCyclesCount = handle_interrupt(cpu);
+
+    // Cycles stolen from the CPU since the last step (e.g. DMA) are a step of their own, so the
+    // devices catch up past them before the next instruction touches anything. An OAM DMA was
+    // started by the last cycle of the previous instruction, so it starts right here.
+    uint32_t cyclesCount = 0;
+    if (cpu->pendingCyclesCount != 0) {
+        cyclesCount = (uint32_t)cpu->pendingCyclesCount;
+        cpu->pendingCyclesCount = 0;
+        if (cpu->isOamDmaPending) {
+            cyclesCount += (uint32_t)(cpu->cyclesCount & 1);
+            cpu->isOamDmaPending = false;
         }
-        else {
-            uint8_t opcode = mmu_cpu_read(cpu->mmu, cpu->pc++);
-            cpu->pendingCyclesCount = handle_opcode(cpu, opcode);
+    }
+    else if (cpu->interrupt != NOI) {
+        cyclesCount = handle_interrupt(cpu);
+    }
+    else {
+        uint16_t pc = cpu->pc;
+        uint8_t opcode = fetch(cpu, true);
+#if CPU_SWITCH_DISPATCH
+        uint32_t instrCyclesCount = handle_opcode(cpu, opcode);
+#else
+        CpuOpcodeHandler **opcodeHandlers = cpu->isLazyFlags ? lazyOpcodeHandlers : eagerOpcodeHandlers;
+        uint32_t instrCyclesCount = opcodeHandlers[opcode](cpu);
+#endif
+        CPU_PROFILE_RECORD(cpu, pc, opcode, instrCyclesCount);
+        cyclesCount = instrCyclesCount;
+        cpu->instructionsCount++;
+    }
+    cpu->cyclesCount += cyclesCount;
+
+    return cyclesCount;
+}
+
+int64_t
+cpu_run(Cpu *cpu, int64_t cyclesBudget)
+{
+    int64_t cyclesCount = 0;
+    cpu->isStopRequested = false;
+    while (cyclesCount < cyclesBudget && !cpu->isJammed && !cpu->isStopRequested) {
+#if !CPU_SWITCH_DISPATCH
+        // PRG ROM code runs from the block cache, anything else (e.g. code in RAM) is interpreted.
+        if ((cpu->pc >= CPU_PRG_ADDR_OFFSET) && (cpu->interrupt == NOI) && (cpu->pendingCyclesCount == 0)) {
+            CpuBlock *block = find_block(cpu, cpu->pc);
+            if (block) {
+#if !CPU_PROFILE
+                // (the profiler wants to see every iteration)
+                if (block->isIdleLoop) {
+                    cyclesCount += run_idle_loop(cpu, block, cyclesBudget - cyclesCount);
+                    continue;
+                }
+#endif
+                if (block->native) {
+                    int64_t nativeCyclesCount = run_native_block(cpu, block, cyclesBudget - cyclesCount);
+                    cyclesCount += nativeCyclesCount;
+                    if (nativeCyclesCount != 0) {
+                        continue;
+                    }
+                    // its first instruction reads a page behind a bus handler, interpret the block
+                }
+                else if (cpu->jit.isEnabled) {
+                    promote_block(cpu, block);
+                }
+                cyclesCount += run_block(cpu, block, cyclesBudget - cyclesCount);
+                continue;
+            }
         }
+#endif
+        cyclesCount += cpu_step(cpu);
     }
-    cpu->pendingCyclesCount--;
-    cpu->cyclesCount++;
+    return cyclesCount - cyclesBudget;
+}
+
+uint8_t
+cpu_status(Cpu *cpu)
+{
+    uint8_t result = status_read(cpu, cpu->isLazyFlags);
+    return result;
+}
+
+void
+cpu_set_lazy_flags(Cpu *cpu, bool isLazyFlags)
+{
+    uint8_t p = cpu_status(cpu);
+    cpu->isLazyFlags = isLazyFlags;
+    status_write(cpu, cpu->isLazyFlags, p);
+
+#if !CPU_SWITCH_DISPATCH
+    // native code keeps the flags lazy
+    if (!isLazyFlags) {
+        cpu->jit.isEnabled = false;
+    }
+    // decoded blocks reference the executors of the previous mode
+    flush_blocks(cpu);
+#endif
+}
+
+bool
+cpu_set_jit(Cpu *cpu, bool isEnabled)
+{
+#if CPU_SWITCH_DISPATCH || CPU_PROFILE
+    // the JIT compiles blocks of the block cache, and its native code can't be profiled
+    return !isEnabled;
+#else
+    if (isEnabled && (!cpu->isLazyFlags || !jit_init(&cpu->jit))) {
+        return false;
+    }
+    cpu->jit.isEnabled = isEnabled;
+    flush_blocks(cpu);
+    return true;
+#endif
 }
 
 void
@@ -1048,107 +1765,397 @@ cpu_interrupt(Cpu *cpu, CpuInterruptType interrupt)
     }
 }
 
-Str8
-cpu_sprint(Arena *arena, Cpu *cpu)
+void
+cpu_set_irq(Cpu *cpu, bool isAsserted)
+{
+    cpu->isIrqAsserted = isAsserted;
+    if (isAsserted) {
+        if (!cpu->isJammed) {
+            poll_irq(cpu);
+        }
+    }
+    else if (cpu->interrupt == IRQ) {
+        // acknowledged before the CPU got to it
+        cpu->interrupt = NOI;
+    }
+}
+
+void
+cpu_invalidate_fetch_page(Cpu *cpu)
+{
+    cpu->fetchPage = NULL;
+    cpu->fetchPageIndex = -1;
+}
+
+void
+cpu_invalidate_code(Cpu *cpu)
+{
+    cpu_invalidate_fetch_page(cpu);
+#if !CPU_SWITCH_DISPATCH
+    flush_blocks(cpu);
+#endif
+}
+
+void
+cpu_request_stop(Cpu *cpu)
+{
+    cpu->isStopRequested = true;
+}
+
+void
+cpu_start_oam_dma(Cpu *cpu)
+{
+    cpu->pendingCyclesCount += CPU_OAM_DMA_CYCLES;
+    cpu->isOamDmaPending = true;
+}
+
+#define HEX_PAIRS_ROW(hi) \
+    hi "0" hi "1" hi "2" hi "3" hi "4" hi "5" hi "6" hi "7" hi "8" hi "9" hi "A" hi "B" hi "C" hi "D" hi "E" hi "F"
+#define DEC_PAIRS_ROW(hi) hi "0" hi "1" hi "2" hi "3" hi "4" hi "5" hi "6" hi "7" hi "8" hi "9"
+
+// "00".."FF" and "00".."99", so the trace formatter converts two digits per lookup.
+global const char hexPairs[] =
+    HEX_PAIRS_ROW("0") HEX_PAIRS_ROW("1") HEX_PAIRS_ROW("2") HEX_PAIRS_ROW("3")
+    HEX_PAIRS_ROW("4") HEX_PAIRS_ROW("5") HEX_PAIRS_ROW("6") HEX_PAIRS_ROW("7")
+    HEX_PAIRS_ROW("8") HEX_PAIRS_ROW("9") HEX_PAIRS_ROW("A") HEX_PAIRS_ROW("B")
+    HEX_PAIRS_ROW("C") HEX_PAIRS_ROW("D") HEX_PAIRS_ROW("E") HEX_PAIRS_ROW("F");
+global const char decPairs[] =
+    DEC_PAIRS_ROW("0") DEC_PAIRS_ROW("1") DEC_PAIRS_ROW("2") DEC_PAIRS_ROW("3") DEC_PAIRS_ROW("4")
+    DEC_PAIRS_ROW("5") DEC_PAIRS_ROW("6") DEC_PAIRS_ROW("7") DEC_PAIRS_ROW("8") DEC_PAIRS_ROW("9");
+
+internal FORCE_INLINE uint8_t *
+put_hex8(uint8_t *at, uint8_t value)
+{
+    memcpy(at, &hexPairs[value * 2], 2);
+    return at + 2;
+}
+
+internal FORCE_INLINE uint8_t *
+put_hex16(uint8_t *at, uint16_t value)
+{
+    at = put_hex8(at, (uint8_t)(value >> 8));
+    at = put_hex8(at, (uint8_t)(value & 0xFF));
+    return at;
+}
+
+internal FORCE_INLINE uint8_t *
+put_chars(uint8_t *at, const char *chars, int32_t length)
+{
+    memcpy(at, chars, length);
+    return at + length;
+}
+
+internal FORCE_INLINE uint8_t *
+put_dec64(uint8_t *at, uint64_t value)
+{
+    uint8_t digits[20];
+    int32_t digitsPos = sizeof(digits);
+    while (value >= 100) {
+        digitsPos -= 2;
+        memcpy(&digits[digitsPos], &decPairs[(value % 100) * 2], 2);
+        value /= 100;
+    }
+    if (value >= 10) {
+        digitsPos -= 2;
+        memcpy(&digits[digitsPos], &decPairs[value * 2], 2);
+    }
+    else {
+        digits[--digitsPos] = (uint8_t)('0' + value);
+    }
+    int32_t digitsCount = (int32_t)sizeof(digits) - digitsPos;
+    memcpy(at, &digits[digitsPos], digitsCount);
+    return at + digitsCount;
+}
+
+void
+cpu_capture_trace_state(Cpu *cpu, CpuTraceState *state)
+{
+    uint8_t opcode = mmu_cpu_peek(cpu->mmu, cpu->pc);
+    CpuInstructionEncoding enc = instructionEncodings[opcode];
+    int32_t operandSize = cpuAddressingModeOperandSizes[enc.addrMode];
+    uint8_t lo = (operandSize >= 1) ? mmu_cpu_peek(cpu->mmu, cpu->pc + 1) : 0;
+    uint8_t hi = (operandSize >= 2) ? mmu_cpu_peek(cpu->mmu, cpu->pc + 2) : 0;
+    uint16_t arg = (uint16_t)((hi << 8) | lo);
+
+    state->pc = cpu->pc;
+    state->opcode = opcode;
+    state->operand[0] = lo;
+    state->operand[1] = hi;
+    state->a = cpu->a;
+    state->x = cpu->x;
+    state->y = cpu->y;
+    state->p = cpu_status(cpu);
+    state->sp = cpu->sp;
+    state->cyclesCount = cpu->cyclesCount;
+
+    // Pointers are read without going through the bus, so tracing neither reports watch hits nor
+    // touches I/O registers: zero page ones straight from RAM, JMP ($xxxx) ones with
+    // mmu_cpu_peek, unless they sit in a register page.
+    uint8_t *zeroPage = cpu->mmu->cpuRam;
+    switch (enc.addrMode) {
+        case ZPG: state->effectiveAddr = lo; break;
+        case ZPX: state->effectiveAddr = (uint8_t)(lo + cpu->x); break;
+        case ZPY: state->effectiveAddr = (uint8_t)(lo + cpu->y); break;
+        case REL: state->effectiveAddr = (uint16_t)((int32_t)(cpu->pc + 2) + (int8_t)lo); break;
+        case ABS: state->effectiveAddr = arg; break;
+        case ABX: state->effectiveAddr = (uint16_t)(arg + cpu->x); break;
+        case ABY: state->effectiveAddr = (uint16_t)(arg + cpu->y); break;
+        case IDR: {
+            // HW bug when the page boundary is crossed
+            uint16_t hiAddr = ((arg & 0x00FF) == 0x00FF) ? (arg & 0xFF00) : (uint16_t)(arg + 1);
+            bool isRegister = (arg >= 0x2000) && (arg <= 0x401F);
+            state->effectiveAddr = isRegister ? 0 : (uint16_t)((mmu_cpu_peek(cpu->mmu, hiAddr) << 8) | mmu_cpu_peek(cpu->mmu, arg));
+        } break;
+        case IDX: {
+            uint8_t ptr = (uint8_t)(lo + cpu->x);
+            state->effectiveAddr = (uint16_t)((zeroPage[(uint8_t)(ptr + 1)] << 8) | zeroPage[ptr]);
+        } break;
+        case IDY: {
+            uint16_t base = (uint16_t)((zeroPage[(uint8_t)(lo + 1)] << 8) | zeroPage[lo]);
+            state->effectiveAddr = (uint16_t)(base + cpu->y);
+        } break;
+        default: {
+            state->effectiveAddr = 0;
+        }
+    }
+}
+
+int32_t
+cpu_format_trace_state(CpuTraceState *state, uint8_t *buf)
 {
-    uint8_t opcode = mmu_cpu_read(cpu->mmu, cpu->pc);
+    uint8_t opcode = state->opcode;
     CpuInstructionEncoding enc = instructionEncodings[opcode];
-    const char *codeName = cpuInstructionCodeNames[enc.code];
+    int32_t operandSize = cpuAddressingModeOperandSizes[enc.addrMode];
+    uint8_t lo = state->operand[0];
+    uint8_t hi = state->operand[1];
 
-    Str8List list = {};
+    uint8_t *at = buf;
+
+    at = put_hex16(at, state->pc);
+    *at++ = '\t';
 
-    str8_list_appendf(arena, &list, "%04X", cpu->pc);
+    // "OP LO HI"
+    memset(at, ' ', 8);
+    put_hex8(at, opcode);
+    if (operandSize >= 1) {
+        put_hex8(at + 3, lo);
+    }
+    if (operandSize >= 2) {
+        put_hex8(at + 6, hi);
+    }
+    at += 8;
+    *at++ = '\t';
 
+    // "INS OPERAND" padded to the longest operand
+    memset(at, ' ', 11);
+    uint8_t *arg = put_chars(at, cpuInstructionCodeNames[enc.code], 3) + 1;
     switch (enc.addrMode) {
         case IMP: {
-            str8_list_appendf(arena, &list, "%02X      ", opcode);
-            str8_list_appendf(arena, &list, "%s        ", codeName);
         } break;
         case ACC: {
-            str8_list_appendf(arena, &list, "%02X      ", opcode);
-            str8_list_appendf(arena, &list, "%s A      ", codeName);
+            *arg = 'A';
         } break;
         case IMM: {
-            uint8_t arg = mmu_cpu_read(cpu->mmu, cpu->pc + 1);
-            str8_list_appendf(arena, &list, "%02X %02X   ", opcode, arg);
-            str8_list_appendf(arena, &list, "%s #$%02X   ", codeName, arg);
+            put_hex8(put_chars(arg, "#$", 2), lo);
         } break;
         case ZPG: {
-            uint8_t arg = mmu_cpu_read(cpu->mmu, cpu->pc + 1);
-            str8_list_appendf(arena, &list, "%02X %02X   ", opcode, arg);
-            str8_list_appendf(arena, &list, "%s $%02X    ", codeName, arg);
+            put_hex8(put_chars(arg, "$", 1), lo);
         } break;
         case ZPX: {
-            uint8_t arg = mmu_cpu_read(cpu->mmu, cpu->pc + 1);
-            str8_list_appendf(arena, &list, "%02X %02X   ", opcode, arg);
-            str8_list_appendf(arena, &list, "%s $%02X,X  ", codeName, arg);
+            put_chars(put_hex8(put_chars(arg, "$", 1), lo), ",X", 2);
         } break;
         case ZPY: {
-            uint8_t arg = mmu_cpu_read(cpu->mmu, cpu->pc + 1);
-            str8_list_appendf(arena, &list, "%02X %02X   ", opcode, arg);
-            str8_list_appendf(arena, &list, "%s $%02X,Y  ", codeName, arg);
+            put_chars(put_hex8(put_chars(arg, "$", 1), lo), ",Y", 2);
         } break;
         case REL: {
-            uint8_t rawOffset = mmu_cpu_read(cpu->mmu, cpu->pc + 1);
-            int32_t offset = (int32_t)(*((int8_t *)&rawOffset));
-            uint16_t arg = (uint16_t)((int32_t)(cpu->pc + 2) + offset);
-            str8_list_appendf(arena, &list, "%02X %02X   ", opcode, rawOffset);
-            str8_list_appendf(arena, &list, "%s $%04X  ", codeName, arg);
+            uint16_t target = (uint16_t)((int32_t)(state->pc + 2) + (int8_t)lo);
+            put_hex16(put_chars(arg, "$", 1), target);
         } break;
         case ABS: {
-            uint8_t lo = mmu_cpu_read(cpu->mmu, cpu->pc + 1);
-            uint8_t hi = mmu_cpu_read(cpu->mmu, cpu->pc + 2);
-            uint16_t arg = (uint16_t)((hi << 8) | lo);
-            str8_list_appendf(arena, &list, "%02X %02X %02X", opcode, lo, hi);
-            str8_list_appendf(arena, &list, "%s $%04X  ", codeName, arg);
+            put_hex8(put_hex8(put_chars(arg, "$", 1), hi), lo);
         } break;
         case ABX: {
-            uint8_t lo = mmu_cpu_read(cpu->mmu, cpu->pc + 1);
-            uint8_t hi = mmu_cpu_read(cpu->mmu, cpu->pc + 2);
-            uint16_t arg = (uint16_t)((hi << 8) | lo);
-            str8_list_appendf(arena, &list, "%02X %02X %02X", opcode, lo, hi);
-            str8_list_appendf(arena, &list, "%s $%04X,X", codeName, arg);
+            put_chars(put_hex8(put_hex8(put_chars(arg, "$", 1), hi), lo), ",X", 2);
         } break;
         case ABY: {
-            uint8_t lo = mmu_cpu_read(cpu->mmu, cpu->pc + 1);
-            uint8_t hi = mmu_cpu_read(cpu->mmu, cpu->pc + 2);
-            uint16_t arg = (uint16_t)((hi << 8) | lo);
-            str8_list_appendf(arena, &list, "%02X %02X %02X", opcode, lo, hi);
-            str8_list_appendf(arena, &list, "%s $%04X,Y", codeName, arg);
+            put_chars(put_hex8(put_hex8(put_chars(arg, "$", 1), hi), lo), ",Y", 2);
         } break;
         case IDR: {
-            uint8_t lo = mmu_cpu_read(cpu->mmu, cpu->pc + 1);
-            uint8_t hi = mmu_cpu_read(cpu->mmu, cpu->pc + 2);
-            uint16_t arg = (uint16_t)((hi << 8) | lo);
-            str8_list_appendf(arena, &list, "%02X %02X %02X", opcode, lo, hi);
-            str8_list_appendf(arena, &list, "%s ($%04X)", codeName, arg);
+            put_chars(put_hex8(put_hex8(put_chars(arg, "($", 2), hi), lo), ")", 1);
         } break;
         case IDX: {
-            uint8_t arg = mmu_cpu_read(cpu->mmu, cpu->pc + 1);
-            str8_list_appendf(arena, &list, "%02X %02X   ", opcode, arg);
-            str8_list_appendf(arena, &list, "%s ($%02X,X)", codeName, arg);
+            put_chars(put_hex8(put_chars(arg, "($", 2), lo), ",X)", 3);
         } break;
         case IDY: {
-            uint8_t arg = mmu_cpu_read(cpu->mmu, cpu->pc + 1);
-            str8_list_appendf(arena, &list, "%02X %02X   ", opcode, arg);
-            str8_list_appendf(arena, &list, "%s ($%02X),Y", codeName, arg);
+            put_chars(put_hex8(put_chars(arg, "($", 2), lo), "),Y", 3);
         } break;
         default: {
             UNREACHABLE();
         }
     }
+    at += 11;
+    *at++ = '\t';
+
+    // "A:00 X:00 Y:00 P:00 SP:00 CYC:0"
+    at = put_chars(at, "A:", 2);
+    at = put_hex8(at, state->a);
+    at = put_chars(at, " X:", 3);
+    at = put_hex8(at, state->x);
+    at = put_chars(at, " Y:", 3);
+    at = put_hex8(at, state->y);
+    at = put_chars(at, " P:", 3);
+    at = put_hex8(at, state->p);
+    at = put_chars(at, " SP:", 4);
+    at = put_hex8(at, state->sp);
+    at = put_chars(at, " CYC:", 5);
+    at = put_dec64(at, state->cyclesCount);
+
+    int32_t result = (int32_t)(at - buf);
+    ASSERT(result <= CPU_TRACE_LINE_CAP);
+    return result;
+}
+
+int32_t
+cpu_format_trace_line(Cpu *cpu, uint8_t *buf)
+{
+    CpuTraceState state;
+    cpu_capture_trace_state(cpu, &state);
+    int32_t result = cpu_format_trace_state(&state, buf);
+    return result;
+}
 
-    str8_list_appendf(
-        arena,
-        &list,
-        "A:%02X X:%02X Y:%02X P:%02X SP:%02X CYC:%lu",
-        cpu->a,
-        cpu->x,
-        cpu->y,
-        cpu->p,
-        cpu->sp,
-        cpu->cyclesCount
-    );
-
-    return str8_list_join(arena, list, '\t');
+Str8
+cpu_sprint(Arena *arena, Cpu *cpu)
+{
+    uint8_t *bytes = arena_push(arena, CPU_TRACE_LINE_CAP);
+    int32_t length = cpu_format_trace_line(cpu, bytes);
+    return str8(bytes, length);
+}
+
+#if CPU_PROFILE
+typedef struct CpuProfileEntry CpuProfileEntry;
+struct CpuProfileEntry
+{
+    uint32_t key; // opcode or PC
+    uint64_t cyclesCount;
+};
+
+internal int
+compare_profile_entries(const void *a, const void *b)
+{
+    const CpuProfileEntry *entryA = a;
+    const CpuProfileEntry *entryB = b;
+    if (entryA->cyclesCount != entryB->cyclesCount) {
+        return (entryA->cyclesCount < entryB->cyclesCount) ? 1 : -1;
+    }
+    return (entryA->key > entryB->key) - (entryA->key < entryB->key);
+}
+
+internal int32_t
+sort_profile_entries(CpuProfileEntry *entries, uint64_t *cyclesCounts, int32_t count)
+{
+    int32_t result = 0;
+    for (int32_t i = 0; i < count; i++) {
+        if (cyclesCounts[i]) {
+            entries[result++] = (CpuProfileEntry){ .key = (uint32_t)i, .cyclesCount = cyclesCounts[i] };
+        }
+    }
+    qsort(entries, result, sizeof(CpuProfileEntry), compare_profile_entries);
+    return result;
+}
+
+Str8
+cpu_profile_sprint(Arena *arena, Cpu *cpu, int32_t pcsCount)
+{
+    CpuProfile *profile = cpu->profile;
+
+    uint64_t executionsCount = 0;
+    uint64_t cyclesCount = 0;
+    for (int32_t opcode = 0; opcode < 256; opcode++) {
+        executionsCount += profile->opcodeExecutionsCounts[opcode];
+        cyclesCount += profile->opcodeCyclesCounts[opcode];
+    }
+    double cyclesPercentScale = 100.0 / (double)MAX(cyclesCount, 1);
+
+    Str8List list = {};
+
+    str8_list_appendf(arena, &list, "Opcodes by cycles (%lu instructions, %lu cycles):", executionsCount, cyclesCount);
+    str8_list_appendf(arena, &list, "  OP  INSTR         EXECUTIONS          CYCLES  CYCLES%%  PAGE CROSSES  TAKEN%%");
+    CpuProfileEntry *opcodeEntries = arena_push(arena, 256 * sizeof(CpuProfileEntry));
+    int32_t opcodesCount = sort_profile_entries(opcodeEntries, profile->opcodeCyclesCounts, 256);
+    for (int32_t i = 0; i < opcodesCount; i++) {
+        uint8_t opcode = (uint8_t)opcodeEntries[i].key;
+        CpuInstructionEncoding enc = instructionEncodings[opcode];
+        uint64_t opcodeExecutionsCount = profile->opcodeExecutionsCounts[opcode];
+
+        Str8 taken = STR8_LITERAL("     -");
+        if (enc.addrMode == REL) {
+            double takenPercent = 100.0 * (double)profile->opcodeBranchesTakenCounts[opcode] / (double)opcodeExecutionsCount;
+            taken = str8_sprintf(arena, "%6.2f", takenPercent);
+        }
+        str8_list_appendf(arena, &list, "  %02X  %s %s  %16lu  %14lu  %6.2f%%  %12lu  %.*s",
+                          opcode,
+                          cpuInstructionCodeNames[enc.code],
+                          cpuAddressingModeNames[enc.addrMode],
+                          opcodeExecutionsCount,
+                          opcodeEntries[i].cyclesCount,
+                          (double)opcodeEntries[i].cyclesCount * cyclesPercentScale,
+                          profile->opcodePageCrossesCounts[opcode],
+                          STR8_VARG(taken));
+    }
+
+    CpuProfileEntry *pcEntries = arena_push(arena, KB(64) * sizeof(CpuProfileEntry));
+    int32_t pcEntriesCount = sort_profile_entries(pcEntries, profile->pcCyclesCounts, KB(64));
+    pcsCount = MIN(pcsCount, pcEntriesCount);
+    str8_list_append(arena, &list, STR8_EMPTY);
+    str8_list_appendf(arena, &list, "Hottest PCs by cycles (%d of %d):", pcsCount, pcEntriesCount);
+    str8_list_appendf(arena, &list, "  PC          EXECUTIONS          CYCLES  CYCLES%%");
+    for (int32_t i = 0; i < pcsCount; i++) {
+        uint16_t pc = (uint16_t)pcEntries[i].key;
+        str8_list_appendf(arena, &list, "  %04X  %16lu  %14lu  %6.2f%%",
+                          pc,
+                          profile->pcExecutionsCounts[pc],
+                          pcEntries[i].cyclesCount,
+                          (double)pcEntries[i].cyclesCount * cyclesPercentScale);
+    }
+
+    Str8 result = str8_list_join(arena, list, '\n');
+    return result;
+}
+
+Str8
+cpu_profile_sprint_csv(Arena *arena, Cpu *cpu)
+{
+    CpuProfile *profile = cpu->profile;
+
+    Str8List list = {};
+
+    str8_list_appendf(arena, &list, "kind,key,instruction,mode,executions,cycles,page_crosses,branches_taken");
+    for (int32_t opcode = 0; opcode < 256; opcode++) {
+        if (!profile->opcodeExecutionsCounts[opcode]) {
+            continue;
+        }
+        CpuInstructionEncoding enc = instructionEncodings[opcode];
+        str8_list_appendf(arena, &list, "opcode,0x%02X,%s,%s,%lu,%lu,%lu,%lu",
+                          opcode,
+                          cpuInstructionCodeNames[enc.code],
+                          cpuAddressingModeNames[enc.addrMode],
+                          profile->opcodeExecutionsCounts[opcode],
+                          profile->opcodeCyclesCounts[opcode],
+                          profile->opcodePageCrossesCounts[opcode],
+                          profile->opcodeBranchesTakenCounts[opcode]);
+    }
+    for (int32_t pc = 0; pc < KB(64); pc++) {
+        if (!profile->pcExecutionsCounts[pc]) {
+            continue;
+        }
+        str8_list_appendf(arena, &list, "pc,0x%04X,,,%lu,%lu,,",
+                          pc,
+                          profile->pcExecutionsCounts[pc],
+                          profile->pcCyclesCounts[pc]);
+    }
+
+    Str8 result = str8_list_join(arena, list, '\n');
+    return result;
 }
+#endif
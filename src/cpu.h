@@ -8,6 +8,23 @@
 #include "str8.h"
 
 #define CPU_STACK_ADDR_OFFSET 0x0100
+#define CPU_PRG_ADDR_OFFSET 0x8000
+
+#define CPU_BLOCK_MAX_INSTRUCTIONS 32
+#define CPU_BLOCK_CACHE_BLOCKS_CAP 4096
+#define CPU_BLOCK_CACHE_INSTRUCTIONS_CAP KB(32)
+
+#define CPU_IDLE_LOOP_MAX_INSTRUCTIONS 4
+
+#define CPU_JIT_CODE_CAP MB(4)
+
+// OAM DMA halt: one cycle for the pending write and 256 read/write pairs, plus one to align
+// the reads when it starts on an odd cycle.
+#define CPU_OAM_DMA_CYCLES 513
+
+// "C000\t4C F5 C5\tJMP $C5F5  \tA:00 X:00 Y:00 P:24 SP:FD CYC:7" with room for a 20-digit CYC
+#define CPU_TRACE_LINE_CAP 96
+#define CPU_JIT_HOT_BLOCK_HITS_COUNT 16
 
 typedef int32_t CpuStatusFlag;
 enum CpuStatusFlag
@@ -31,24 +48,6 @@ enum CpuInterruptType
     IRQ, // Interrupt Request
 };
 
-typedef struct Cpu Cpu;
-struct Cpu
-{
-    Mmu *mmu;
-
-    uint16_t pc; // Program Counter
-    uint8_t a;   // ACC
-    uint8_t x;   // Register X
-    uint8_t y;   // Register Y
-    uint8_t p;   // Status register
-    uint8_t sp;  // Stack Pointer
-
-    CpuInterruptType interrupt;
-    uint64_t cyclesCount;
-    uint64_t pendingCyclesCount;
-    bool isJammed;
-};
-
 typedef int32_t CpuInstructionCode;
 enum CpuInstructionCode
 {
@@ -85,9 +84,170 @@ enum CpuAddressingMode
     CPU_ADDRESSING_MODE_COUNT
 };
 
-bool cpu_init(Cpu *cpu);
-void cpu_tick(Cpu *cpu);
+typedef struct Cpu Cpu;
+
+typedef uint32_t CpuOpcodeExecutor(Cpu *cpu, uint16_t operand);
+
+// Native code of a block, returns what is left of the cycles budget.
+typedef int64_t CpuNativeBlock(Cpu *cpu, uint8_t *cpuRam, int64_t cyclesBudget);
+
+typedef struct CpuDecodedInstruction CpuDecodedInstruction;
+struct CpuDecodedInstruction
+{
+    CpuOpcodeExecutor *execute;
+    uint16_t operand;
+    uint8_t opcode;
+    uint8_t size; // opcode + operand bytes
+    uint8_t baseCyclesCount;
+    CpuInstructionCode code;
+    CpuAddressingMode addrMode;
+};
+
+// Straight-line run of PRG ROM instructions ending at the first branch/jump.
+typedef struct CpuBlock CpuBlock;
+struct CpuBlock
+{
+    uint16_t addr;
+    CpuDecodedInstruction *instructions;
+    int32_t instructionsCount;
+    int32_t prgWindow;
+    uint32_t prgWindowVersion;
+
+    CpuNativeBlock *native;
+    int32_t hitsCount;
+    bool isNativeRejected; // too few of its instructions can be translated by the JIT
+    bool isIdleLoop;       // side-effect-free polling loop branching back to its own start
+};
+
+typedef struct CpuBlockCache CpuBlockCache;
+struct CpuBlockCache
+{
+    CpuBlock **blocksByAddr; // indexed by `addr - CPU_PRG_ADDR_OFFSET`
+
+    CpuBlock *blocks;
+    int32_t blocksCount;
+
+    CpuDecodedInstruction *instructions;
+    int32_t instructionsCount;
+};
+
+typedef struct CpuJit CpuJit;
+struct CpuJit
+{
+    uint8_t *code;     // code buffer the blocks are emitted to
+    uint8_t *codeExec; // the same memory mapped executable, where they run
+    int32_t codeCap;
+    int32_t codePos;
+    bool isEnabled;
+    bool isFull;
+};
+
+#if CPU_PROFILE
+// Per-opcode and per-PC execution counters, compiled in with `-DCPU_PROFILE`.
+typedef struct CpuProfile CpuProfile;
+struct CpuProfile
+{
+    uint64_t opcodeExecutionsCounts[256];
+    uint64_t opcodeCyclesCounts[256];
+    uint64_t opcodePageCrossesCounts[256];
+    uint64_t opcodeBranchesTakenCounts[256];
+
+    uint64_t pcExecutionsCounts[KB(64)];
+    uint64_t pcCyclesCounts[KB(64)];
+};
+#endif
+
+// What a trace line shows, captured before the instruction executes.
+typedef struct CpuTraceState CpuTraceState;
+struct CpuTraceState
+{
+    uint16_t pc;
+    uint8_t opcode;
+    uint8_t operand[2]; // bytes following the opcode, 0 past the instruction size
+    uint8_t a;
+    uint8_t x;
+    uint8_t y;
+    uint8_t p;
+    uint8_t sp;
+    uint16_t effectiveAddr; // memory operand address or branch target, 0 otherwise
+    uint64_t cyclesCount;
+};
+
+struct Cpu
+{
+    Mmu *mmu;
+
+    uint16_t pc; // Program Counter
+    uint8_t a;   // ACC
+    uint8_t x;   // Register X
+    uint8_t y;   // Register Y
+    uint8_t p;   // Status register (use `cpu_status` to read it)
+    uint8_t sp;  // Stack Pointer
+
+    // Host memory of the page instructions are fetched from (NULL if it goes through a bus
+    // handler), looked up again when `pc` leaves it. Reset by the MMU when PRG is remapped.
+    uint8_t *fetchPage;
+    int32_t fetchPageIndex; // -1 when stale
+
+    // Lazy flags: N from bit 7 of `nResult`, Z when `zResult` is 0, C and V unpacked.
+    bool isLazyFlags;
+    uint8_t nResult;
+    uint8_t zResult;
+    bool carry;
+    bool overflow;
+
+    CpuInterruptType interrupt;
+    uint64_t cyclesCount;
+    uint64_t pendingCyclesCount;
+    bool isOamDmaPending; // the alignment cycle is only known once the pending cycles are charged
+    bool isIrqAsserted;   // IRQ line, driven by the mapper
+    uint64_t instructionsCount;
+    uint64_t idleCyclesCount; // cycles fast-forwarded through idle loops
+    bool isStopRequested;     // cpu_run returns before its next instruction
+    bool isJammed;
+
+    CpuBlockCache blockCache;
+    CpuJit jit;
+
+#if CPU_PROFILE
+    CpuProfile *profile;
+#endif
+};
+
+bool cpu_init(Arena *arena, Cpu *cpu);
+// Runs one instruction, interrupt or stall (e.g. OAM DMA) and returns its cycles.
+uint32_t cpu_step(Cpu *cpu);
+// Runs whole instructions until the budget is spent and returns the cycles run past it
+// (negative if the CPU jammed or was asked to stop before the budget ran out). Idle loops are
+// fast-forwarded to the end of the budget, so it must not reach past the next event (vblank,
+// NMI, IRQ).
+int64_t cpu_run(Cpu *cpu, int64_t cyclesBudget);
+// Makes cpu_run return once the current instruction is done, for devices whose next event
+// may have moved before the end of the budget.
+void cpu_request_stop(Cpu *cpu);
 void cpu_interrupt(Cpu *cpu, CpuInterruptType type);
+// Drives the IRQ line, the IRQ is taken as soon as (and as long as) it's asserted with I clear.
+void cpu_set_irq(Cpu *cpu, bool isAsserted);
+// Forgets the fetch page, for when the memory mapped at `pc` may have changed.
+void cpu_invalidate_fetch_page(Cpu *cpu);
+// Forgets the fetch page and every decoded block and native code, for when the way code may
+// run has changed (e.g. watchpoints).
+void cpu_invalidate_code(Cpu *cpu);
+// Halts the CPU for an OAM DMA started by the instruction being executed, the stall is charged
+// on the next step.
+void cpu_start_oam_dma(Cpu *cpu);
+uint8_t cpu_status(Cpu *cpu);
+void cpu_set_lazy_flags(Cpu *cpu, bool isLazyFlags);
+bool cpu_set_jit(Cpu *cpu, bool isEnabled);
+void cpu_capture_trace_state(Cpu *cpu, CpuTraceState *state);
+// Formats a trace line into `buf` (`CPU_TRACE_LINE_CAP` bytes, no newline) and returns its length.
+int32_t cpu_format_trace_state(CpuTraceState *state, uint8_t *buf);
+int32_t cpu_format_trace_line(Cpu *cpu, uint8_t *buf);
 Str8 cpu_sprint(Arena *arena, Cpu *cpu);
+#if CPU_PROFILE
+// Human-readable report sorted by cycles and a CSV dump of all non-zero counters.
+Str8 cpu_profile_sprint(Arena *arena, Cpu *cpu, int32_t pcsCount);
+Str8 cpu_profile_sprint_csv(Arena *arena, Cpu *cpu);
+#endif
 
 #endif //CPU_H
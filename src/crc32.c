@@ -0,0 +1,62 @@
+#include <string.h> // memcpy
+
+#include "utils.h"
+#include "crc32.h"
+
+#define CRC32_POLYNOMIAL 0xEDB88320
+#define CRC32_SLICES_COUNT 8
+
+// Slicing-by-8: crcTables[k][b] is the CRC of byte b followed by k zero bytes, so eight
+// input bytes are folded with eight independent lookups instead of a serial chain of eight.
+global uint32_t crcTables[CRC32_SLICES_COUNT][256];
+global bool isCrcTablesInit;
+
+internal void
+init_crc_tables()
+{
+    for (uint32_t b = 0; b < 256; b++) {
+        uint32_t crc = b;
+        for (int32_t bit = 0; bit < 8; bit++) {
+            crc = (crc >> 1) ^ ((crc & 1) ? CRC32_POLYNOMIAL : 0);
+        }
+        crcTables[0][b] = crc;
+    }
+    for (uint32_t b = 0; b < 256; b++) {
+        for (int32_t k = 1; k < CRC32_SLICES_COUNT; k++) {
+            uint32_t prev = crcTables[k - 1][b];
+            crcTables[k][b] = (prev >> 8) ^ crcTables[0][prev & 0xFF];
+        }
+    }
+    isCrcTablesInit = true;
+}
+
+uint32_t
+crc32_update(uint32_t crc, uint8_t *bytes, int64_t count)
+{
+    if (!isCrcTablesInit) {
+        init_crc_tables();
+    }
+
+    crc = ~crc;
+    int64_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        // little-endian loads, the CRC is reflected
+        uint32_t lo;
+        uint32_t hi;
+        memcpy(&lo, bytes + i, sizeof(lo));
+        memcpy(&hi, bytes + i + 4, sizeof(hi));
+        lo ^= crc;
+        crc = crcTables[7][lo & 0xFF] ^
+              crcTables[6][(lo >> 8) & 0xFF] ^
+              crcTables[5][(lo >> 16) & 0xFF] ^
+              crcTables[4][lo >> 24] ^
+              crcTables[3][hi & 0xFF] ^
+              crcTables[2][(hi >> 8) & 0xFF] ^
+              crcTables[1][(hi >> 16) & 0xFF] ^
+              crcTables[0][hi >> 24];
+    }
+    for (; i < count; i++) {
+        crc = (crc >> 8) ^ crcTables[0][(crc ^ bytes[i]) & 0xFF];
+    }
+    return ~crc;
+}
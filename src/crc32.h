@@ -0,0 +1,10 @@
+#ifndef CRC32_H
+#define CRC32_H
+
+#include <stdint.h>
+
+// CRC-32 as used by zip, gzip and the ROM databases (reflected polynomial 0xEDB88320).
+// Continue a running checksum by passing the previous result as `crc`, start with 0.
+uint32_t crc32_update(uint32_t crc, uint8_t *bytes, int64_t count);
+
+#endif //CRC32_H
@@ -0,0 +1,345 @@
+#include <string.h> // memcpy, memset
+
+#include "inflate.h"
+
+#define INFLATE_MAX_CODE_LENGTH 15
+#define INFLATE_LITLEN_SYMBOLS_COUNT 288
+#define INFLATE_DIST_SYMBOLS_COUNT 30
+#define INFLATE_CODELEN_SYMBOLS_COUNT 19
+#define INFLATE_END_OF_BLOCK 256
+
+// Codes up to this long are decoded with a single table lookup, longer ones bit by bit.
+#define INFLATE_FAST_BITS 10
+
+typedef struct InflateBits InflateBits;
+struct InflateBits
+{
+    uint8_t *in;
+    int64_t inSize;
+    int64_t inPos; // past the bytes loaded into `buf`, zeros are loaded past the end
+    uint64_t buf;  // next bits in the low end
+    int32_t count;
+};
+
+typedef struct InflateHuffman InflateHuffman;
+struct InflateHuffman
+{
+    uint16_t fast[1 << INFLATE_FAST_BITS]; // (symbol << 4) | length, 0 for longer codes
+    uint16_t counts[INFLATE_MAX_CODE_LENGTH + 1];
+    uint16_t symbols[INFLATE_LITLEN_SYMBOLS_COUNT]; // in canonical code order
+};
+
+global const uint16_t lengthBases[] = {
+    3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258,
+};
+global const uint8_t lengthExtraBits[] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0,
+};
+global const uint16_t distBases[] = {
+    1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073,
+    4097, 6145, 8193, 12289, 16385, 24577,
+};
+global const uint8_t distExtraBits[] = {
+    0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13,
+};
+// order of the code length code lengths in a dynamic block header
+global const uint8_t codeLengthOrder[INFLATE_CODELEN_SYMBOLS_COUNT] = {
+    16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15,
+};
+
+// Tops the buffer up to at least 57 bits, enough for a length/distance pair with its extra bits.
+internal FORCE_INLINE void
+refill(InflateBits *bits)
+{
+    while (bits->count <= 56) {
+        uint64_t byte = (bits->inPos < bits->inSize) ? bits->in[bits->inPos] : 0;
+        bits->inPos++;
+        bits->buf |= byte << bits->count;
+        bits->count += 8;
+    }
+}
+
+internal FORCE_INLINE uint32_t
+take_bits(InflateBits *bits, int32_t count)
+{
+    uint32_t result = (uint32_t)(bits->buf & ((1ull << count) - 1));
+    bits->buf >>= count;
+    bits->count -= count;
+    return result;
+}
+
+// Input bytes actually consumed, the zeros loaded past the end make it exceed `inSize`.
+internal int64_t
+bytes_used(InflateBits *bits)
+{
+    int64_t result = bits->inPos - bits->count / 8;
+    return result;
+}
+
+internal bool
+build_huffman(InflateHuffman *huffman, uint8_t *lengths, int32_t symbolsCount)
+{
+    memset(huffman->counts, 0, sizeof(huffman->counts));
+    memset(huffman->fast, 0, sizeof(huffman->fast));
+    for (int32_t symbol = 0; symbol < symbolsCount; symbol++) {
+        huffman->counts[lengths[symbol]]++;
+    }
+    huffman->counts[0] = 0;
+
+    // over-subscribed sets can't be decoded, incomplete ones only fail if an unused code shows up
+    int32_t left = 1;
+    uint16_t offsets[INFLATE_MAX_CODE_LENGTH + 1];
+    offsets[1] = 0;
+    for (int32_t length = 1; length <= INFLATE_MAX_CODE_LENGTH; length++) {
+        left = (left << 1) - huffman->counts[length];
+        if (left < 0) {
+            return false;
+        }
+        if (length < INFLATE_MAX_CODE_LENGTH) {
+            offsets[length + 1] = (uint16_t)(offsets[length] + huffman->counts[length]);
+        }
+    }
+    for (int32_t symbol = 0; symbol < symbolsCount; symbol++) {
+        if (lengths[symbol]) {
+            huffman->symbols[offsets[lengths[symbol]]++] = (uint16_t)symbol;
+        }
+    }
+
+    // Codes are stored MSB first but the bit buffer is LSB first, so the table is indexed
+    // by the reversed code, repeated for every value of the bits that follow it.
+    int32_t code = 0;
+    int32_t index = 0;
+    for (int32_t length = 1; length <= INFLATE_FAST_BITS; length++) {
+        for (int32_t i = 0; i < huffman->counts[length]; i++, code++, index++) {
+            int32_t reversed = 0;
+            for (int32_t bit = 0; bit < length; bit++) {
+                reversed |= ((code >> bit) & 1) << (length - 1 - bit);
+            }
+            for (int32_t j = reversed; j < (1 << INFLATE_FAST_BITS); j += (1 << length)) {
+                huffman->fast[j] = (uint16_t)((huffman->symbols[index] << 4) | length);
+            }
+        }
+        code <<= 1;
+    }
+    return true;
+}
+
+// -1 for a code that isn't in the set. The buffer must hold at least 15 bits.
+internal FORCE_INLINE int32_t
+decode_symbol(InflateBits *bits, InflateHuffman *huffman)
+{
+    uint16_t entry = huffman->fast[bits->buf & ((1 << INFLATE_FAST_BITS) - 1)];
+    if (entry) {
+        take_bits(bits, entry & 0x0F);
+        return entry >> 4;
+    }
+
+    // canonical decoding one bit at a time: `first` is the first code of each length
+    int32_t code = 0;
+    int32_t first = 0;
+    int32_t index = 0;
+    for (int32_t length = 1; length <= INFLATE_MAX_CODE_LENGTH; length++) {
+        code |= (int32_t)((bits->buf >> (length - 1)) & 1);
+        int32_t count = huffman->counts[length];
+        if (code - first < count) {
+            take_bits(bits, length);
+            return huffman->symbols[index + code - first];
+        }
+        index += count;
+        first = (first + count) << 1;
+        code <<= 1;
+    }
+    return -1;
+}
+
+internal bool
+read_dynamic_tables(InflateBits *bits, InflateHuffman *litlen, InflateHuffman *dist)
+{
+    refill(bits);
+    int32_t litlenCount = (int32_t)take_bits(bits, 5) + 257;
+    int32_t distCount = (int32_t)take_bits(bits, 5) + 1;
+    int32_t codeLengthCount = (int32_t)take_bits(bits, 4) + 4;
+    if ((litlenCount > 286) || (distCount > INFLATE_DIST_SYMBOLS_COUNT)) {
+        return false;
+    }
+
+    uint8_t lengths[INFLATE_LITLEN_SYMBOLS_COUNT + INFLATE_DIST_SYMBOLS_COUNT] = {};
+    for (int32_t i = 0; i < codeLengthCount; i++) {
+        refill(bits);
+        lengths[codeLengthOrder[i]] = (uint8_t)take_bits(bits, 3);
+    }
+    InflateHuffman codeLength;
+    if (!build_huffman(&codeLength, lengths, INFLATE_CODELEN_SYMBOLS_COUNT)) {
+        return false;
+    }
+
+    // literal/length and distance code lengths form a single run-length coded sequence
+    memset(lengths, 0, sizeof(lengths));
+    int32_t count = 0;
+    while (count < litlenCount + distCount) {
+        refill(bits);
+        int32_t symbol = decode_symbol(bits, &codeLength);
+        if (symbol < 0) {
+            return false;
+        }
+        if (symbol < 16) {
+            lengths[count++] = (uint8_t)symbol;
+            continue;
+        }
+
+        uint8_t length = 0;
+        int32_t repeatCount = 0;
+        switch (symbol) {
+            case 16: {
+                if (count == 0) {
+                    return false;
+                }
+                length = lengths[count - 1];
+                repeatCount = 3 + (int32_t)take_bits(bits, 2);
+            } break;
+            case 17: {
+                repeatCount = 3 + (int32_t)take_bits(bits, 3);
+            } break;
+            default: {
+                repeatCount = 11 + (int32_t)take_bits(bits, 7);
+            } break;
+        }
+        if (count + repeatCount > litlenCount + distCount) {
+            return false;
+        }
+        memset(lengths + count, length, repeatCount);
+        count += repeatCount;
+    }
+
+    if (lengths[INFLATE_END_OF_BLOCK] == 0) {
+        return false;
+    }
+    bool result = build_huffman(litlen, lengths, litlenCount) &&
+                  build_huffman(dist, lengths + litlenCount, distCount);
+    return result;
+}
+
+internal void
+build_fixed_tables(InflateHuffman *litlen, InflateHuffman *dist)
+{
+    uint8_t lengths[INFLATE_LITLEN_SYMBOLS_COUNT];
+    memset(lengths, 8, 144);
+    memset(lengths + 144, 9, 256 - 144);
+    memset(lengths + 256, 7, 280 - 256);
+    memset(lengths + 280, 8, INFLATE_LITLEN_SYMBOLS_COUNT - 280);
+    build_huffman(litlen, lengths, INFLATE_LITLEN_SYMBOLS_COUNT);
+
+    memset(lengths, 5, INFLATE_DIST_SYMBOLS_COUNT);
+    build_huffman(dist, lengths, INFLATE_DIST_SYMBOLS_COUNT);
+}
+
+internal bool
+inflate_block(InflateBits *bits, InflateHuffman *litlen, InflateHuffman *dist, uint8_t *out, int64_t outSize, int64_t *outPos)
+{
+    int64_t pos = *outPos;
+    for (;;) {
+        refill(bits);
+        int32_t symbol = decode_symbol(bits, litlen);
+        if (symbol < 0) {
+            return false;
+        }
+        if (symbol < INFLATE_END_OF_BLOCK) {
+            if (pos >= outSize) {
+                return false;
+            }
+            out[pos++] = (uint8_t)symbol;
+            continue;
+        }
+        if (symbol == INFLATE_END_OF_BLOCK) {
+            break;
+        }
+
+        symbol -= INFLATE_END_OF_BLOCK + 1;
+        if (symbol >= (int32_t)ARRAY_CAP(lengthBases)) {
+            return false;
+        }
+        int32_t length = lengthBases[symbol] + (int32_t)take_bits(bits, lengthExtraBits[symbol]);
+
+        int32_t distSymbol = decode_symbol(bits, dist);
+        if ((distSymbol < 0) || (distSymbol >= INFLATE_DIST_SYMBOLS_COUNT)) {
+            return false;
+        }
+        int64_t distance = distBases[distSymbol] + take_bits(bits, distExtraBits[distSymbol]);
+        if ((distance > pos) || (length > outSize - pos)) {
+            return false;
+        }
+
+        uint8_t *from = out + pos - distance;
+        uint8_t *to = out + pos;
+        if (distance >= length) {
+            memcpy(to, from, length);
+        }
+        else {
+            // overlapping, repeats the last `distance` bytes
+            for (int32_t i = 0; i < length; i++) {
+                to[i] = from[i];
+            }
+        }
+        pos += length;
+    }
+    *outPos = pos;
+    return true;
+}
+
+int64_t
+inflate_decode(uint8_t *in, int64_t inSize, uint8_t *out, int64_t outSize)
+{
+    InflateBits bits = {.in = in, .inSize = inSize};
+    InflateHuffman litlen;
+    InflateHuffman dist;
+
+    int64_t outPos = 0;
+    bool isFinal = false;
+    while (!isFinal) {
+        refill(&bits);
+        isFinal = take_bits(&bits, 1);
+        uint32_t type = take_bits(&bits, 2);
+        switch (type) {
+            case 0: {
+                // stored: byte aligned LEN, NLEN and LEN raw bytes, read straight from the input
+                take_bits(&bits, bits.count % 8);
+                int64_t pos = bytes_used(&bits);
+                bits.buf = 0;
+                bits.count = 0;
+                if (pos + 4 > inSize) {
+                    return -1;
+                }
+                uint16_t length = (uint16_t)(in[pos] | (in[pos + 1] << 8));
+                uint16_t lengthComplement = (uint16_t)(in[pos + 2] | (in[pos + 3] << 8));
+                pos += 4;
+                if (((length ^ lengthComplement) != 0xFFFF) || (length > inSize - pos) || (length > outSize - outPos)) {
+                    return -1;
+                }
+                memcpy(out + outPos, in + pos, length);
+                outPos += length;
+                bits.inPos = pos + length;
+            } break;
+            case 1: {
+                build_fixed_tables(&litlen, &dist);
+                if (!inflate_block(&bits, &litlen, &dist, out, outSize, &outPos)) {
+                    return -1;
+                }
+            } break;
+            case 2: {
+                if (!read_dynamic_tables(&bits, &litlen, &dist) ||
+                    !inflate_block(&bits, &litlen, &dist, out, outSize, &outPos)) {
+                    return -1;
+                }
+            } break;
+            default: {
+                return -1;
+            }
+        }
+        if (bytes_used(&bits) > inSize) {
+            return -1;
+        }
+    }
+
+    int64_t result = (outPos == outSize) ? bytes_used(&bits) : -1;
+    return result;
+}
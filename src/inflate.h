@@ -0,0 +1,14 @@
+#ifndef INFLATE_H
+#define INFLATE_H
+
+#include <stdint.h>
+
+#include "utils.h"
+
+// Decodes the raw DEFLATE stream (RFC 1951) at `in` straight into `out`, which must be
+// exactly the size of the decoded data (known from the zip/gzip container), so the output
+// doubles as the history window. Returns the number of input bytes used, or -1 if the stream
+// is invalid or doesn't decode to `outSize` bytes.
+int64_t inflate_decode(uint8_t *in, int64_t inSize, uint8_t *out, int64_t outSize);
+
+#endif //INFLATE_H
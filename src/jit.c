@@ -0,0 +1,1008 @@
+#define _GNU_SOURCE // memfd_create
+
+#include <stddef.h> // offsetof
+#include <string.h> // memcpy
+#include <sys/mman.h>
+#include <unistd.h> // ftruncate, close
+
+#include "utils.h"
+#include "jit.h"
+
+#if defined(__x86_64__)
+
+// Translates PRG ROM blocks into x86-64 code. The 6502 registers live in host registers
+// for the whole block and only go back to `Cpu` when the block exits. RAM is accessed
+// directly and PRG RAM/ROM reads through the MMU's page table. Anything else (I/O, the
+// stack, interrupts, reads of pages behind bus handlers) ends the native code and the
+// interpreter carries on from that instruction. Blocks branching back to their own start
+// loop inside the native code while there is budget left.
+//
+// Native blocks follow the System V ABI:
+//   int64_t block(Cpu *cpu, uint8_t *cpuRam, int64_t cyclesBudget)
+// and like `run_block` they stop after the first instruction that uses up the budget.
+//
+// The code buffer is mapped twice, writable for the emitter and executable for the CPU, so
+// that no mapping is ever both (which some hosts refuse) and compiling a block costs no
+// system call.
+
+typedef int32_t JitReg;
+enum JitReg
+{
+    RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI,
+    R8, R9, R10, R11, R12, R13, R14, R15,
+};
+
+// All of them hold zero-extended bytes, C and V are 0 or 1.
+#define REG_CPU    RDI
+#define REG_RAM    RSI
+#define REG_BUDGET RDX
+#define REG_A      RBX
+#define REG_X      RBP
+#define REG_Y      R13
+#define REG_SP     R12
+#define REG_N      R14 // nResult
+#define REG_Z      R15 // zResult
+#define REG_C      R8
+#define REG_V      R9
+// RAX holds the operand value, RCX its offset into the CPU RAM (or into the PRG page in
+// R11), R10 and R11 are scratch.
+
+// Blocks with a smaller translatable share are left to the interpreter, entering and leaving
+// native code costs more than the few instructions it would run.
+#define JIT_MIN_TRANSLATED_PERCENT 75
+
+typedef int32_t JitCond;
+enum JitCond
+{
+    CC_AE = 0x3,
+    CC_E  = 0x4,
+    CC_NE = 0x5,
+    CC_NS = 0x9,
+    CC_G  = 0xF,
+};
+
+// Opcodes of `op r/m32, r32` and extensions of `op r/m32, imm32`
+#define OP_ADD 0x01
+#define OP_OR  0x09
+#define OP_AND 0x21
+#define OP_SUB 0x29
+#define OP_XOR 0x31
+#define OP_MOV 0x89
+#define EXT_AND 4
+#define EXT_SUB 5
+#define EXT_SHL 4
+#define EXT_SHR 5
+
+typedef struct JitEmitter JitEmitter;
+struct JitEmitter
+{
+    uint8_t *code;
+    int32_t cap;
+    int32_t pos;
+    bool isOverflown;
+};
+
+internal void
+emit8(JitEmitter *e, uint8_t value)
+{
+    if (e->pos < e->cap) {
+        e->code[e->pos] = value;
+    }
+    else {
+        e->isOverflown = true;
+    }
+    e->pos++;
+}
+
+internal void
+emit16(JitEmitter *e, uint16_t value)
+{
+    emit8(e, (uint8_t)(value & 0xFF));
+    emit8(e, (uint8_t)(value >> 8));
+}
+
+internal void
+emit32(JitEmitter *e, uint32_t value)
+{
+    emit16(e, (uint16_t)(value & 0xFFFF));
+    emit16(e, (uint16_t)(value >> 16));
+}
+
+internal void
+emit_rex(JitEmitter *e, bool isWide, JitReg reg, JitReg rm, bool isByteReg)
+{
+    uint8_t rex = (uint8_t)(0x40 | (isWide << 3) | ((reg >> 3) << 2) | (rm >> 3));
+    // without REX byte registers 4-7 would be AH, CH, DH and BH instead of SPL, BPL, SIL and DIL
+    bool isRexNeeded = (rex != 0x40) || (isByteReg && (RSP <= reg) && (reg <= RDI));
+    if (isRexNeeded) {
+        emit8(e, rex);
+    }
+}
+
+internal void
+emit_modrm(JitEmitter *e, uint8_t mod, JitReg reg, JitReg rm)
+{
+    emit8(e, (uint8_t)((mod << 6) | ((reg & 7) << 3) | (rm & 7)));
+}
+
+// op dst, src
+internal void
+emit_op_rr(JitEmitter *e, uint8_t op, JitReg dst, JitReg src)
+{
+    emit_rex(e, false, src, dst, false);
+    emit8(e, op);
+    emit_modrm(e, 3, src, dst);
+}
+
+// op dst, imm32
+internal void
+emit_op_ri(JitEmitter *e, uint8_t ext, JitReg dst, int32_t imm)
+{
+    emit_rex(e, false, 0, dst, false);
+    emit8(e, 0x81);
+    emit_modrm(e, 3, ext, dst);
+    emit32(e, (uint32_t)imm);
+}
+
+// mov dst, imm32
+internal void
+emit_mov_ri(JitEmitter *e, JitReg dst, int32_t imm)
+{
+    emit_rex(e, false, 0, dst, false);
+    emit8(e, (uint8_t)(0xB8 + (dst & 7)));
+    emit32(e, (uint32_t)imm);
+}
+
+// shl/shr dst, imm8
+internal void
+emit_shift_ri(JitEmitter *e, uint8_t ext, JitReg dst, uint8_t imm)
+{
+    emit_rex(e, false, 0, dst, false);
+    emit8(e, 0xC1);
+    emit_modrm(e, 3, ext, dst);
+    emit8(e, imm);
+}
+
+// test dst, imm32
+internal void
+emit_test_ri(JitEmitter *e, JitReg dst, int32_t imm)
+{
+    emit_rex(e, false, 0, dst, false);
+    emit8(e, 0xF7);
+    emit_modrm(e, 3, 0, dst);
+    emit32(e, (uint32_t)imm);
+}
+
+// test dst, dst
+internal void
+emit_test_rr(JitEmitter *e, JitReg dst)
+{
+    emit_rex(e, false, dst, dst, false);
+    emit8(e, 0x85);
+    emit_modrm(e, 3, dst, dst);
+}
+
+// setcc dst8
+internal void
+emit_setcc(JitEmitter *e, JitCond cond, JitReg dst)
+{
+    emit_rex(e, false, 0, dst, true);
+    emit8(e, 0x0F);
+    emit8(e, (uint8_t)(0x90 + cond));
+    emit_modrm(e, 3, 0, dst);
+}
+
+// lea dst, [base + disp32]
+internal void
+emit_lea(JitEmitter *e, JitReg dst, JitReg base, int32_t disp)
+{
+    ASSERT((base & 7) != RSP); // would need a SIB byte
+    emit_rex(e, false, dst, base, false);
+    emit8(e, 0x8D);
+    emit_modrm(e, 2, dst, base);
+    emit32(e, (uint32_t)disp);
+}
+
+// movzx dst, byte [cpu + disp32]
+internal void
+emit_load_cpu(JitEmitter *e, JitReg dst, size_t disp)
+{
+    emit_rex(e, false, dst, REG_CPU, false);
+    emit8(e, 0x0F);
+    emit8(e, 0xB6);
+    emit_modrm(e, 2, dst, REG_CPU);
+    emit32(e, (uint32_t)disp);
+}
+
+// mov byte [cpu + disp32], src8
+internal void
+emit_store_cpu(JitEmitter *e, size_t disp, JitReg src)
+{
+    emit_rex(e, false, src, REG_CPU, true);
+    emit8(e, 0x88);
+    emit_modrm(e, 2, src, REG_CPU);
+    emit32(e, (uint32_t)disp);
+}
+
+// mov dst, qword [base + disp32]
+internal void
+emit_load_ptr(JitEmitter *e, JitReg dst, JitReg base, int32_t disp)
+{
+    ASSERT((base & 7) != RSP); // would need a SIB byte
+    emit_rex(e, true, dst, base, false);
+    emit8(e, 0x8B);
+    emit_modrm(e, 2, dst, base);
+    emit32(e, (uint32_t)disp);
+}
+
+// mov dst, qword [base + index * 8 + disp32]
+internal void
+emit_load_ptr_indexed(JitEmitter *e, JitReg dst, JitReg base, JitReg index, int32_t disp)
+{
+    emit8(e, (uint8_t)(0x48 | ((dst >> 3) << 2) | ((index >> 3) << 1) | (base >> 3)));
+    emit8(e, 0x8B);
+    emit_modrm(e, 2, dst, RSP); // SIB follows
+    emit_modrm(e, 3, index, base);
+    emit32(e, (uint32_t)disp);
+}
+
+// test reg, reg (64-bit)
+internal void
+emit_test_ptr(JitEmitter *e, JitReg reg)
+{
+    emit_rex(e, true, reg, reg, false);
+    emit8(e, 0x85);
+    emit_modrm(e, 3, reg, reg);
+}
+
+// movzx eax, byte [r11 + rcx]
+internal void
+emit_load_page(JitEmitter *e)
+{
+    emit_rex(e, false, RAX, R11, false);
+    emit8(e, 0x0F);
+    emit8(e, 0xB6);
+    emit_modrm(e, 0, RAX, RSP); // SIB follows
+    emit_modrm(e, 0, RCX, R11);
+}
+
+// movzx eax, byte [ram + rcx]
+internal void
+emit_load_ram(JitEmitter *e)
+{
+    emit8(e, 0x0F);
+    emit8(e, 0xB6);
+    emit_modrm(e, 0, RAX, RSP); // SIB follows
+    emit_modrm(e, 0, RCX, REG_RAM);
+}
+
+// mov byte [ram + rcx], al
+internal void
+emit_store_ram(JitEmitter *e)
+{
+    emit8(e, 0x88);
+    emit_modrm(e, 0, RAX, RSP); // SIB follows
+    emit_modrm(e, 0, RCX, REG_RAM);
+}
+
+// sub budget, imm32
+internal void
+emit_sub_budget(JitEmitter *e, int32_t cyclesCount)
+{
+    emit_rex(e, true, 0, REG_BUDGET, false);
+    emit8(e, 0x81);
+    emit_modrm(e, 3, EXT_SUB, REG_BUDGET);
+    emit32(e, (uint32_t)cyclesCount);
+}
+
+// test budget, budget
+internal void
+emit_test_budget(JitEmitter *e)
+{
+    emit_rex(e, true, REG_BUDGET, REG_BUDGET, false);
+    emit8(e, 0x85);
+    emit_modrm(e, 3, REG_BUDGET, REG_BUDGET);
+}
+
+// jcc rel32, returns where the displacement has to be patched
+internal int32_t
+emit_jcc(JitEmitter *e, JitCond cond)
+{
+    emit8(e, 0x0F);
+    emit8(e, (uint8_t)(0x80 + cond));
+    int32_t result = e->pos;
+    emit32(e, 0);
+    return result;
+}
+
+internal int32_t
+emit_jmp(JitEmitter *e)
+{
+    emit8(e, 0xE9);
+    int32_t result = e->pos;
+    emit32(e, 0);
+    return result;
+}
+
+internal void
+patch_jump(JitEmitter *e, int32_t at, int32_t target)
+{
+    if (at + 4 <= e->cap) {
+        uint32_t rel = (uint32_t)(target - (at + 4));
+        memcpy(e->code + at, &rel, sizeof(rel));
+    }
+}
+
+internal void
+emit_push(JitEmitter *e, JitReg reg)
+{
+    emit_rex(e, false, 0, reg, false);
+    emit8(e, (uint8_t)(0x50 + (reg & 7)));
+}
+
+internal void
+emit_pop(JitEmitter *e, JitReg reg)
+{
+    emit_rex(e, false, 0, reg, false);
+    emit8(e, (uint8_t)(0x58 + (reg & 7)));
+}
+
+// add qword [cpu + instructionsCount], imm32
+internal void
+emit_add_instructions(JitEmitter *e, int32_t instructionsCount)
+{
+    emit_rex(e, true, 0, REG_CPU, false);
+    emit8(e, 0x81);
+    emit_modrm(e, 2, 0, REG_CPU);
+    emit32(e, (uint32_t)offsetof(Cpu, instructionsCount));
+    emit32(e, (uint32_t)instructionsCount);
+}
+
+internal void
+emit_exit(JitEmitter *e, int32_t epilogue, uint16_t pc, int32_t instructionsCount)
+{
+    // mov word [cpu + pc], imm16
+    emit8(e, 0x66);
+    emit8(e, 0xC7);
+    emit_modrm(e, 2, 0, REG_CPU);
+    emit32(e, (uint32_t)offsetof(Cpu, pc));
+    emit16(e, pc);
+
+    if (instructionsCount > 0) {
+        emit_add_instructions(e, instructionsCount);
+    }
+
+    int32_t at = emit_jmp(e);
+    patch_jump(e, at, epilogue);
+}
+
+internal void
+emit_update_nz(JitEmitter *e, JitReg src)
+{
+    emit_op_rr(e, OP_MOV, REG_N, src);
+    emit_op_rr(e, OP_MOV, REG_Z, src);
+}
+
+internal bool
+is_ram_access(CpuDecodedInstruction *instr)
+{
+    bool result = false;
+    switch (instr->addrMode) {
+        case ZPG:
+        case ZPX:
+        case ZPY: {
+            result = true;
+        } break;
+        case ABS: {
+            result = instr->operand <= 0x1FFF;
+        } break;
+        case ABX:
+        case ABY: {
+            result = (instr->operand + 0xFF) <= 0x1FFF;
+        } break;
+        default: {
+        }
+    }
+    return result;
+}
+
+// Absolute reads of PRG RAM/ROM (indexed ones may wrap around to RAM), looked up in the
+// page table when the instruction runs since banks may have been switched since.
+internal bool
+is_prg_read(CpuDecodedInstruction *instr)
+{
+    bool result = ((instr->addrMode == ABS) || (instr->addrMode == ABX) || (instr->addrMode == ABY)) &&
+                  (instr->operand >= 0x6000);
+    return result;
+}
+
+internal bool
+is_branch(CpuInstructionCode code)
+{
+    bool result = (code == BCC) || (code == BCS) || (code == BEQ) || (code == BMI) ||
+                  (code == BNE) || (code == BPL) || (code == BVC) || (code == BVS);
+    return result;
+}
+
+internal bool
+is_translatable(CpuDecodedInstruction *instr)
+{
+    bool result = false;
+    switch (instr->code) {
+        case ADC:
+        case AND:
+        case BIT:
+        case CMP:
+        case CPX:
+        case CPY:
+        case EOR:
+        case LDA:
+        case LDX:
+        case LDY:
+        case ORA:
+        case SBC: {
+            result = (instr->addrMode == IMM) || is_ram_access(instr) || is_prg_read(instr);
+        } break;
+        case DEC:
+        case INC:
+        case STA:
+        case STX:
+        case STY: {
+            result = is_ram_access(instr);
+        } break;
+        case ASL:
+        case LSR:
+        case ROL:
+        case ROR: {
+            result = (instr->addrMode == ACC) || is_ram_access(instr);
+        } break;
+        case NOP: {
+            result = (instr->addrMode == IMP) || (instr->addrMode == IMM) || is_ram_access(instr) || is_prg_read(instr);
+        } break;
+        case CLC:
+        case CLV:
+        case DEX:
+        case DEY:
+        case INX:
+        case INY:
+        case SEC:
+        case TAX:
+        case TAY:
+        case TSX:
+        case TXA:
+        case TXS:
+        case TYA: {
+            result = true;
+        } break;
+        case JMP: {
+            result = (instr->addrMode == ABS);
+        } break;
+        default: {
+            result = is_branch(instr->code);
+        }
+    }
+    return result;
+}
+
+// rcx = offset of the operand in the CPU RAM
+internal void
+emit_operand_addr(JitEmitter *e, CpuDecodedInstruction *instr)
+{
+    switch (instr->addrMode) {
+        case ZPG: {
+            emit_mov_ri(e, RCX, instr->operand & 0xFF);
+        } break;
+        case ZPX: {
+            emit_lea(e, RCX, REG_X, instr->operand & 0xFF);
+            emit_op_ri(e, EXT_AND, RCX, 0xFF);
+        } break;
+        case ZPY: {
+            emit_lea(e, RCX, REG_Y, instr->operand & 0xFF);
+            emit_op_ri(e, EXT_AND, RCX, 0xFF);
+        } break;
+        case ABS: {
+            emit_mov_ri(e, RCX, instr->operand & 0x07FF);
+        } break;
+        case ABX: {
+            emit_lea(e, RCX, REG_X, instr->operand);
+            emit_op_ri(e, EXT_AND, RCX, 0x07FF);
+        } break;
+        case ABY: {
+            emit_lea(e, RCX, REG_Y, instr->operand);
+            emit_op_ri(e, EXT_AND, RCX, 0x07FF);
+        } break;
+        default: {
+            UNREACHABLE();
+        }
+    }
+}
+
+// r11 = page the PRG read lands on, rcx = the offset in it. Pages without memory behind them
+// exit before the instruction, for the interpreter to go through their handler.
+internal void
+emit_prg_page(JitEmitter *e, int32_t epilogue, CpuDecodedInstruction *instr, uint16_t pc, int32_t instructionsCount)
+{
+    emit_load_ptr(e, R11, REG_CPU, offsetof(Cpu, mmu));
+    if (instr->addrMode == ABS) {
+        emit_mov_ri(e, RCX, instr->operand & 0xFF);
+        emit_load_ptr(e, R11, R11, (int32_t)(offsetof(Mmu, readPages) + (instr->operand >> 8) * sizeof(uint8_t *)));
+    }
+    else {
+        emit_lea(e, RCX, (instr->addrMode == ABX) ? REG_X : REG_Y, instr->operand);
+        emit_op_ri(e, EXT_AND, RCX, 0xFFFF);
+        emit_op_rr(e, OP_MOV, R10, RCX);
+        emit_shift_ri(e, EXT_SHR, R10, 8);
+        emit_op_ri(e, EXT_AND, RCX, 0xFF);
+        emit_load_ptr_indexed(e, R11, R11, R10, offsetof(Mmu, readPages));
+    }
+    emit_test_ptr(e, R11);
+    int32_t mapped = emit_jcc(e, CC_NE);
+    emit_exit(e, epilogue, pc, instructionsCount);
+    patch_jump(e, mapped, e->pos);
+}
+
+// eax = operand value (rcx = its offset for memory operands)
+internal void
+emit_load_operand(JitEmitter *e, CpuDecodedInstruction *instr)
+{
+    if (instr->addrMode == IMM) {
+        emit_mov_ri(e, RAX, instr->operand & 0xFF);
+    }
+    else if (is_prg_read(instr)) {
+        // emit_prg_page came first
+        emit_load_page(e);
+    }
+    else {
+        emit_operand_addr(e, instr);
+        emit_load_ram(e);
+    }
+}
+
+// Charges the extra cycle of reads whose indexed address crossed a page.
+internal void
+emit_page_cross_penalty(JitEmitter *e, CpuDecodedInstruction *instr)
+{
+    if ((instr->addrMode == ABX) || (instr->addrMode == ABY)) {
+        JitReg index = (instr->addrMode == ABX) ? REG_X : REG_Y;
+        emit_lea(e, R10, index, instr->operand & 0xFF);
+        emit_shift_ri(e, EXT_SHR, R10, 8);
+        emit_rex(e, true, R10, REG_BUDGET, false);
+        emit8(e, OP_SUB);
+        emit_modrm(e, 3, R10, REG_BUDGET);
+    }
+}
+
+// value = value << 1 / >> 1 with the shifted out bit going to C and the old C shifted in for rotations
+internal void
+emit_shift(JitEmitter *e, CpuInstructionCode code, JitReg value)
+{
+    switch (code) {
+        case ASL: {
+            emit_op_rr(e, OP_MOV, REG_C, value);
+            emit_shift_ri(e, EXT_SHR, REG_C, 7);
+            emit_shift_ri(e, EXT_SHL, value, 1);
+            emit_op_ri(e, EXT_AND, value, 0xFF);
+        } break;
+        case LSR: {
+            emit_op_rr(e, OP_MOV, REG_C, value);
+            emit_op_ri(e, EXT_AND, REG_C, 1);
+            emit_shift_ri(e, EXT_SHR, value, 1);
+        } break;
+        case ROL: {
+            emit_op_rr(e, OP_MOV, R10, value);
+            emit_shift_ri(e, EXT_SHL, value, 1);
+            emit_op_rr(e, OP_OR, value, REG_C);
+            emit_op_ri(e, EXT_AND, value, 0xFF);
+            emit_shift_ri(e, EXT_SHR, R10, 7);
+            emit_op_rr(e, OP_MOV, REG_C, R10);
+        } break;
+        case ROR: {
+            emit_op_rr(e, OP_MOV, R10, value);
+            emit_shift_ri(e, EXT_SHR, value, 1);
+            emit_op_rr(e, OP_MOV, R11, REG_C);
+            emit_shift_ri(e, EXT_SHL, R11, 7);
+            emit_op_rr(e, OP_OR, value, R11);
+            emit_op_ri(e, EXT_AND, R10, 1);
+            emit_op_rr(e, OP_MOV, REG_C, R10);
+        } break;
+        default: {
+            UNREACHABLE();
+        }
+    }
+    emit_update_nz(e, value);
+}
+
+// reg - eax, C set when there was no borrow
+internal void
+emit_compare(JitEmitter *e, JitReg reg)
+{
+    emit_op_rr(e, OP_XOR, REG_C, REG_C);
+    emit_op_rr(e, OP_MOV, R10, reg);
+    emit_op_rr(e, OP_SUB, R10, RAX);
+    emit_setcc(e, CC_AE, REG_C);
+    emit_op_ri(e, EXT_AND, R10, 0xFF);
+    emit_update_nz(e, R10);
+}
+
+// V = (x ^ y) & (z ^ r) & 0x80 with r in r10
+internal void
+emit_overflow(JitEmitter *e, JitReg x, JitReg y, JitReg z)
+{
+    emit_op_rr(e, OP_MOV, RCX, x);
+    emit_op_rr(e, OP_XOR, RCX, y);
+    emit_op_rr(e, OP_MOV, R11, z);
+    emit_op_rr(e, OP_XOR, R11, R10);
+    emit_op_rr(e, OP_AND, RCX, R11);
+    emit_shift_ri(e, EXT_SHR, RCX, 7);
+    emit_op_ri(e, EXT_AND, RCX, 1);
+    emit_op_rr(e, OP_MOV, REG_V, RCX);
+}
+
+internal void
+emit_instruction(JitEmitter *e, CpuDecodedInstruction *instr)
+{
+    switch (instr->code) {
+        case ADC: {
+            emit_page_cross_penalty(e, instr);
+            emit_load_operand(e, instr);
+            emit_op_rr(e, OP_MOV, R10, REG_A);
+            emit_op_rr(e, OP_ADD, R10, RAX);
+            emit_op_rr(e, OP_ADD, R10, REG_C);
+            //   A + M = R, overflow when A and M agree in sign and R doesn't
+            emit_overflow(e, REG_A, R10, RAX);
+            emit_op_rr(e, OP_MOV, REG_C, R10);
+            emit_shift_ri(e, EXT_SHR, REG_C, 8);
+            emit_op_ri(e, EXT_AND, R10, 0xFF);
+            emit_op_rr(e, OP_MOV, REG_A, R10);
+            emit_update_nz(e, REG_A);
+        } break;
+        case SBC: {
+            emit_page_cross_penalty(e, instr);
+            emit_load_operand(e, instr);
+            // r10 = A - M - 1 + C, no borrow when it's not negative
+            emit_op_rr(e, OP_XOR, R11, R11);
+            emit_op_rr(e, OP_MOV, R10, REG_A);
+            emit_op_rr(e, OP_SUB, R10, RAX);
+            emit_op_ri(e, EXT_SUB, R10, 1);
+            emit_op_rr(e, OP_ADD, R10, REG_C);
+            emit_setcc(e, CC_NS, R11);
+            emit_op_rr(e, OP_MOV, REG_C, R11);
+            //   A - M = R, overflow when A and M differ in sign and R doesn't match A
+            emit_overflow(e, REG_A, RAX, REG_A);
+            emit_op_ri(e, EXT_AND, R10, 0xFF);
+            emit_op_rr(e, OP_MOV, REG_A, R10);
+            emit_update_nz(e, REG_A);
+        } break;
+        case AND:
+        case EOR:
+        case ORA: {
+            uint8_t op = (instr->code == AND) ? OP_AND : ((instr->code == EOR) ? OP_XOR : OP_OR);
+            emit_page_cross_penalty(e, instr);
+            emit_load_operand(e, instr);
+            emit_op_rr(e, op, REG_A, RAX);
+            emit_update_nz(e, REG_A);
+        } break;
+        case BIT: {
+            emit_load_operand(e, instr);
+            emit_op_rr(e, OP_MOV, REG_N, RAX);
+            emit_op_rr(e, OP_MOV, REG_Z, REG_A);
+            emit_op_rr(e, OP_AND, REG_Z, RAX);
+            emit_op_rr(e, OP_MOV, REG_V, RAX);
+            emit_shift_ri(e, EXT_SHR, REG_V, 6);
+            emit_op_ri(e, EXT_AND, REG_V, 1);
+        } break;
+        case CMP: {
+            emit_page_cross_penalty(e, instr);
+            emit_load_operand(e, instr);
+            emit_compare(e, REG_A);
+        } break;
+        case CPX: {
+            emit_load_operand(e, instr);
+            emit_compare(e, REG_X);
+        } break;
+        case CPY: {
+            emit_load_operand(e, instr);
+            emit_compare(e, REG_Y);
+        } break;
+        case LDA:
+        case LDX:
+        case LDY: {
+            JitReg reg = (instr->code == LDA) ? REG_A : ((instr->code == LDX) ? REG_X : REG_Y);
+            emit_page_cross_penalty(e, instr);
+            emit_load_operand(e, instr);
+            emit_op_rr(e, OP_MOV, reg, RAX);
+            emit_update_nz(e, reg);
+        } break;
+        case STA:
+        case STX:
+        case STY: {
+            JitReg reg = (instr->code == STA) ? REG_A : ((instr->code == STX) ? REG_X : REG_Y);
+            emit_operand_addr(e, instr);
+            emit_op_rr(e, OP_MOV, RAX, reg);
+            emit_store_ram(e);
+        } break;
+        case DEC:
+        case INC: {
+            emit_operand_addr(e, instr);
+            emit_load_ram(e);
+            emit_op_ri(e, (instr->code == INC) ? 0 : EXT_SUB, RAX, 1);
+            emit_op_ri(e, EXT_AND, RAX, 0xFF);
+            emit_store_ram(e);
+            emit_update_nz(e, RAX);
+        } break;
+        case ASL:
+        case LSR:
+        case ROL:
+        case ROR: {
+            if (instr->addrMode == ACC) {
+                emit_shift(e, instr->code, REG_A);
+            }
+            else {
+                emit_operand_addr(e, instr);
+                emit_load_ram(e);
+                emit_shift(e, instr->code, RAX);
+                emit_store_ram(e);
+            }
+        } break;
+        case DEX:
+        case DEY:
+        case INX:
+        case INY: {
+            JitReg reg = ((instr->code == DEX) || (instr->code == INX)) ? REG_X : REG_Y;
+            uint8_t ext = ((instr->code == INX) || (instr->code == INY)) ? 0 : EXT_SUB;
+            emit_op_ri(e, ext, reg, 1);
+            emit_op_ri(e, EXT_AND, reg, 0xFF);
+            emit_update_nz(e, reg);
+        } break;
+        case TAX:
+        case TAY:
+        case TSX:
+        case TXA:
+        case TYA: {
+            JitReg dst = REG_A;
+            JitReg src = REG_A;
+            switch (instr->code) {
+                case TAX: dst = REG_X; src = REG_A; break;
+                case TAY: dst = REG_Y; src = REG_A; break;
+                case TSX: dst = REG_X; src = REG_SP; break;
+                case TXA: dst = REG_A; src = REG_X; break;
+                default:  dst = REG_A; src = REG_Y; break;
+            }
+            emit_op_rr(e, OP_MOV, dst, src);
+            emit_update_nz(e, dst);
+        } break;
+        case TXS: {
+            emit_op_rr(e, OP_MOV, REG_SP, REG_X);
+        } break;
+        case CLC: {
+            emit_mov_ri(e, REG_C, 0);
+        } break;
+        case SEC: {
+            emit_mov_ri(e, REG_C, 1);
+        } break;
+        case CLV: {
+            emit_mov_ri(e, REG_V, 0);
+        } break;
+        case NOP: {
+            emit_page_cross_penalty(e, instr);
+        } break;
+        default: {
+            UNREACHABLE();
+        }
+    }
+}
+
+// Jumps back to the start of the native block while the budget lasts, exits to `pc` (the
+// block's address) otherwise. The iteration's instructions are counted either way.
+internal void
+emit_loop(JitEmitter *e, int32_t epilogue, int32_t loopStart, uint16_t pc, int32_t instructionsCount)
+{
+    emit_add_instructions(e, instructionsCount);
+    emit_test_budget(e);
+    int32_t at = emit_jcc(e, CC_G);
+    patch_jump(e, at, loopStart);
+    emit_exit(e, epilogue, pc, 0);
+}
+
+// `loopStart` is where the native code of the block's first instruction starts, -1 when the
+// block can't loop inside the native code.
+internal void
+emit_branch(JitEmitter *e, int32_t epilogue, int32_t loopStart, uint16_t blockAddr, CpuDecodedInstruction *instr,
+            uint16_t nextPc, int32_t instructionsCount)
+{
+    JitCond takenCond = CC_NE;
+    switch (instr->code) {
+        case BCC: emit_test_rr(e, REG_C); takenCond = CC_E; break;
+        case BCS: emit_test_rr(e, REG_C); takenCond = CC_NE; break;
+        case BEQ: emit_test_rr(e, REG_Z); takenCond = CC_E; break;
+        case BNE: emit_test_rr(e, REG_Z); takenCond = CC_NE; break;
+        case BMI: emit_test_ri(e, REG_N, NEGATIVE); takenCond = CC_NE; break;
+        case BPL: emit_test_ri(e, REG_N, NEGATIVE); takenCond = CC_E; break;
+        case BVC: emit_test_rr(e, REG_V); takenCond = CC_E; break;
+        case BVS: emit_test_rr(e, REG_V); takenCond = CC_NE; break;
+        default: UNREACHABLE();
+    }
+    int32_t taken = emit_jcc(e, takenCond);
+
+    emit_sub_budget(e, instr->baseCyclesCount);
+    emit_exit(e, epilogue, nextPc, instructionsCount);
+
+    patch_jump(e, taken, e->pos);
+    int8_t offset = (int8_t)(instr->operand & 0xFF);
+    uint16_t target = (uint16_t)(nextPc + offset);
+    bool pageCrossed = ((nextPc & 0xFF00) != (target & 0xFF00));
+    emit_sub_budget(e, instr->baseCyclesCount + (pageCrossed ? 2 : 1));
+    if ((loopStart >= 0) && (target == blockAddr)) {
+        emit_loop(e, epilogue, loopStart, target, instructionsCount);
+    }
+    else {
+        emit_exit(e, epilogue, target, instructionsCount);
+    }
+}
+
+bool
+jit_init(CpuJit *jit)
+{
+    if (!jit->code) {
+        int fd = memfd_create("jit", MFD_CLOEXEC);
+        if (fd < 0) {
+            return false;
+        }
+        void *code = MAP_FAILED;
+        void *codeExec = MAP_FAILED;
+        if (ftruncate(fd, CPU_JIT_CODE_CAP) == 0) {
+            code = mmap(NULL, CPU_JIT_CODE_CAP, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+            codeExec = mmap(NULL, CPU_JIT_CODE_CAP, PROT_READ | PROT_EXEC, MAP_SHARED, fd, 0);
+        }
+        // the mappings keep the memory alive
+        close(fd);
+        if ((code == MAP_FAILED) || (codeExec == MAP_FAILED)) {
+            if (code != MAP_FAILED) {
+                munmap(code, CPU_JIT_CODE_CAP);
+            }
+            if (codeExec != MAP_FAILED) {
+                munmap(codeExec, CPU_JIT_CODE_CAP);
+            }
+            return false;
+        }
+        jit->code = code;
+        jit->codeExec = codeExec;
+        jit->codeCap = CPU_JIT_CODE_CAP;
+    }
+    jit_reset(jit);
+    return true;
+}
+
+void
+jit_reset(CpuJit *jit)
+{
+    jit->codePos = 0;
+    jit->isFull = false;
+}
+
+CpuNativeBlock *
+jit_compile(CpuJit *jit, CpuBlock *block)
+{
+    int32_t translatableCount = 0;
+    while ((translatableCount < block->instructionsCount) &&
+           is_translatable(&block->instructions[translatableCount])) {
+        translatableCount++;
+    }
+    if (translatableCount * 100 < block->instructionsCount * JIT_MIN_TRANSLATED_PERCENT) {
+        return NULL;
+    }
+
+    JitEmitter emitter = {};
+    JitEmitter *e = &emitter;
+    e->code = jit->code + jit->codePos;
+    e->cap = jit->codeCap - jit->codePos;
+
+    // Epilogue goes first so that every exit knows where to jump.
+    int32_t epilogue = e->pos;
+    emit_store_cpu(e, offsetof(Cpu, a), REG_A);
+    emit_store_cpu(e, offsetof(Cpu, x), REG_X);
+    emit_store_cpu(e, offsetof(Cpu, y), REG_Y);
+    emit_store_cpu(e, offsetof(Cpu, sp), REG_SP);
+    emit_store_cpu(e, offsetof(Cpu, nResult), REG_N);
+    emit_store_cpu(e, offsetof(Cpu, zResult), REG_Z);
+    emit_store_cpu(e, offsetof(Cpu, carry), REG_C);
+    emit_store_cpu(e, offsetof(Cpu, overflow), REG_V);
+    emit_rex(e, true, REG_BUDGET, RAX, false);
+    emit8(e, OP_MOV);
+    emit_modrm(e, 3, REG_BUDGET, RAX);
+    emit_pop(e, R15);
+    emit_pop(e, R14);
+    emit_pop(e, R13);
+    emit_pop(e, R12);
+    emit_pop(e, RBP);
+    emit_pop(e, RBX);
+    emit8(e, 0xC3); // ret
+
+    int32_t entry = e->pos;
+    emit_push(e, RBX);
+    emit_push(e, RBP);
+    emit_push(e, R12);
+    emit_push(e, R13);
+    emit_push(e, R14);
+    emit_push(e, R15);
+    emit_load_cpu(e, REG_A, offsetof(Cpu, a));
+    emit_load_cpu(e, REG_X, offsetof(Cpu, x));
+    emit_load_cpu(e, REG_Y, offsetof(Cpu, y));
+    emit_load_cpu(e, REG_SP, offsetof(Cpu, sp));
+    emit_load_cpu(e, REG_N, offsetof(Cpu, nResult));
+    emit_load_cpu(e, REG_Z, offsetof(Cpu, zResult));
+    emit_load_cpu(e, REG_C, offsetof(Cpu, carry));
+    emit_load_cpu(e, REG_V, offsetof(Cpu, overflow));
+
+    // Only whole blocks loop, the instructions the interpreter runs can't jump back in.
+    int32_t loopStart = (translatableCount == block->instructionsCount) ? e->pos : -1;
+    uint16_t pc = block->addr;
+    for (int32_t i = 0; i < translatableCount; i++) {
+        CpuDecodedInstruction *instr = &block->instructions[i];
+        uint16_t nextPc = (uint16_t)(pc + instr->size);
+
+        if (is_branch(instr->code)) {
+            emit_branch(e, epilogue, loopStart, block->addr, instr, nextPc, i + 1);
+        }
+        else if (instr->code == JMP) {
+            emit_sub_budget(e, instr->baseCyclesCount);
+            if ((loopStart >= 0) && (instr->operand == block->addr)) {
+                emit_loop(e, epilogue, loopStart, block->addr, i + 1);
+            }
+            else {
+                emit_exit(e, epilogue, instr->operand, i + 1);
+            }
+        }
+        else {
+            if (is_prg_read(instr)) {
+                emit_prg_page(e, epilogue, instr, pc, i);
+            }
+            emit_instruction(e, instr);
+            emit_sub_budget(e, instr->baseCyclesCount);
+            if (i + 1 < translatableCount) {
+                emit_test_budget(e);
+                int32_t next = emit_jcc(e, CC_G);
+                emit_exit(e, epilogue, nextPc, i + 1);
+                patch_jump(e, next, e->pos);
+            }
+            else {
+                // the rest of the block (if any) is left to the interpreter
+                emit_exit(e, epilogue, nextPc, i + 1);
+            }
+        }
+        pc = nextPc;
+    }
+
+    if (e->isOverflown) {
+        jit->isFull = true;
+        return NULL;
+    }
+    uint8_t *codeExec = jit->codeExec + jit->codePos;
+    jit->codePos += (e->pos + 15) & ~15;
+
+    CpuNativeBlock *result = NULL;
+    void *entryAddr = codeExec + entry;
+    memcpy(&result, &entryAddr, sizeof(result));
+    return result;
+}
+
+#else
+
+bool
+jit_init(CpuJit *jit)
+{
+    return false;
+}
+
+void
+jit_reset(CpuJit *jit)
+{
+}
+
+CpuNativeBlock *
+jit_compile(CpuJit *jit, CpuBlock *block)
+{
+    return NULL;
+}
+
+#endif
@@ -0,0 +1,12 @@
+#ifndef JIT_H
+#define JIT_H
+
+#include <stdint.h>
+
+#include "cpu.h"
+
+bool jit_init(CpuJit *jit);
+void jit_reset(CpuJit *jit);
+CpuNativeBlock *jit_compile(CpuJit *jit, CpuBlock *block);
+
+#endif //JIT_H
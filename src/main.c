@@ -2,6 +2,10 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
 
 #include "utils.h"
 #include "arena.h"
@@ -9,6 +13,7 @@
 #include "nes.h"
 
 #define FPS 60
+#define DEFAULT_SAVE_SYNC_SECONDS 10
 
 typedef struct SdlResources SdlResources;
 struct SdlResources
@@ -82,20 +87,67 @@ int32_t
 main(int32_t argc, char *argv[])
 {
     if (argc < 2) {
-        fprintf(stderr, "Usage: %s ROM\n", argv[0]);
+        fprintf(stderr, "Usage: %s [--trace | --trace-bin FILE] [--jit] [--save-sync SECONDS | --save-private] ROM\n", argv[0]);
         exit(1);
     }
-    Str8 romPath = str8_from_cstr(argv[1]);
+    Str8 romPath = str8_from_cstr(argv[argc - 1]);
+
+    bool isTracing = false;
+    char *binaryTracePath = NULL;
+    bool isJit = false;
+    RomSaveMode saveMode = ROM_SAVE_SHARED;
+    int32_t saveSyncSeconds = DEFAULT_SAVE_SYNC_SECONDS;
+    for (int32_t i = 1; i < argc - 1; i++) {
+        Str8 arg = str8_from_cstr(argv[i]);
+        if (str8_is_equal(arg, STR8_LITERAL("--trace"), 0)) {
+            isTracing = true;
+        }
+        else if (str8_is_equal(arg, STR8_LITERAL("--trace-bin"), 0) && (i + 1 < argc - 1)) {
+            binaryTracePath = argv[++i];
+        }
+        else if (str8_is_equal(arg, STR8_LITERAL("--jit"), 0)) {
+            isJit = true;
+        }
+        else if (str8_is_equal(arg, STR8_LITERAL("--save-sync"), 0) && (i + 1 < argc - 1)) {
+            saveSyncSeconds = atoi(argv[++i]);
+        }
+        else if (str8_is_equal(arg, STR8_LITERAL("--save-private"), 0)) {
+            saveMode = ROM_SAVE_PRIVATE;
+        }
+        else {
+            fprintf(stderr, "Unknown option '%s'\n", argv[i]);
+            exit(1);
+        }
+    }
 
     int32_t arenaBufCap = MB(64);
     uint8_t *arenaBuf = (uint8_t *)malloc(arenaBufCap);
     Arena permArena = arena_make(arenaBuf, arenaBufCap);
 
     Nes nes = {};
+    nes.saveMode = saveMode;
+    nes.saveSyncFramesCount = MAX(saveSyncSeconds, 0) * FPS;
     if (!nes_init(&permArena, &nes, romPath)) {
         fprintf(stderr, "Failed to initialize NES\n");
         exit(1);
     }
+    int32_t binaryTraceFd = -1;
+    if (binaryTracePath) {
+        binaryTraceFd = open(binaryTracePath, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (binaryTraceFd < 0) {
+            fprintf(stderr, "Failed to open file '%s': %s\n", binaryTracePath, strerror(errno));
+            exit(1);
+        }
+        trace_init(&permArena, &nes.trace, binaryTraceFd, TRACE_BINARY);
+        nes.isTracing = true;
+    }
+    else if (isTracing) {
+        trace_init(&permArena, &nes.trace, STDOUT_FILENO, TRACE_TEXT);
+        nes.isTracing = true;
+    }
+    if (isJit && !cpu_set_jit(&nes.cpu, true)) {
+        fprintf(stderr, "JIT is not available, falling back to the interpreter\n");
+    }
 
     uint64_t targetFrameDurationMs = 1000 / FPS;
 
@@ -117,14 +169,12 @@ main(int32_t argc, char *argv[])
             }
         }
 
+        nes_run_frame(&nes, true);
+
         uint32_t *pixels;
         int32_t pitch;
         sdl_abort_if_failed(SDL_LockTexture(sdl.buffer, NULL, (void **)&pixels, &pitch));
-
-        ArenaBackup arenaBck = arena_backup(&permArena);
-        nes_display_update(arenaBck.arena, &nes, pixels);
-        arena_restore(&arenaBck);
-
+        nes_convert_frame(&nes, pixels, pitch);
         SDL_UnlockTexture(sdl.buffer);
 
         SDL_RenderClear(sdl.renderer);
@@ -143,6 +193,14 @@ main(int32_t argc, char *argv[])
         }
     }
 
+#if CPU_PROFILE
+    nes_write_profile(&permArena, &nes, STR8_LITERAL("cpu_profile.csv"));
+#endif
+
+    if (binaryTraceFd >= 0) {
+        close(binaryTraceFd);
+    }
+    nes_deinit(&nes);
     sdl_free(&sdl);
     free(arenaBuf);
 
@@ -0,0 +1,315 @@
+#include <stddef.h>
+
+#include "mapper.h"
+#include "rom.h"
+
+// Banks are numbered in units of the bank size and wrap around the image, like the unconnected
+// high bank lines of smaller boards.
+
+internal void
+map_prg_8k(Rom *rom, int32_t window, int32_t bank)
+{
+    int32_t banksCount = rom->prgSize / ROM_PRG_WINDOW_SIZE;
+    uint8_t *bankBase = rom->prg + (bank % banksCount) * ROM_PRG_WINDOW_SIZE;
+    if (rom->prgWindows[window] != bankBase) {
+        rom->prgWindows[window] = bankBase;
+        rom->prgWindowVersions[window]++;
+    }
+}
+
+internal void
+map_prg_16k(Rom *rom, int32_t slot, int32_t bank)
+{
+    map_prg_8k(rom, slot * 2, bank * 2);
+    map_prg_8k(rom, slot * 2 + 1, bank * 2 + 1);
+}
+
+internal void
+map_prg_32k(Rom *rom, int32_t bank)
+{
+    map_prg_16k(rom, 0, bank * 2);
+    map_prg_16k(rom, 1, bank * 2 + 1);
+}
+
+internal void
+map_chr_1k(Rom *rom, int32_t window, int32_t bank)
+{
+    int32_t banksCount = rom->chrSize / ROM_CHR_WINDOW_SIZE;
+    rom->chrWindows[window] = rom->chr + (bank % banksCount) * ROM_CHR_WINDOW_SIZE;
+}
+
+internal void
+map_chr(Rom *rom, int32_t window, int32_t windowsCount, int32_t bank)
+{
+    for (int32_t i = 0; i < windowsCount; i++) {
+        map_chr_1k(rom, window + i, bank * windowsCount + i);
+    }
+}
+
+internal int32_t
+last_prg_16k(Rom *rom)
+{
+    int32_t result = rom->prgSize / KB(16) - 1;
+    return result;
+}
+
+//
+// NROM: 16KB or 32KB PRG, 8KB CHR, no registers
+//
+
+internal void
+nrom_reset(Rom *rom)
+{
+    // 16KB images are mirrored into $C000-$FFFF
+    map_prg_32k(rom, 0);
+    map_chr(rom, 0, 8, 0);
+}
+
+//
+// UxROM: switchable 16KB PRG bank at $8000, last bank fixed at $C000
+//
+
+internal void
+uxrom_reset(Rom *rom)
+{
+    map_prg_16k(rom, 0, 0);
+    map_prg_16k(rom, 1, last_prg_16k(rom));
+    map_chr(rom, 0, 8, 0);
+}
+
+internal void
+uxrom_write(Rom *rom, uint16_t addr, uint8_t value)
+{
+    rom->mapperState.bank = value;
+    map_prg_16k(rom, 0, value);
+}
+
+//
+// CNROM: fixed PRG, switchable 8KB CHR bank
+//
+
+internal void
+cnrom_write(Rom *rom, uint16_t addr, uint8_t value)
+{
+    rom->mapperState.bank = value;
+    map_chr(rom, 0, 8, value);
+}
+
+//
+// MMC1: registers loaded serially through a 5-bit shift register
+//
+
+internal void
+mmc1_map(Rom *rom)
+{
+    Mmc1 *mmc1 = &rom->mapperState.mmc1;
+
+    // CONTROL:
+    // +---+---+---+---+---+
+    // | 4 | 3 | 2 | 1 | 0 |
+    // +---+---+---+---+---+
+    //   |  \_____/  \_____/
+    //   |     |        |
+    //   |     |        mirroring: single screen low, high, vertical, horizontal
+    //   |     PRG mode: 32KB (0, 1), fixed first bank (2), fixed last bank (3)
+    //   CHR mode: 8KB (0), two 4KB banks (1)
+    if (rom->mirror != FOUR_SCREEN) {
+        global const Mirror mirrors[] = {SINGLE_SCREEN_LOW, SINGLE_SCREEN_HIGH, VERTICAL, HORIZONTAL};
+        rom->mirror = mirrors[mmc1->control & 0x03];
+    }
+
+    // SUROM uses the top CHR bank line to select the 256KB PRG half
+    int32_t prgOuterBank = (rom->prgSize > KB(256)) ? (mmc1->chrBank0 & 0x10) : 0;
+    int32_t prgBank = prgOuterBank | (mmc1->prgBank & 0x0F);
+    switch ((mmc1->control >> 2) & 0x03) {
+        case 0:
+        case 1: {
+            map_prg_32k(rom, prgBank >> 1);
+        } break;
+        case 2: {
+            map_prg_16k(rom, 0, prgOuterBank);
+            map_prg_16k(rom, 1, prgBank);
+        } break;
+        case 3: {
+            map_prg_16k(rom, 0, prgBank);
+            map_prg_16k(rom, 1, prgOuterBank | (last_prg_16k(rom) & 0x0F));
+        } break;
+    }
+
+    if (mmc1->control & 0x10) {
+        map_chr(rom, 0, 4, mmc1->chrBank0);
+        map_chr(rom, 4, 4, mmc1->chrBank1);
+    }
+    else {
+        map_chr(rom, 0, 8, mmc1->chrBank0 >> 1);
+    }
+}
+
+internal void
+mmc1_reset(Rom *rom)
+{
+    Mmc1 *mmc1 = &rom->mapperState.mmc1;
+    mmc1->control = 0x0C;
+    mmc1_map(rom);
+}
+
+internal void
+mmc1_write(Rom *rom, uint16_t addr, uint8_t value)
+{
+    Mmc1 *mmc1 = &rom->mapperState.mmc1;
+    if (value & 0x80) {
+        mmc1->shift = 0;
+        mmc1->shiftCount = 0;
+        mmc1->control |= 0x0C;
+        mmc1_map(rom);
+        return;
+    }
+
+    mmc1->shift |= (uint8_t)((value & 0x01) << mmc1->shiftCount);
+    mmc1->shiftCount++;
+    if (mmc1->shiftCount < 5) {
+        return;
+    }
+
+    // the fifth write picks the register with bits 13-14 of its address
+    switch ((addr >> 13) & 0x03) {
+        case 0: {
+            mmc1->control = mmc1->shift;
+        } break;
+        case 1: {
+            mmc1->chrBank0 = mmc1->shift;
+        } break;
+        case 2: {
+            mmc1->chrBank1 = mmc1->shift;
+        } break;
+        case 3: {
+            mmc1->prgBank = mmc1->shift;
+        } break;
+    }
+    mmc1->shift = 0;
+    mmc1->shiftCount = 0;
+    mmc1_map(rom);
+}
+
+//
+// MMC3: eight bank registers, scanline counter IRQ
+//
+
+internal void
+mmc3_map(Rom *rom)
+{
+    Mmc3 *mmc3 = &rom->mapperState.mmc3;
+
+    // BANK SELECT:
+    // +---+---+   +---+---+---+
+    // | 7 | 6 |...| 2 | 1 | 0 |
+    // +---+---+   +---+---+---+
+    //   |   |      \_________/
+    //   |   |           |
+    //   |   |           register updated by the next bank data write
+    //   |   R6 at $8000 (0) or at $C000 (1), the second last bank at the other one
+    //   2KB CHR banks at $0000 (0) or at $1000 (1)
+    int32_t secondLastBank = rom->prgSize / ROM_PRG_WINDOW_SIZE - 2;
+    bool isPrgSwapped = mmc3->bankSelect & 0x40;
+    map_prg_8k(rom, isPrgSwapped ? 2 : 0, mmc3->banks[6]);
+    map_prg_8k(rom, 1, mmc3->banks[7]);
+    map_prg_8k(rom, isPrgSwapped ? 0 : 2, secondLastBank);
+    map_prg_8k(rom, 3, secondLastBank + 1);
+
+    int32_t chrInversion = (mmc3->bankSelect & 0x80) ? 4 : 0;
+    map_chr(rom, 0 ^ chrInversion, 2, mmc3->banks[0] >> 1);
+    map_chr(rom, 2 ^ chrInversion, 2, mmc3->banks[1] >> 1);
+    for (int32_t i = 0; i < 4; i++) {
+        map_chr_1k(rom, (4 + i) ^ chrInversion, mmc3->banks[2 + i]);
+    }
+}
+
+internal void
+mmc3_reset(Rom *rom)
+{
+    Mmc3 *mmc3 = &rom->mapperState.mmc3;
+    mmc3->banks[7] = 1;
+    mmc3_map(rom);
+}
+
+internal void
+mmc3_write(Rom *rom, uint16_t addr, uint8_t value)
+{
+    Mmc3 *mmc3 = &rom->mapperState.mmc3;
+
+    // registers are selected by the 8KB window and the low address bit
+    bool isOdd = addr & 0x01;
+    switch ((addr >> 13) & 0x03) {
+        case 0: {
+            if (isOdd) {
+                mmc3->banks[mmc3->bankSelect & 0x07] = value;
+            }
+            else {
+                mmc3->bankSelect = value;
+            }
+            mmc3_map(rom);
+        } break;
+        case 1: {
+            // odd: PRG RAM protection, ignored
+            if (!isOdd && (rom->mirror != FOUR_SCREEN)) {
+                rom->mirror = (value & 0x01) ? HORIZONTAL : VERTICAL;
+            }
+        } break;
+        case 2: {
+            if (isOdd) {
+                mmc3->irqCounter = 0;
+                mmc3->isIrqReload = true;
+            }
+            else {
+                mmc3->irqLatch = value;
+            }
+        } break;
+        case 3: {
+            mmc3->isIrqEnabled = isOdd;
+            if (!isOdd) {
+                mmc3->isIrqPending = false;
+            }
+        } break;
+    }
+}
+
+internal void
+mmc3_scanline(Rom *rom)
+{
+    Mmc3 *mmc3 = &rom->mapperState.mmc3;
+    if ((mmc3->irqCounter == 0) || mmc3->isIrqReload) {
+        mmc3->irqCounter = mmc3->irqLatch;
+        mmc3->isIrqReload = false;
+    }
+    else {
+        mmc3->irqCounter--;
+    }
+    if ((mmc3->irqCounter == 0) && mmc3->isIrqEnabled) {
+        mmc3->isIrqPending = true;
+    }
+}
+
+internal bool
+mmc3_irq(Rom *rom)
+{
+    bool result = rom->mapperState.mmc3.isIrqPending;
+    return result;
+}
+
+global const MapperOps mapperOps[] = {
+    [NROM] = {.reset = nrom_reset},
+    [MMC1] = {.reset = mmc1_reset, .write = mmc1_write},
+    [UXROM] = {.reset = uxrom_reset, .write = uxrom_write},
+    [CNROM] = {.reset = nrom_reset, .write = cnrom_write},
+    [MMC3] = {.reset = mmc3_reset, .write = mmc3_write, .scanline = mmc3_scanline, .irq = mmc3_irq},
+};
+
+const MapperOps *
+mapper_get_ops(Mapper mapper)
+{
+    const MapperOps *result = NULL;
+    if ((mapper >= 0) && (mapper < (Mapper)ARRAY_CAP(mapperOps))) {
+        result = &mapperOps[mapper];
+    }
+    return result;
+}
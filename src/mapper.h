@@ -0,0 +1,70 @@
+#ifndef MAPPER_H
+#define MAPPER_H
+
+#include <stdint.h>
+
+#include "utils.h"
+
+typedef int32_t Mapper;
+enum Mapper
+{
+    NROM = 0,
+    MMC1 = 1,
+    UXROM = 2,
+    CNROM = 3,
+    MMC3 = 4,
+};
+
+typedef struct Rom Rom;
+
+typedef struct Mmc1 Mmc1;
+struct Mmc1
+{
+    uint8_t shift;
+    uint8_t shiftCount;
+    uint8_t control;
+    uint8_t chrBank0;
+    uint8_t chrBank1;
+    uint8_t prgBank;
+};
+
+typedef struct Mmc3 Mmc3;
+struct Mmc3
+{
+    uint8_t bankSelect;
+    uint8_t banks[8];
+    uint8_t irqLatch;
+    uint8_t irqCounter;
+    bool isIrqReload;
+    bool isIrqEnabled;
+    bool isIrqPending;
+};
+
+typedef union MapperState MapperState;
+union MapperState
+{
+    uint8_t bank; // UxROM, CNROM
+    Mmc1 mmc1;
+    Mmc3 mmc3;
+};
+
+// Mappers only rearrange the bank pointers of the Rom (`prgWindows`, `chrWindows`) and its
+// mirroring, reads never go through them.
+typedef struct MapperOps MapperOps;
+struct MapperOps
+{
+    // Maps the power-on banks.
+    void (*reset)(Rom *rom);
+    // Write to $8000-$FFFF, NULL if the mapper has no registers.
+    void (*write)(Rom *rom, uint16_t addr, uint8_t value);
+    // Clocked at the end of every rendered scanline, NULL if the mapper doesn't count scanlines.
+    void (*scanline)(Rom *rom);
+    // Level of the mapper's IRQ output, which drives the CPU's IRQ line after each scanline
+    // clock and register write. NULL if the mapper has none.
+    bool (*irq)(Rom *rom);
+};
+
+// NULL if the mapper isn't supported.
+const MapperOps *mapper_get_ops(Mapper mapper);
+
+#endif //MAPPER_H
@@ -1,24 +1,228 @@
 #include "mmu.h"
+#include "cpu.h"
+#include "ppu.h"
 
-uint8_t
-mmu_cpu_read(Mmu *mmu, uint16_t addr)
+#include <stddef.h>
+#include <string.h> // memcpy
+
+internal uint8_t
+read_ppu_registers(Mmu *mmu, uint16_t addr)
+{
+    uint8_t result = ppu_read_register(mmu->ppu, addr & 0x7);
+    return result;
+}
+
+internal void
+write_ppu_registers(Mmu *mmu, uint16_t addr, uint8_t value)
+{
+    ppu_write_register(mmu->ppu, addr & 0x7, value);
+}
+
+// $4000-$40FF, only the bottom $20 bytes are registers, the rest is cartridge space
+internal uint8_t
+read_io_registers(Mmu *mmu, uint16_t addr)
 {
     uint8_t result = 0;
-    if (addr <= 0x1FFF) {
-        result = mmu->cpuRam[addr & 0x07FF];
+    if (addr <= 0x401F) {
+        // IO registers
     }
-    else if (addr <= 0x3FFF) {
-        result = mmu_ppu_read(mmu, addr & 0x7);
+    else {
+        result = rom_read(mmu->rom, addr);
+    }
+    return result;
+}
+
+// The mapper may switch CHR banks or mirroring, the PPU must have rendered what came before.
+// It may also acknowledge its IRQ.
+internal void
+write_cartridge(Mmu *mmu, uint16_t addr, uint8_t value)
+{
+    if (mmu->ppu) {
+        ppu_sync(mmu->ppu);
+    }
+    Rom *rom = mmu->rom;
+    rom_write(rom, addr, value);
+    if (rom->mapperOps->irq && mmu->cpu) {
+        cpu_set_irq(mmu->cpu, rom->mapperOps->irq(rom));
+    }
+}
+
+// Copies CPU page `page` to OAM at once, with a single memcpy when the page is mapped straight
+// to memory (RAM, PRG RAM/ROM) and the copy starts at the top of OAM as it nearly always does,
+// instead of emulating the 256 read/write pairs.
+internal void
+oam_dma(Mmu *mmu, uint8_t page)
+{
+    ppu_sync(mmu->ppu);
+
+    uint8_t *src = mmu->readPages[page];
+    uint8_t oamAddr = mmu->ppu->oamAddr;
+    if (src && (oamAddr == 0)) {
+        memcpy(mmu->ppuOam, src, PPU_OAM_SIZE);
+    }
+    else {
+        for (int32_t i = 0; i < PPU_OAM_SIZE; i++) {
+            mmu->ppuOam[(uint8_t)(oamAddr + i)] = mmu_cpu_read(mmu, (uint16_t)((page << 8) | i));
+        }
+    }
+    cpu_start_oam_dma(mmu->cpu);
+    // the new sprites may move the next sprite flag event
+    cpu_request_stop(mmu->cpu);
+}
+
+internal void
+write_io_registers(Mmu *mmu, uint16_t addr, uint8_t value)
+{
+    if (addr == 0x4014) {
+        oam_dma(mmu, value);
     }
     else if (addr <= 0x401F) {
         // IO registers
     }
     else {
-        result = rom_read(mmu->rom, addr);
+        write_cartridge(mmu, addr, value);
+    }
+}
+
+internal uint8_t
+read_cartridge(Mmu *mmu, uint16_t addr)
+{
+    uint8_t result = rom_read(mmu->rom, addr);
+    return result;
+}
+
+// Writes to PRG ROM are mapper register writes, which may have switched banks.
+internal void
+write_mapper(Mmu *mmu, uint16_t addr, uint8_t value)
+{
+    write_cartridge(mmu, addr, value);
+    mmu_map_prg(mmu);
+}
+
+// Accesses to watched pages are checked against the watch flags of the address, then go
+// through the page's mapping as usual.
+internal void
+push_watch_hit(Mmu *mmu, uint16_t addr, uint8_t value, MmuWatchFlags access)
+{
+    if (mmu->watchHitsPushedCount - mmu->watchHitsPoppedCount == MMU_WATCH_HITS_CAP) {
+        mmu->watchHitsDroppedCount++;
+        return;
+    }
+    MmuWatchHit *hit = &mmu->watchHits[mmu->watchHitsPushedCount++ & (MMU_WATCH_HITS_CAP - 1)];
+    hit->cyclesCount = mmu->cpu ? mmu->cpu->cyclesCount : 0;
+    hit->addr = addr;
+    hit->value = value;
+    hit->access = (uint8_t)access;
+}
+
+internal uint8_t
+read_watched(Mmu *mmu, uint16_t addr)
+{
+    uint8_t result = mmu_cpu_peek(mmu, addr);
+    if (mmu->watchFlags[addr] & MMU_WATCH_READ) {
+        push_watch_hit(mmu, addr, result, MMU_WATCH_READ);
     }
     return result;
 }
 
+internal void
+write_watched(Mmu *mmu, uint16_t addr, uint8_t value)
+{
+    if (mmu->watchFlags[addr] & MMU_WATCH_WRITE) {
+        push_watch_hit(mmu, addr, value, MMU_WATCH_WRITE);
+    }
+    MmuPageMapping *mapping = &mmu->mappings[addr >> 8];
+    if (mapping->writePage) {
+        mapping->writePage[addr & 0xFF] = value;
+    }
+    else {
+        mapping->writeHandler(mmu, addr, value);
+    }
+}
+
+// Derives the page table entries of `page` from its mapping and watch flags.
+internal void
+update_page(Mmu *mmu, int32_t page)
+{
+    MmuPageMapping *mapping = &mmu->mappings[page];
+    uint8_t flags = mmu->pageWatchFlags[page];
+    bool isReadWatched = flags & MMU_WATCH_READ;
+    bool isWriteWatched = flags & MMU_WATCH_WRITE;
+    mmu->readPages[page] = isReadWatched ? NULL : mapping->readPage;
+    mmu->readHandlers[page] = isReadWatched ? read_watched : mapping->readHandler;
+    mmu->writePages[page] = isWriteWatched ? NULL : mapping->writePage;
+    mmu->writeHandlers[page] = isWriteWatched ? write_watched : mapping->writeHandler;
+    mmu->fetchPages[page] = (flags & MMU_WATCH_EXECUTE) ? NULL : mapping->readPage;
+}
+
+void
+mmu_init(Mmu *mmu, Rom *rom)
+{
+    mmu->rom = rom;
+
+    for (int32_t page = 0; page < MMU_PAGES_COUNT; page++) {
+        int32_t addr = page * MMU_PAGE_SIZE;
+        MmuPageMapping *mapping = &mmu->mappings[page];
+        *mapping = (MmuPageMapping){};
+        if (addr <= 0x1FFF) {
+            // RAM and its mirrors
+            mapping->readPage = mmu->cpuRam + (addr & 0x07FF);
+            mapping->writePage = mmu->cpuRam + (addr & 0x07FF);
+        }
+        else if (addr <= 0x3FFF) {
+            mapping->readHandler = read_ppu_registers;
+            mapping->writeHandler = write_ppu_registers;
+        }
+        else if (addr <= 0x40FF) {
+            mapping->readHandler = read_io_registers;
+            mapping->writeHandler = write_io_registers;
+        }
+        else if (addr <= 0x5FFF) {
+            mapping->readHandler = read_cartridge;
+            mapping->writeHandler = write_cartridge;
+        }
+        else if (addr <= 0x7FFF) {
+            // PRG RAM (mirrored), boards without it or with odd sizes go through the handlers
+            if (rom->prgRam && ((rom->prgRamSize % MMU_PAGE_SIZE) == 0)) {
+                mapping->readPage = rom->prgRam + (addr - 0x6000) % rom->prgRamSize;
+                mapping->writePage = rom->prgRam + (addr - 0x6000) % rom->prgRamSize;
+            }
+            else {
+                mapping->readHandler = read_cartridge;
+                mapping->writeHandler = write_cartridge;
+            }
+        }
+        else {
+            mapping->writeHandler = write_mapper;
+        }
+        update_page(mmu, page);
+    }
+    mmu_map_prg(mmu);
+}
+
+// Points the $8000-$FFFF pages at the PRG banks currently mapped in, only the windows whose
+// bank changed are rewritten (and the CPU's fetch page dropped, it may be one of them).
+// Writes there stay on the mapper handler.
+void
+mmu_map_prg(Mmu *mmu)
+{
+    Rom *rom = mmu->rom;
+    int32_t windowPagesCount = ROM_PRG_WINDOW_SIZE / MMU_PAGE_SIZE;
+    for (int32_t window = 0; window < ROM_PRG_WINDOWS_COUNT; window++) {
+        uint8_t *bank = rom->prgWindows[window];
+        int32_t firstPage = MMU_PRG_FIRST_PAGE + window * windowPagesCount;
+        if (mmu->mappings[firstPage].readPage != bank) {
+            for (int32_t i = 0; i < windowPagesCount; i++) {
+                mmu->mappings[firstPage + i].readPage = bank + i * MMU_PAGE_SIZE;
+                update_page(mmu, firstPage + i);
+            }
+            if (mmu->cpu) {
+                cpu_invalidate_fetch_page(mmu->cpu);
+            }
+        }
+    }
+}
+
 uint16_t
 mmu_cpu_read16(Mmu *mmu, uint16_t addr)
 {
@@ -28,31 +232,121 @@ mmu_cpu_read16(Mmu *mmu, uint16_t addr)
     return result;
 }
 
+uint8_t
+mmu_cpu_fetch(Mmu *mmu, uint16_t addr, bool isOpcode)
+{
+    uint8_t result = mmu_cpu_peek(mmu, addr);
+    if (isOpcode && (mmu->watchFlags[addr] & MMU_WATCH_EXECUTE)) {
+        push_watch_hit(mmu, addr, result, MMU_WATCH_EXECUTE);
+    }
+    return result;
+}
+
+uint8_t
+mmu_cpu_peek(Mmu *mmu, uint16_t addr)
+{
+    MmuPageMapping *mapping = &mmu->mappings[addr >> 8];
+    uint8_t result = mapping->readPage ? mapping->readPage[addr & 0xFF] : mapping->readHandler(mmu, addr);
+    return result;
+}
+
 void
-mmu_cpu_write(Mmu *mmu, uint16_t addr, uint8_t value)
+mmu_set_watch(Mmu *mmu, uint16_t addr, int32_t count, MmuWatchFlags flags)
 {
-    if (addr <= 0x1FFF) {
-        mmu->cpuRam[addr & 0x07FF] = value;
+    for (int32_t i = 0; i < count; i++) {
+        mmu->watchFlags[(uint16_t)(addr + i)] = (uint8_t)flags;
     }
-    else if (addr <= 0x3FFF) {
-        mmu_ppu_write(mmu, addr & 0x7, value);
+
+    mmu->isRamWatched = false;
+    for (int32_t page = 0; page < MMU_PAGES_COUNT; page++) {
+        uint8_t pageFlags = 0;
+        for (int32_t i = 0; i < MMU_PAGE_SIZE; i++) {
+            pageFlags |= mmu->watchFlags[page * MMU_PAGE_SIZE + i];
+        }
+        mmu->pageWatchFlags[page] = pageFlags;
+        mmu->isRamWatched |= (page < MMU_RAM_PAGES_COUNT) && pageFlags;
+        update_page(mmu, page);
     }
-    else if (addr <= 0x401F) {
-        // IO registers
+
+    // decoded blocks and native code were built for the previous watchpoints
+    if (mmu->cpu) {
+        cpu_invalidate_code(mmu->cpu);
     }
-    else {
-        rom_write(mmu->rom, addr, value);
+}
+
+int32_t
+mmu_pop_watch_hits(Mmu *mmu, MmuWatchHit *hits, int32_t cap)
+{
+    int32_t count = 0;
+    while ((count < cap) && (mmu->watchHitsPoppedCount < mmu->watchHitsPushedCount)) {
+        hits[count++] = mmu->watchHits[mmu->watchHitsPoppedCount++ & (MMU_WATCH_HITS_CAP - 1)];
+    }
+    return count;
+}
+
+// Offset into `ppuRam` of a nametable address ($2000-$3EFF).
+internal int32_t
+nametable_offset(Mirror mirror, uint16_t addr)
+{
+    int32_t nametable = (addr >> 10) & 0x03;
+    switch (mirror) {
+        case HORIZONTAL: {
+            nametable >>= 1;
+        } break;
+        case VERTICAL: {
+            nametable &= 1;
+        } break;
+        case SINGLE_SCREEN_LOW: {
+            nametable = 0;
+        } break;
+        case SINGLE_SCREEN_HIGH: {
+            nametable = 1;
+        } break;
+        default: {
+            // four-screen
+        } break;
+    }
+    int32_t result = nametable * KB(1) + (addr & 0x03FF);
+    return result;
+}
+
+// $3F10/$3F14/$3F18/$3F1C are the backdrop entries $3F00/$3F04/$3F08/$3F0C.
+internal int32_t
+palette_offset(uint16_t addr)
+{
+    int32_t result = addr & 0x1F;
+    if ((result & 0x13) == 0x10) {
+        result &= ~0x10;
     }
+    return result;
 }
 
 uint8_t
 mmu_ppu_read(Mmu *mmu, uint16_t addr)
 {
-    return 0;
+    uint8_t result = 0;
+    if (addr < 0x2000) {
+        result = rom_read_chr(mmu->rom, addr);
+    }
+    else if (addr < 0x3F00) {
+        result = mmu->ppuRam[nametable_offset(mmu->rom->mirror, addr)];
+    }
+    else {
+        result = mmu->ppuPalette[palette_offset(addr)];
+    }
+    return result;
 }
 
 void
 mmu_ppu_write(Mmu *mmu, uint16_t addr, uint8_t value)
 {
-
+    if (addr < 0x2000) {
+        rom_write_chr(mmu->rom, addr, value);
+    }
+    else if (addr < 0x3F00) {
+        mmu->ppuRam[nametable_offset(mmu->rom->mirror, addr)] = value;
+    }
+    else {
+        mmu->ppuPalette[palette_offset(addr)] = value & 0x3F;
+    }
 }
@@ -6,11 +6,50 @@
 #include "rom.h"
 
 #define CPU_RAM_SIZE KB(2)
-#define PPU_RAM_SIZE KB(2)
+#define PPU_RAM_SIZE KB(4) // 2KB on the console, four-screen boards add the other 2KB
 #define PPU_PALETTE_SIZE 32
 #define PPU_OAM_SIZE 256
 
+#define MMU_PAGE_SIZE 256
+#define MMU_PAGES_COUNT 256
+#define MMU_PRG_FIRST_PAGE 0x80
+#define MMU_RAM_PAGES_COUNT 0x20
+#define MMU_WATCH_HITS_CAP 1024 // power of 2
+
 typedef struct Mmu Mmu;
+typedef struct Cpu Cpu;
+typedef struct Ppu Ppu;
+
+typedef uint8_t MmuReadHandler(Mmu *mmu, uint16_t addr);
+typedef void MmuWriteHandler(Mmu *mmu, uint16_t addr, uint8_t value);
+
+// What a page is mapped to, whether or not its accesses are diverted by a watchpoint.
+typedef struct MmuPageMapping MmuPageMapping;
+struct MmuPageMapping
+{
+    uint8_t *readPage;
+    uint8_t *writePage;
+    MmuReadHandler *readHandler;
+    MmuWriteHandler *writeHandler;
+};
+
+typedef int32_t MmuWatchFlags;
+enum MmuWatchFlags
+{
+    MMU_WATCH_READ = 1 << 0,
+    MMU_WATCH_WRITE = 1 << 1,
+    MMU_WATCH_EXECUTE = 1 << 2, // opcode fetches
+};
+
+typedef struct MmuWatchHit MmuWatchHit;
+struct MmuWatchHit
+{
+    uint64_t cyclesCount; // when the accessing instruction started
+    uint16_t addr;
+    uint8_t value; // read, written or opcode fetched
+    uint8_t access; // one of MmuWatchFlags
+};
+
 struct Mmu
 {
     // CPU Memory Mapping:
@@ -66,8 +105,32 @@ struct Mmu
     //   - $6000–$7FFF Save RAM
     //   - $8000–$FFFF PRG ROM
     Rom *rom;
+    Cpu *cpu; // halted by OAM DMA
+    Ppu *ppu; // behind $2000-$2007
     uint8_t cpuRam[CPU_RAM_SIZE];
 
+    // CPU bus page table: RAM and PRG pages point straight at their memory (indexed by the
+    // low address byte), the others (NULL) go through the page's handler. Instruction fetches
+    // have their own pointers, so that watching reads and opcodes are independent.
+    uint8_t *readPages[MMU_PAGES_COUNT];
+    uint8_t *writePages[MMU_PAGES_COUNT];
+    uint8_t *fetchPages[MMU_PAGES_COUNT];
+    MmuReadHandler *readHandlers[MMU_PAGES_COUNT];
+    MmuWriteHandler *writeHandlers[MMU_PAGES_COUNT];
+
+    // Watchpoints: the page table above is derived from `mappings`, pages holding watched
+    // addresses get the checking handlers instead, so unwatched pages never test anything.
+    // Hits are queued for the caller to drain (see mmu_pop_watch_hits), the ones that don't
+    // fit are dropped.
+    MmuPageMapping mappings[MMU_PAGES_COUNT];
+    uint8_t watchFlags[KB(64)];
+    uint8_t pageWatchFlags[MMU_PAGES_COUNT]; // union of the flags of the page's addresses
+    bool isRamWatched; // native code accesses RAM directly, so it must not be compiled then
+    MmuWatchHit watchHits[MMU_WATCH_HITS_CAP];
+    uint64_t watchHitsPushedCount;
+    uint64_t watchHitsPoppedCount;
+    uint64_t watchHitsDroppedCount;
+
     // PPU Memory Mapping:
     // - $0000-$1FFF CHR ROM
     //   - $0000-$0FFF pattern table 0
@@ -77,7 +140,8 @@ struct Mmu
     //   - $2400-$27FF name table 1
     //   - $2800-$2BFF name table 2
     //   - $2C00-$2FFF name table 3
-    //   - $3000-$3EFF unused
+    //   (only 2 of them are backed by RAM but on four-screen boards, see `Mirror`)
+    //   - $3000-$3EFF mirrors $2000-$2EFF
     // - $3F00–$3FFF ROM
     //   - $3F00-$3F1F palette RAM indexes
     //   - $3F20-$3FFF mirrors $3F00-$3F1F
@@ -87,10 +151,40 @@ struct Mmu
     uint8_t ppuOam[PPU_OAM_SIZE];
 };
 
-uint8_t mmu_cpu_read(Mmu *mmu, uint16_t addr);
+void mmu_init(Mmu *mmu, Rom *rom);
+void mmu_map_prg(Mmu *mmu);
 uint16_t mmu_cpu_read16(Mmu *mmu, uint16_t addr);
-void mmu_cpu_write(Mmu *mmu, uint16_t addr, uint8_t value);
+// Instruction fetch from a page without a fetch pointer (bus handlers and watched code).
+uint8_t mmu_cpu_fetch(Mmu *mmu, uint16_t addr, bool isOpcode);
+// Read bypassing watchpoints, for decoding and tracing.
+uint8_t mmu_cpu_peek(Mmu *mmu, uint16_t addr);
+// Replaces the watch flags of the `count` addresses from `addr` (0 unwatches them). Accesses
+// through RAM mirrors of a watched address aren't reported.
+void mmu_set_watch(Mmu *mmu, uint16_t addr, int32_t count, MmuWatchFlags flags);
+// Moves up to `cap` queued hits, oldest first, into `hits` and returns how many.
+int32_t mmu_pop_watch_hits(Mmu *mmu, MmuWatchHit *hits, int32_t cap);
+
+internal FORCE_INLINE uint8_t
+mmu_cpu_read(Mmu *mmu, uint16_t addr)
+{
+    uint8_t *page = mmu->readPages[addr >> 8];
+    uint8_t result = page ? page[addr & 0xFF] : mmu->readHandlers[addr >> 8](mmu, addr);
+    return result;
+}
+
+internal FORCE_INLINE void
+mmu_cpu_write(Mmu *mmu, uint16_t addr, uint8_t value)
+{
+    uint8_t *page = mmu->writePages[addr >> 8];
+    if (page) {
+        page[addr & 0xFF] = value;
+    }
+    else {
+        mmu->writeHandlers[addr >> 8](mmu, addr, value);
+    }
+}
 
+// PPU bus, `addr` in $0000-$3FFF
 uint8_t mmu_ppu_read(Mmu *mmu, uint16_t addr);
 void mmu_ppu_write(Mmu *mmu, uint16_t addr, uint8_t value);
 
@@ -1,6 +1,23 @@
 #include "nes.h"
 
 #include <stdio.h>
+#include <string.h>
+#include <errno.h>
+
+// The ROM path with its extension replaced by ".sav".
+internal Str8
+save_path(Arena *arena, Str8 romPath)
+{
+    int32_t length = romPath.length;
+    for (int32_t i = romPath.length - 1; (i >= 0) && (romPath.chars[i] != '/'); i--) {
+        if (romPath.chars[i] == '.') {
+            length = i;
+            break;
+        }
+    }
+    Str8 result = str8_sprintf(arena, "%.*s.sav", length, romPath.chars);
+    return result;
+}
 
 bool
 nes_init(Arena *arena, Nes *nes, Str8 romPath)
@@ -10,27 +27,132 @@ nes_init(Arena *arena, Nes *nes, Str8 romPath)
         return false;
     }
 
+    if (rom->hasBattery && rom->prgRam) {
+        ArenaBackup arenaBck = arena_backup(arena);
+        Str8 savePath = save_path(arenaBck.arena, romPath);
+        bool isSaveMapped = rom_map_save(arenaBck.arena, rom, savePath, nes->saveMode);
+        arena_restore(&arenaBck);
+        if (!isSaveMapped) {
+            return false;
+        }
+    }
+
     Mmu *mmu = &nes->mmu;
-    mmu->rom = rom;
+    mmu_init(mmu, rom);
 
     Cpu *cpu = &nes->cpu;
     cpu->mmu = mmu;
-    if (!cpu_init(cpu)) {
+    mmu->cpu = cpu;
+    if (!cpu_init(arena, cpu)) {
         return false;
     }
 
     Ppu *ppu = &nes->ppu;
-    ppu->mmu = mmu;
+    ppu_init(ppu, mmu, cpu);
+    mmu->ppu = ppu;
+    nes->frameCyclesCount = cpu->cyclesCount;
 
     return true;
 }
 
+// Same contract as cpu_run.
+internal int64_t
+run_cpu(Nes *nes, int64_t cyclesBudget)
+{
+    Cpu *cpu = &nes->cpu;
+
+    int64_t result = 0;
+    if (nes->isTracing || nes->isStepping) {
+        int64_t cyclesCount = 0;
+        cpu->isStopRequested = false;
+        while (cyclesCount < cyclesBudget && !cpu->isJammed && !cpu->isStopRequested) {
+            // (a DMA stall isn't an instruction)
+            if (nes->isTracing && (cpu->pendingCyclesCount == 0)) {
+                trace_cpu(&nes->trace, cpu);
+            }
+            cyclesCount += cpu_step(cpu);
+        }
+        result = cyclesCount - cyclesBudget;
+    }
+    else {
+        result = cpu_run(cpu, cyclesBudget);
+    }
+    if (nes->cpuRunHook) {
+        nes->cpuRunHook(nes, nes->cpuRunHookData);
+    }
+    return result;
+}
+
 void
-nes_display_update(Arena *arena, Nes *nes, uint32_t *pixels)
+nes_run_frame(Nes *nes, bool isRendered)
 {
-    if (nes->cpu.pendingCyclesCount == 0) {
-        Str8 cpuState = cpu_sprint(arena, &nes->cpu);
-        printf("%*s\n", STR8_VARG(cpuState));
+    Rom *rom = &nes->rom;
+    Cpu *cpu = &nes->cpu;
+    Ppu *ppu = &nes->ppu;
+
+    // The CPU runs from one PPU event to the next, the PPU renders in between whenever the CPU
+    // touches it (the previous frame already ran the first cycles of this one).
+    uint8_t *frame = isRendered ? &nes->frame[0][0] : NULL;
+    uint8_t *frameEmphasis = isRendered ? nes->frameEmphasis : NULL;
+    ppu_start_frame(ppu, nes->frameCyclesCount, frame, frameEmphasis);
+    for (;;) {
+        // a jammed CPU doesn't get anywhere, the frame goes on without it
+        ppu_catch_up(ppu, cpu->isJammed ? UINT64_MAX : cpu->cyclesCount);
+        if (ppu_is_frame_done(ppu)) {
+            break;
+        }
+        run_cpu(nes, (int64_t)(ppu_next_event(ppu) - cpu->cyclesCount));
     }
-    cpu_tick(&nes->cpu);
+    nes->frameCyclesCount += PPU_CPU_CYCLES_PER_FRAME;
+    nes->framesCount++;
+
+    if (nes->saveSyncFramesCount && ((nes->framesCount % (uint64_t)nes->saveSyncFramesCount) == 0)) {
+        rom_sync_save(rom, false);
+    }
+
+    if (nes->isTracing) {
+        trace_flush(&nes->trace);
+    }
+}
+
+void
+nes_convert_frame(Nes *nes, uint32_t *pixels, int32_t pitch)
+{
+    for (int32_t y = 0; y < NES_DISPLAY_HEIGHT_PX; y++) {
+        uint32_t *row = (uint32_t *)((uint8_t *)pixels + y * pitch);
+        ppu_convert_line(&nes->ppu, nes->frame[y], nes->frameEmphasis[y], row);
+    }
+}
+
+void
+nes_deinit(Nes *nes)
+{
+    rom_sync_save(&nes->rom, true);
+}
+
+#if CPU_PROFILE
+#define NES_PROFILE_REPORT_PCS_COUNT 32
+
+bool
+nes_write_profile(Arena *arena, Nes *nes, Str8 csvPath)
+{
+    ArenaBackup arenaBck = arena_backup(arena);
+
+    Str8 report = cpu_profile_sprint(arenaBck.arena, &nes->cpu, NES_PROFILE_REPORT_PCS_COUNT);
+    printf("%.*s\n", STR8_VARG(report));
+
+    bool result = false;
+    FILE *csvFile = fopen(str8_to_cstr(arenaBck.arena, csvPath), "wb");
+    if (csvFile) {
+        Str8 csv = cpu_profile_sprint_csv(arenaBck.arena, &nes->cpu);
+        result = (fwrite(csv.bytes, 1, csv.length, csvFile) == (size_t)csv.length) && (fputc('\n', csvFile) != EOF);
+        result = (fclose(csvFile) == 0) && result;
+    }
+    if (!result) {
+        fprintf(stderr, "Failed to write profile '%.*s': %s\n", STR8_VARG(csvPath), strerror(errno));
+    }
+
+    arena_restore(&arenaBck);
+    return result;
 }
+#endif
@@ -7,20 +7,53 @@
 #include "mmu.h"
 #include "cpu.h"
 #include "ppu.h"
+#include "trace.h"
 
 #define NES_DISPLAY_WIDTH_PX 256
 #define NES_DISPLAY_HEIGHT_PX 240
 
 typedef struct Nes Nes;
+// Called by nes_run_frame after each CPU run, e.g. to drain watchpoint hits.
+typedef void NesCpuRunHook(Nes *nes, void *data);
+
 struct Nes
 {
     Rom rom;
     Mmu mmu;
     Cpu cpu;
     Ppu ppu;
+
+    uint64_t frameCyclesCount; // CPU cycle the next frame starts at
+    uint64_t framesCount;
+
+    // Last frame rendered: the colour (0-63) of each pixel, and the emphasis bits each scanline
+    // was rendered with. nes_convert_frame turns it into RGBA whenever someone wants that.
+    uint8_t frame[NES_DISPLAY_HEIGHT_PX][NES_DISPLAY_WIDTH_PX];
+    uint8_t frameEmphasis[NES_DISPLAY_HEIGHT_PX];
+
+    // Set before nes_init. Battery saves live next to the ROM (game.nes -> game.sav), private
+    // by default so batch runs never write them.
+    RomSaveMode saveMode;
+    int32_t saveSyncFramesCount; // frames between background syncs of a shared save, 0 for none
+    bool isTracing;
+    Trace trace;
+    // Runs the CPU one cpu_step at a time (the reference interpreter, as when tracing) instead
+    // of through cpu_run.
+    bool isStepping;
+    NesCpuRunHook *cpuRunHook; // NULL for none
+    void *cpuRunHookData;
 };
 
 bool nes_init(Arena *arena, Nes *nes, Str8 romPath);
-void nes_display_update(Arena *arena, Nes *nes, uint32_t *pixels);
+// Renders into `frame` if `isRendered`, otherwise leaves it as it was.
+void nes_run_frame(Nes *nes, bool isRendered);
+// Writes `frame` as RGBA8888 rows `pitch` bytes apart.
+void nes_convert_frame(Nes *nes, uint32_t *pixels, int32_t pitch);
+// Flushes the battery save to disk.
+void nes_deinit(Nes *nes);
+#if CPU_PROFILE
+// Prints the CPU profile report to stdout and dumps its counters as CSV to `csvPath`.
+bool nes_write_profile(Arena *arena, Nes *nes, Str8 csvPath);
+#endif
 
 #endif //NES_H
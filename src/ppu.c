@@ -1 +1,519 @@
+#include <string.h> // memset
+
 #include "ppu.h"
+
+// 2C02 colours as SDL_PIXELFORMAT_RGBA8888
+global const uint32_t ppuColors[64] = {
+    0x626262FF, 0x001FB2FF, 0x2404C8FF, 0x5200B2FF, 0x730076FF, 0x800024FF, 0x730B00FF, 0x522800FF,
+    0x244400FF, 0x005700FF, 0x005C00FF, 0x005324FF, 0x003C76FF, 0x000000FF, 0x000000FF, 0x000000FF,
+    0xABABABFF, 0x0D57FFFF, 0x4B30FFFF, 0x8A13FFFF, 0xBC08D6FF, 0xD21269FF, 0xC72E00FF, 0x9D5400FF,
+    0x607B00FF, 0x209800FF, 0x00A300FF, 0x009942FF, 0x007DB4FF, 0x000000FF, 0x000000FF, 0x000000FF,
+    0xFFFFFFFF, 0x53AEFFFF, 0x9085FFFF, 0xD365FFFF, 0xFF57FFFF, 0xFF5DCFFF, 0xFF7757FF, 0xFA9E00FF,
+    0xBDC700FF, 0x7AE700FF, 0x43F611FF, 0x26EF7EFF, 0x2CD5F6FF, 0x4E4E4EFF, 0x000000FF, 0x000000FF,
+    0xFFFFFFFF, 0xB6E1FFFF, 0xCED1FFFF, 0xE9C3FFFF, 0xFFBCFFFF, 0xFFBDF4FF, 0xFFC6C3FF, 0xFFD59AFF,
+    0xE9E681FF, 0xCEF481FF, 0xB6FB9AFF, 0xA9FAC3FF, 0xA9F0F4FF, 0xB8B8B8FF, 0x000000FF, 0x000000FF,
+};
+
+void
+ppu_init(Ppu *ppu, Mmu *mmu, Cpu *cpu)
+{
+    ppu->mmu = mmu;
+    ppu->cpu = cpu;
+    ppu->ctrl = 0;
+    ppu->mask = 0;
+    ppu->status = 0;
+    ppu->oamAddr = 0;
+    ppu->v = 0;
+    ppu->t = 0;
+    ppu->fineX = 0;
+    ppu->w = false;
+    ppu->readBuffer = 0;
+    // no frame until ppu_start_frame
+    ppu->frameCyclesCount = 0;
+    ppu->scanline = PPU_SCANLINES_COUNT + 1;
+    ppu->frame = NULL;
+    ppu->frameEmphasis = NULL;
+    ppu->kernels = compose_get_best();
+
+    // Each emphasis bit darkens the other two channels, except on the blacks of columns $E-$F.
+    for (int32_t emphasis = 0; emphasis < PPU_EMPHASIS_COUNT; emphasis++) {
+        for (int32_t color = 0; color < COMPOSE_COLORS_COUNT; color++) {
+            uint32_t rgba = ppuColors[color];
+            if (emphasis && ((color & 0x0F) < 0x0E)) {
+                uint32_t attenuated = 0xFF;
+                for (int32_t channel = 0; channel < 3; channel++) {
+                    uint32_t shift = 24 - 8 * (uint32_t)channel;
+                    uint32_t value = (rgba >> shift) & 0xFF;
+                    if (emphasis & ~(1 << channel)) {
+                        value = value * 3 / 4;
+                    }
+                    attenuated |= value << shift;
+                }
+                rgba = attenuated;
+            }
+            ppu->rgba[emphasis][color] = rgba;
+        }
+    }
+}
+
+bool
+ppu_is_rendering(Ppu *ppu)
+{
+    bool result = ppu->mask & (PPU_MASK_BACKGROUND | PPU_MASK_SPRITES);
+    return result;
+}
+
+// Moves `v` down a pixel row, wrapping into the nametable below after the 30th tile row.
+internal void
+increment_y(Ppu *ppu)
+{
+    if ((ppu->v & 0x7000) != 0x7000) {
+        ppu->v += 0x1000;
+        return;
+    }
+
+    ppu->v &= ~0x7000;
+    int32_t coarseY = (ppu->v & 0x03E0) >> 5;
+    if (coarseY == 29) {
+        coarseY = 0;
+        ppu->v ^= 0x0800;
+    }
+    else if (coarseY == 31) {
+        // out of the nametable (attribute bytes), wraps without switching nametables
+        coarseY = 0;
+    }
+    else {
+        coarseY++;
+    }
+    ppu->v = (uint16_t)((ppu->v & ~0x03E0) | (coarseY << 5));
+}
+
+// Background palette RAM indexes of the scanline `v` points at, `fineX` included. 0 is
+// transparent (the backdrop).
+internal void
+render_background(Ppu *ppu, uint8_t *line)
+{
+    Mmu *mmu = ppu->mmu;
+    uint16_t v = ppu->v;
+    uint16_t patternTable = (ppu->ctrl & PPU_CTRL_BACKGROUND_TABLE) ? 0x1000 : 0x0000;
+    int32_t fineY = (v >> 12) & 0x07;
+
+    // 33 tiles, the first one is partly scrolled out
+    uint8_t tilesLine[PPU_DISPLAY_WIDTH_PX + 8];
+    for (int32_t tile = 0; tile <= PPU_DISPLAY_WIDTH_PX / 8; tile++) {
+        uint8_t tileIdx = mmu_ppu_read(mmu, 0x2000 | (v & 0x0FFF));
+        uint8_t attribute = mmu_ppu_read(mmu, 0x23C0 | (v & 0x0C00) | ((v >> 4) & 0x38) | ((v >> 2) & 0x07));
+        int32_t palette = (attribute >> (((v >> 4) & 0x04) | (v & 0x02))) & 0x03;
+
+        uint16_t patternAddr = (uint16_t)(patternTable + tileIdx * 16 + fineY);
+        uint8_t *pixels = rom_chr_tile_row(mmu->rom, patternAddr, false);
+        for (int32_t i = 0; i < 8; i++) {
+            uint8_t pixel = pixels[i];
+            tilesLine[tile * 8 + i] = (uint8_t)(pixel ? ((palette << 2) | pixel) : 0);
+        }
+
+        // next tile, into the horizontally adjacent nametable past the 32nd
+        if ((v & 0x001F) == 31) {
+            v = (uint16_t)((v & ~0x001F) ^ 0x0400);
+        }
+        else {
+            v++;
+        }
+    }
+    memcpy(line, tilesLine + ppu->fineX, PPU_DISPLAY_WIDTH_PX);
+
+    if (!(ppu->mask & PPU_MASK_BACKGROUND_LEFT)) {
+        memset(line, 0, 8);
+    }
+}
+
+// Sets the sprite overflow flag when more than 8 sprites are on `scanline`, whether or not
+// the scanline is rendered into the frame.
+internal void
+evaluate_sprites(Ppu *ppu, int32_t scanline)
+{
+    if (ppu->status & PPU_STATUS_SPRITE_OVERFLOW) {
+        return;
+    }
+
+    uint8_t *oam = ppu->mmu->ppuOam;
+    int32_t height = (ppu->ctrl & PPU_CTRL_SPRITE_8X16) ? 16 : 8;
+    int32_t spritesCount = 0;
+    for (int32_t sprite = 0; sprite < PPU_OAM_SIZE / 4; sprite++) {
+        // sprites show up a scanline below their Y
+        int32_t row = scanline - (oam[sprite * 4] + 1);
+        if ((row >= 0) && (row < height) && (++spritesCount > PPU_SPRITES_PER_SCANLINE)) {
+            ppu->status |= PPU_STATUS_SPRITE_OVERFLOW;
+            break;
+        }
+    }
+}
+
+// Sprite palette RAM indexes (and flags) of `scanline`, the first sprite in OAM wins where
+// sprites overlap, as on the hardware. Only the first 8 sprites of the scanline are drawn.
+internal void
+render_sprites(Ppu *ppu, int32_t scanline, uint8_t *line)
+{
+    Mmu *mmu = ppu->mmu;
+    int32_t height = (ppu->ctrl & PPU_CTRL_SPRITE_8X16) ? 16 : 8;
+
+    int32_t spritesCount = 0;
+    for (int32_t sprite = 0; sprite < PPU_OAM_SIZE / 4; sprite++) {
+        uint8_t *entry = &mmu->ppuOam[sprite * 4];
+        // sprites show up a scanline below their Y
+        int32_t row = scanline - (entry[0] + 1);
+        if ((row < 0) || (row >= height)) {
+            continue;
+        }
+        if (spritesCount == PPU_SPRITES_PER_SCANLINE) {
+            break;
+        }
+        spritesCount++;
+
+        uint8_t tileIdx = entry[1];
+        uint8_t attributes = entry[2];
+        int32_t x = entry[3];
+        if (attributes & 0x80) {
+            row = height - 1 - row;
+        }
+
+        uint16_t patternAddr = 0;
+        if (height == 16) {
+            // 8x16 sprites pick their pattern table with bit 0 of the tile index
+            patternAddr = (uint16_t)(((tileIdx & 0x01) ? 0x1000 : 0x0000) + (tileIdx & 0xFE) * 16 + (row & 0x08) * 2 + (row & 0x07));
+        }
+        else {
+            patternAddr = (uint16_t)(((ppu->ctrl & PPU_CTRL_SPRITE_TABLE) ? 0x1000 : 0x0000) + tileIdx * 16 + row);
+        }
+        uint8_t *pixels = rom_chr_tile_row(mmu->rom, patternAddr, attributes & 0x40);
+
+        uint8_t flags = (uint8_t)(COMPOSE_SPRITE_PALETTE | ((attributes & 0x03) << 2));
+        if (attributes & 0x20) {
+            flags |= COMPOSE_SPRITE_BEHIND_BACKGROUND;
+        }
+        if (sprite == 0) {
+            flags |= COMPOSE_SPRITE_0;
+        }
+        for (int32_t i = 0; (i < 8) && (x + i < PPU_DISPLAY_WIDTH_PX); i++) {
+            uint8_t pixel = pixels[i];
+            if (pixel && !line[x + i]) {
+                line[x + i] = (uint8_t)(flags | pixel);
+            }
+        }
+    }
+
+    if (!(ppu->mask & PPU_MASK_SPRITES_LEFT)) {
+        memset(line, 0, 8);
+    }
+}
+
+// Whether sprite 0 may overlap the background on `scanline`, the only reason to look at the
+// pixels of a scanline no one displays.
+internal bool
+is_sprite_0_hit_possible(Ppu *ppu, int32_t scanline)
+{
+    int32_t height = (ppu->ctrl & PPU_CTRL_SPRITE_8X16) ? 16 : 8;
+    int32_t row = scanline - (ppu->mmu->ppuOam[0] + 1);
+    bool result = !(ppu->status & PPU_STATUS_SPRITE_0_HIT) &&
+                  ((ppu->mask & (PPU_MASK_BACKGROUND | PPU_MASK_SPRITES)) == (PPU_MASK_BACKGROUND | PPU_MASK_SPRITES)) &&
+                  (row >= 0) && (row < height);
+    return result;
+}
+
+internal void
+render_scanline(Ppu *ppu, int32_t scanline, uint8_t *line)
+{
+    uint8_t *paletteRam = ppu->mmu->ppuPalette;
+    uint8_t greyscaleMask = (ppu->mask & PPU_MASK_GREYSCALE) ? 0x30 : 0x3F;
+
+    if (!ppu_is_rendering(ppu)) {
+        // the backdrop colour
+        if (line) {
+            memset(line, paletteRam[0] & greyscaleMask, PPU_DISPLAY_WIDTH_PX);
+        }
+        return;
+    }
+
+    // v's horizontal bits are reloaded at the end of each scanline for the next one
+    ppu->v = (uint16_t)((ppu->v & ~0x041F) | (ppu->t & 0x041F));
+
+    if (ppu->mask & PPU_MASK_SPRITES) {
+        evaluate_sprites(ppu, scanline);
+    }
+
+    if (line || is_sprite_0_hit_possible(ppu, scanline)) {
+        uint8_t background[PPU_DISPLAY_WIDTH_PX] = {};
+        uint8_t sprites[PPU_DISPLAY_WIDTH_PX] = {};
+        if (ppu->mask & PPU_MASK_BACKGROUND) {
+            render_background(ppu, background);
+        }
+        if (ppu->mask & PPU_MASK_SPRITES) {
+            render_sprites(ppu, scanline, sprites);
+        }
+
+        uint8_t palette[COMPOSE_PALETTE_COUNT];
+        for (int32_t i = 0; i < COMPOSE_PALETTE_COUNT; i++) {
+            palette[i] = paletteRam[i] & greyscaleMask;
+        }
+        // lines no one displays are only composited for the sprite 0 hit
+        uint8_t scratchLine[PPU_DISPLAY_WIDTH_PX];
+        if (ppu->kernels->compose(background, sprites, palette, line ? line : scratchLine)) {
+            ppu->status |= PPU_STATUS_SPRITE_0_HIT;
+        }
+    }
+
+    increment_y(ppu);
+}
+
+internal void
+start_scanline(Ppu *ppu, int32_t scanline)
+{
+    if (scanline < PPU_DISPLAY_HEIGHT_PX) {
+        uint8_t *line = NULL;
+        if (ppu->frame) {
+            line = ppu->frame + scanline * PPU_DISPLAY_WIDTH_PX;
+            ppu->frameEmphasis[scanline] = (uint8_t)((ppu->mask & PPU_MASK_EMPHASIS) >> PPU_MASK_EMPHASIS_SHIFT);
+        }
+        render_scanline(ppu, scanline, line);
+    }
+    else if (scanline == PPU_VBLANK_SCANLINE) {
+        ppu->status |= PPU_STATUS_VBLANK;
+        if (ppu->ctrl & PPU_CTRL_NMI) {
+            cpu_interrupt(ppu->cpu, NMI);
+        }
+    }
+    else if (scanline == PPU_PRE_RENDER_SCANLINE) {
+        ppu->status = 0;
+        if (ppu_is_rendering(ppu)) {
+            // the whole scroll is reloaded for the next frame
+            ppu->v = ppu->t;
+        }
+    }
+}
+
+internal void
+end_scanline(Ppu *ppu, int32_t scanline)
+{
+    // Mappers counting scanlines only see the rendered ones (visible and pre-render).
+    Rom *rom = ppu->mmu->rom;
+    bool isRendered = (scanline < PPU_DISPLAY_HEIGHT_PX) || (scanline == PPU_PRE_RENDER_SCANLINE);
+    if (rom->mapperOps->scanline && isRendered && ppu_is_rendering(ppu)) {
+        rom->mapperOps->scanline(rom);
+        cpu_set_irq(ppu->cpu, rom->mapperOps->irq(rom));
+    }
+}
+
+// CPU cycle scanline `scanline` starts at (and the previous one ends).
+internal uint64_t
+scanline_cycles(Ppu *ppu, int32_t scanline)
+{
+    uint64_t result = ppu->frameCyclesCount + (uint64_t)scanline * PPU_CPU_CYCLES_PER_FRAME / PPU_SCANLINES_COUNT;
+    return result;
+}
+
+void
+ppu_start_frame(Ppu *ppu, uint64_t cyclesCount, uint8_t *frame, uint8_t *frameEmphasis)
+{
+    ppu->frameCyclesCount = cyclesCount;
+    ppu->scanline = 0;
+    ppu->frame = frame;
+    ppu->frameEmphasis = frameEmphasis;
+}
+
+void
+ppu_catch_up(Ppu *ppu, uint64_t cyclesCount)
+{
+    while ((ppu->scanline <= PPU_SCANLINES_COUNT) && (scanline_cycles(ppu, ppu->scanline) <= cyclesCount)) {
+        if (ppu->scanline > 0) {
+            end_scanline(ppu, ppu->scanline - 1);
+        }
+        if (ppu->scanline < PPU_SCANLINES_COUNT) {
+            start_scanline(ppu, ppu->scanline);
+        }
+        ppu->scanline++;
+    }
+}
+
+void
+ppu_sync(Ppu *ppu)
+{
+    ppu_catch_up(ppu, ppu->cpu->cyclesCount);
+}
+
+bool
+ppu_is_frame_done(Ppu *ppu)
+{
+    bool result = (ppu->scanline > PPU_SCANLINES_COUNT);
+    return result;
+}
+
+// The scanline, from `scanline` on, whose start sets the sprite 0 hit or overflow flag if the
+// registers and OAM stay as they are, PPU_SCANLINES_COUNT if none does. The sprite 0 hit is
+// only known once the line is rendered, any line sprite 0 covers may have it.
+internal int32_t
+next_sprite_flag_scanline(Ppu *ppu, int32_t scanline)
+{
+    int32_t result = PPU_SCANLINES_COUNT;
+    if (!(ppu->mask & PPU_MASK_SPRITES) || (scanline >= PPU_DISPLAY_HEIGHT_PX)) {
+        return result;
+    }
+
+    uint8_t *oam = ppu->mmu->ppuOam;
+    int32_t height = (ppu->ctrl & PPU_CTRL_SPRITE_8X16) ? 16 : 8;
+    if (!(ppu->status & PPU_STATUS_SPRITE_0_HIT) && (ppu->mask & PPU_MASK_BACKGROUND)) {
+        // sprites show up a scanline below their Y
+        int32_t top = oam[0] + 1;
+        int32_t first = MAX(scanline, top);
+        if ((first < top + height) && (first < PPU_DISPLAY_HEIGHT_PX)) {
+            result = first;
+        }
+    }
+
+    if (!(ppu->status & PPU_STATUS_SPRITE_OVERFLOW)) {
+        int32_t end = MIN(result, PPU_DISPLAY_HEIGHT_PX);
+        uint8_t spritesCounts[PPU_DISPLAY_HEIGHT_PX] = {};
+        for (int32_t sprite = 0; sprite < PPU_OAM_SIZE / 4; sprite++) {
+            int32_t top = oam[sprite * 4] + 1;
+            for (int32_t line = MAX(top, scanline); line < MIN(top + height, end); line++) {
+                spritesCounts[line]++;
+            }
+        }
+        for (int32_t line = scanline; line < end; line++) {
+            if (spritesCounts[line] > PPU_SPRITES_PER_SCANLINE) {
+                result = line;
+                break;
+            }
+        }
+    }
+    return result;
+}
+
+uint64_t
+ppu_next_event(Ppu *ppu)
+{
+    ASSERT(!ppu_is_frame_done(ppu));
+
+    int32_t scanline = ppu->scanline;
+    int32_t result = PPU_SCANLINES_COUNT;
+    if (ppu->mmu->rom->mapperOps->scanline) {
+        // the mapper may raise an IRQ at the end of any of them
+        result = scanline;
+    }
+    else {
+        if (scanline <= PPU_VBLANK_SCANLINE) {
+            result = PPU_VBLANK_SCANLINE;
+        }
+        else if (scanline <= PPU_PRE_RENDER_SCANLINE) {
+            // clears the status flags
+            result = PPU_PRE_RENDER_SCANLINE;
+        }
+        result = MIN(result, next_sprite_flag_scanline(ppu, scanline));
+    }
+    return scanline_cycles(ppu, result);
+}
+
+void
+ppu_convert_line(Ppu *ppu, uint8_t *line, uint8_t emphasis, uint32_t *row)
+{
+    ASSERT(emphasis < PPU_EMPHASIS_COUNT);
+    ppu->kernels->convert(line, ppu->rgba[emphasis], row);
+}
+
+// $2007 accesses move `v` across (+1) or down (+32) the nametable.
+internal void
+increment_addr(Ppu *ppu)
+{
+    ppu->v = (uint16_t)((ppu->v + ((ppu->ctrl & PPU_CTRL_INCREMENT_32) ? 32 : 1)) & 0x7FFF);
+}
+
+uint8_t
+ppu_read_register(Ppu *ppu, uint16_t reg)
+{
+    ppu_sync(ppu);
+
+    uint8_t result = 0;
+    switch (reg) {
+        case 2: {
+            result = ppu->status;
+            ppu->status &= ~PPU_STATUS_VBLANK;
+            ppu->w = false;
+        } break;
+        case 4: {
+            result = ppu->mmu->ppuOam[ppu->oamAddr];
+        } break;
+        case 7: {
+            uint16_t addr = ppu->v & 0x3FFF;
+            if (addr < 0x3F00) {
+                result = ppu->readBuffer;
+                ppu->readBuffer = mmu_ppu_read(ppu->mmu, addr);
+            }
+            else {
+                // palette reads are immediate, the buffer gets the nametable byte underneath
+                result = mmu_ppu_read(ppu->mmu, addr);
+                ppu->readBuffer = mmu_ppu_read(ppu->mmu, addr - 0x1000);
+            }
+            increment_addr(ppu);
+        } break;
+        default: {
+            // write-only
+        } break;
+    }
+    return result;
+}
+
+void
+ppu_write_register(Ppu *ppu, uint16_t reg, uint8_t value)
+{
+    ppu_sync(ppu);
+
+    switch (reg) {
+        case 0: {
+            // enabling NMI during vblank raises one right away
+            if (!(ppu->ctrl & PPU_CTRL_NMI) && (value & PPU_CTRL_NMI) && (ppu->status & PPU_STATUS_VBLANK)) {
+                cpu_interrupt(ppu->cpu, NMI);
+            }
+            ppu->ctrl = value;
+            ppu->t = (uint16_t)((ppu->t & ~0x0C00) | ((value & PPU_CTRL_NAMETABLE) << 10));
+            // the sprite height may move the next sprite flag event
+            cpu_request_stop(ppu->cpu);
+        } break;
+        case 1: {
+            ppu->mask = value;
+            cpu_request_stop(ppu->cpu);
+        } break;
+        case 3: {
+            ppu->oamAddr = value;
+        } break;
+        case 4: {
+            ppu->mmu->ppuOam[ppu->oamAddr++] = value;
+            cpu_request_stop(ppu->cpu);
+        } break;
+        case 5: {
+            if (!ppu->w) {
+                ppu->t = (uint16_t)((ppu->t & ~0x001F) | (value >> 3));
+                ppu->fineX = value & 0x07;
+            }
+            else {
+                ppu->t = (uint16_t)((ppu->t & ~0x73E0) | ((value & 0x07) << 12) | ((value & 0xF8) << 2));
+            }
+            ppu->w = !ppu->w;
+        } break;
+        case 6: {
+            if (!ppu->w) {
+                ppu->t = (uint16_t)((ppu->t & 0x00FF) | ((value & 0x3F) << 8));
+            }
+            else {
+                ppu->t = (uint16_t)((ppu->t & 0xFF00) | value);
+                ppu->v = ppu->t;
+            }
+            ppu->w = !ppu->w;
+        } break;
+        case 7: {
+            mmu_ppu_write(ppu->mmu, ppu->v & 0x3FFF, value);
+            increment_addr(ppu);
+        } break;
+        default: {
+            // read-only
+        } break;
+    }
+}
@@ -1,12 +1,102 @@
 #ifndef PPU_H
 #define PPU_H
 
+#include <stdint.h>
+
 #include "mmu.h"
+#include "cpu.h"
+#include "compose.h"
+
+#define PPU_DISPLAY_WIDTH_PX 256
+#define PPU_DISPLAY_HEIGHT_PX 240
+#define PPU_VBLANK_SCANLINE 241
+#define PPU_PRE_RENDER_SCANLINE 261
+#define PPU_SCANLINES_COUNT 262
+// NTSC: 341 PPU dots * 262 scanlines / 3 PPU dots per CPU cycle, rounded up
+#define PPU_CPU_CYCLES_PER_FRAME 29781
+#define PPU_SPRITES_PER_SCANLINE 8
+
+// $2000 PPUCTRL
+#define PPU_CTRL_NAMETABLE 0x03
+#define PPU_CTRL_INCREMENT_32 0x04
+#define PPU_CTRL_SPRITE_TABLE 0x08
+#define PPU_CTRL_BACKGROUND_TABLE 0x10
+#define PPU_CTRL_SPRITE_8X16 0x20
+#define PPU_CTRL_NMI 0x80
+
+// $2001 PPUMASK
+#define PPU_MASK_GREYSCALE 0x01
+#define PPU_MASK_BACKGROUND_LEFT 0x02
+#define PPU_MASK_SPRITES_LEFT 0x04
+#define PPU_MASK_BACKGROUND 0x08
+#define PPU_MASK_SPRITES 0x10
+#define PPU_MASK_EMPHASIS 0xE0 // red, green, blue
+#define PPU_MASK_EMPHASIS_SHIFT 5
+#define PPU_EMPHASIS_COUNT 8
+
+// $2002 PPUSTATUS
+#define PPU_STATUS_SPRITE_OVERFLOW 0x20
+#define PPU_STATUS_SPRITE_0_HIT 0x40
+#define PPU_STATUS_VBLANK 0x80
 
+// Renders a whole scanline at a time, at its start, from whatever the registers hold then, so
+// scroll/PPUCTRL/PPUMASK changes made by the CPU during a scanline show up from the next one.
+// Scanline N starts at CPU cycle N * PPU_CPU_CYCLES_PER_FRAME / PPU_SCANLINES_COUNT of the
+// frame, but the PPU only catches up to the CPU when the CPU is about to touch something
+// rendering depends on (PPU registers, OAM DMA, mapper registers) or to see something the PPU
+// does: the vblank NMI, the sprite 0 hit and overflow flags, the mapper's scanline counter.
+// ppu_next_event tells how far the CPU may run before the latter.
+// VRAM addresses follow the usual `v`/`t` layout (yyy NN YYYYY XXXXX):
+//   - fine Y scroll (3 bits)
+//   - nametable select (2 bits)
+//   - coarse Y scroll (5 bits)
+//   - coarse X scroll (5 bits)
 typedef struct Ppu Ppu;
 struct Ppu
 {
     Mmu *mmu;
+    Cpu *cpu; // gets the vblank NMI
+
+    uint8_t ctrl;
+    uint8_t mask;
+    uint8_t status;
+    uint8_t oamAddr;
+
+    uint16_t v;    // current VRAM address
+    uint16_t t;    // temporary VRAM address, top left corner of the screen
+    uint8_t fineX; // fine X scroll
+    bool w;        // $2005/$2006 write toggle
+    uint8_t readBuffer; // $2007 reads below the palette are delayed by one
+
+    uint64_t frameCyclesCount; // CPU cycle the frame started at
+    int32_t scanline;          // next to start, PPU_SCANLINES_COUNT is the end of the frame
+    uint8_t *frame;            // colours of the visible scanlines, NULL when no one looks
+    uint8_t *frameEmphasis;    // emphasis bits of each visible scanline
+
+    const ComposeKernels *kernels; // picked for this CPU
+    // RGBA8888 value of the 64 colours under each combination of emphasis bits
+    uint32_t rgba[PPU_EMPHASIS_COUNT][COMPOSE_COLORS_COUNT];
 };
 
+void ppu_init(Ppu *ppu, Mmu *mmu, Cpu *cpu);
+// Starts a frame at CPU cycle `cyclesCount`. Visible scanlines are written to `frame` (256x240
+// colours, 0-63) and their PPUMASK emphasis bits (shifted down) to `frameEmphasis`, both may
+// be NULL when no one looks.
+void ppu_start_frame(Ppu *ppu, uint64_t cyclesCount, uint8_t *frame, uint8_t *frameEmphasis);
+// Runs every scanline start and end due by CPU cycle `cyclesCount`.
+void ppu_catch_up(Ppu *ppu, uint64_t cyclesCount);
+// Catches up to the CPU, before it changes something the PPU reads (e.g. mapper banks).
+void ppu_sync(Ppu *ppu);
+// CPU cycle of the next scanline start or end the CPU may notice (see above), the end of the
+// frame at the latest. The CPU is asked to stop when a change may have moved it earlier.
+uint64_t ppu_next_event(Ppu *ppu);
+bool ppu_is_frame_done(Ppu *ppu);
+// Maps a rendered `line` to 256 RGBA8888 pixels, `emphasis` being PPUMASK's bits 5-7 (shifted
+// down) while it was rendered.
+void ppu_convert_line(Ppu *ppu, uint8_t *line, uint8_t emphasis, uint32_t *row);
+bool ppu_is_rendering(Ppu *ppu);
+// $2000-$2007, `reg` is the address & 7
+uint8_t ppu_read_register(Ppu *ppu, uint16_t reg);
+void ppu_write_register(Ppu *ppu, uint16_t reg, uint8_t value);
+
 #endif //PPU_H
@@ -1,35 +1,110 @@
+#define _DEFAULT_SOURCE // ftruncate, pread
+
 #include <stdio.h>
 #include <string.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "rom.h"
+#include "crc32.h"
+#include "romdb.h"
+#include "archive.h"
 
-bool rom_load(Arena *arena, Rom *rom, Str8 path)
+// The file is mapped read-only and stays mapped for the lifetime of the process, PRG/CHR
+// point straight into the mapping so its pages are shared by every instance running the ROM.
+// Compressed ROMs (gzip, zip) are decompressed into the arena instead and the archive unmapped.
+bool
+rom_load(Arena *arena, Rom *rom, Str8 path)
 {
     ArenaBackup arenaBck = arena_backup(arena);
-    FILE *romFile = fopen(str8_to_cstr(arenaBck.arena, path), "rb");
+    int32_t romFd = open(str8_to_cstr(arenaBck.arena, path), O_RDONLY);
     arena_restore(&arenaBck);
-    if (!romFile) {
+    if (romFd < 0) {
         fprintf(stderr, "Failed to open file '%.*s': %s\n", STR8_VARG(path), strerror(errno));
-        fclose(romFile);
         return false;
     }
 
-    uint8_t *romData = arena_push_zero(arena, MAX_ROM_SIZE + 1);
-    int32_t romSize = (int32_t)fread(romData, sizeof(uint8_t), MAX_ROM_SIZE + 1, romFile);
-    if (ferror(romFile) != 0) {
+    struct stat romStat;
+    if (fstat(romFd, &romStat) != 0) {
         fprintf(stderr, "Failed to read ROM file '%.*s': %s\n", STR8_VARG(path), strerror(errno));
-        fclose(romFile);
+        close(romFd);
         return false;
     }
-    if (romSize > MAX_ROM_SIZE) {
+    if (romStat.st_size > INT32_MAX) {
         fprintf(stderr, "ROM file is too large '%.*s'\n", STR8_VARG(path));
-        fclose(romFile);
+        close(romFd);
+        return false;
+    }
+    if (romStat.st_size <= INES_HEADER_SIZE) {
+        fprintf(stderr, "Invalid ROM file '%.*s'\n", STR8_VARG(path));
+        close(romFd);
+        return false;
+    }
+
+    int32_t romSize = (int32_t)romStat.st_size;
+    uint8_t *romData = mmap(NULL, romSize, PROT_READ, MAP_PRIVATE, romFd, 0);
+    close(romFd);
+    if (romData == MAP_FAILED) {
+        fprintf(stderr, "Failed to map ROM file '%.*s': %s\n", STR8_VARG(path), strerror(errno));
         return false;
     }
-    fclose(romFile);
 
-    if (romSize <= INES_HEADER_SIZE) {
+    if (archive_detect(romData, romSize) != ARCHIVE_NONE) {
+        uint8_t *image = NULL;
+        int32_t imageSize = 0;
+        bool result = archive_extract_rom(arena, romData, romSize, path, &image, &imageSize) &&
+                      rom_load_image(arena, rom, image, imageSize, path);
+        munmap(romData, romSize);
+        return result;
+    }
+
+    bool result = rom_load_image(arena, rom, romData, romSize, path);
+    if (!result) {
+        munmap(romData, romSize);
+    }
+    return result;
+}
+
+// NES 2.0 sizes are either a count of `unitSize` units (12 bits: MSB nibble, LSB byte) or,
+// with the MSB nibble set to $F, 2^E * (MM * 2 + 1) where LSB = EEEEEEMM.
+internal int64_t
+nes20_rom_size(uint8_t msb, uint8_t lsb, int32_t unitSize)
+{
+    int64_t result = 0;
+    if (msb == 0x0F) {
+        int32_t exponent = lsb >> 2;
+        int32_t multiplier = (lsb & 0x03) * 2 + 1;
+        // clamped, anything that large can't be in the image anyway
+        result = ((int64_t)1 << MIN(exponent, 40)) * multiplier;
+    }
+    else {
+        result = ((int64_t)msb << 8 | lsb) * unitSize;
+    }
+    return result;
+}
+
+internal int32_t
+nes20_ram_size(uint8_t shift)
+{
+    int32_t result = shift ? (64 << shift) : 0;
+    return result;
+}
+
+internal void
+load_trainer(Rom *rom)
+{
+    if (rom->trainer) {
+        memcpy(rom->prgRam + (0x7000 - 0x6000), rom->trainer, ROM_TRAINER_SIZE);
+    }
+}
+
+bool
+rom_load_image(Arena *arena, Rom *rom, uint8_t *image, int32_t imageSize, Str8 path)
+{
+    if (imageSize <= INES_HEADER_SIZE) {
         fprintf(stderr, "Invalid ROM file '%.*s'\n", STR8_VARG(path));
         return false;
     }
@@ -47,7 +122,7 @@ bool rom_load(Arena *arena, Rom *rom, Str8 path)
     //        |        |    number of 8KB CHR ROM units
     //        |        number of 16KB PRG ROM units
     //        constant "NES^Z"
-    uint8_t *header = romData;
+    uint8_t *header = image;
 
     if (header[0] != 'N' || header[1] != 'E' || header[2] != 'S' || header[3] != 0x1A) {
         fprintf(stderr, "Not an iNES ROM file '%.*s'\n", STR8_VARG(path));
@@ -67,70 +142,231 @@ bool rom_load(Arena *arena, Rom *rom, Str8 path)
     uint8_t ctrl1 = header[6];
 
     // CONTROL BYTE 2:
-    // +---+   +---+---+   +---+
-    // | 7 |...| 4 | 3 |...| 0 |
-    // +---+   +---+---+   +---+
-    //  \_________/ \_________/
-    //       |           |
-    //       |           all zeros for iNES 1.0
-    //       high byte of ROM mapper type
+    // +---+   +---+---+---+---+---+
+    // | 7 |...| 4 | 3 | 2 | 1 | 0 |
+    // +---+   +---+---+---+---+---+
+    //  \_________/ \_____/ \_____/
+    //       |         |        |
+    //       |         |        console type (0 for NES/Famicom)
+    //       |         header version, 2 for NES 2.0 and 0 for iNES 1.0
+    //       high nibble of ROM mapper type
     uint8_t ctrl2 = header[7];
 
-    if (ctrl2 & 0x0F) {
-        fprintf(stderr, "Unsupported iNES version\n");
-        return false;
+    rom->isNes20 = ((ctrl2 & 0x0C) == 0x08);
+    rom->mapper = (ctrl2 & 0xF0) | (ctrl1 >> 4);
+    rom->submapper = 0;
+    rom->region = REGION_NTSC;
+    rom->hasBattery = (ctrl1 & 0x02);
+    rom->mirror = (ctrl1 & 0x08) ? FOUR_SCREEN : ((ctrl1 & 0x1) ? VERTICAL : HORIZONTAL);
+
+    int32_t trainerSize = (ctrl1 & 0x04) ? ROM_TRAINER_SIZE : 0;
+    int64_t prgSize = header[4] * KB(16);
+    int64_t chrSize = header[5] * KB(8);
+    int32_t prgRamSize = 0;
+    int32_t chrRamSize = 0;
+
+    if (rom->isNes20) {
+        // NES 2.0 BYTES 8-12:
+        // +------+------+------+------+------+
+        // |  08  |  09  |  0A  |  0B  |  0C  |
+        // +------+------+------+------+------+
+        //  \_hi_/ \_hi_/ \_hi_/ \_hi_/    |
+        //  \_lo_/ \_lo_/ \_lo_/ \_lo_/    timing: NTSC, PAL, multi-region, Dendy (bits 0-1)
+        //    |      |      |      |
+        //    |      |      |      CHR NVRAM (hi) and CHR RAM (lo) shift counts
+        //    |      |      PRG NVRAM (hi) and PRG RAM (lo) shift counts, 64 << shift bytes
+        //    |      CHR ROM (hi) and PRG ROM (lo) size MSB nibbles
+        //    submapper (hi) and mapper bits 8-11 (lo)
+        if (ctrl2 & 0x03) {
+            fprintf(stderr, "Unsupported console type: %d\n", ctrl2 & 0x03);
+            return false;
+        }
+        rom->mapper |= (header[8] & 0x0F) << 8;
+        rom->submapper = header[8] >> 4;
+        prgSize = nes20_rom_size(header[9] & 0x0F, header[4], KB(16));
+        chrSize = nes20_rom_size(header[9] >> 4, header[5], KB(8));
+        rom->prgNvramSize = nes20_ram_size(header[10] >> 4);
+        prgRamSize = nes20_ram_size(header[10] & 0x0F) + rom->prgNvramSize;
+        chrRamSize = nes20_ram_size(header[11] & 0x0F) + nes20_ram_size(header[11] >> 4);
+        rom->region = header[12] & 0x03;
+    }
+    else {
+        // "DiskDude!" and similar junk in bytes 7-15 of old dumps, byte 7 can't be trusted
+        if (header[12] || header[13] || header[14] || header[15]) {
+            rom->mapper = ctrl1 >> 4;
+        }
+        else if (ctrl2 & 0x0F) {
+            fprintf(stderr, "Unsupported iNES version\n");
+            return false;
+        }
+        // iNES 1.0 doesn't reliably tell the PRG RAM size, the boards we support have at most 8KB
+        prgRamSize = ROM_PRG_RAM_SIZE;
+        chrRamSize = ROM_CHR_RAM_SIZE;
     }
 
-    rom->mapper = (uint8_t) (ctrl2 & 0xF0) | (ctrl1 >> 4);
-    if (rom->mapper != NROM) {
-        fprintf(stderr, "Unsupported mapper: %d\n", rom->mapper);
+    // banks are switched in 8KB (PRG) and 1KB (CHR) units
+    if ((prgSize == 0) || (prgSize % ROM_PRG_WINDOW_SIZE) || (chrSize % ROM_CHR_WINDOW_SIZE) ||
+        (imageSize < (INES_HEADER_SIZE + trainerSize + prgSize + chrSize))) {
+        fprintf(stderr, "Invalid ROM file '%.*s'\n", STR8_VARG(path));
         return false;
     }
+    rom->prgSize = (int32_t)prgSize;
+    rom->chrSize = (int32_t)chrSize;
 
-    rom->mirror = (ctrl1 & 0x08) ? FOUR_SCREEN : ((ctrl1 & 0x1) ? VERTICAL : HORIZONTAL);
+    rom->trainer = trainerSize ? (header + INES_HEADER_SIZE) : NULL;
+    rom->prg = header + INES_HEADER_SIZE + trainerSize;
+    rom->chr = header + INES_HEADER_SIZE + trainerSize + rom->prgSize;
+    rom->crc = crc32_update(0, rom->prg, rom->prgSize + rom->chrSize);
 
-    int32_t trainerSize = (ctrl1 & 0x04) ? 512 : 0;
+    // iNES 1.0 headers of old dumps are often wrong, known dumps get theirs from the database
+    const RomDbEntry *dbEntry = romdb_find(rom->crc);
+    if (!rom->isNes20 && dbEntry) {
+        rom->mapper = dbEntry->mapper;
+        rom->submapper = dbEntry->submapper;
+        rom->hasBattery = (dbEntry->flags & ROMDB_BATTERY);
+        rom->mirror = (dbEntry->flags & ROMDB_FOUR_SCREEN) ? FOUR_SCREEN :
+                      ((dbEntry->flags & ROMDB_VERTICAL) ? VERTICAL : HORIZONTAL);
+    }
+    if (!rom->isNes20) {
+        rom->prgNvramSize = rom->hasBattery ? ROM_PRG_RAM_SIZE : 0;
+    }
 
-    rom->prgSize = header[4] * KB(16);
-    rom->chrSize = header[5] * KB(8);
-    if (romSize < (INES_HEADER_SIZE + trainerSize + rom->prgSize + rom->chrSize)) {
-        fprintf(stderr, "Invalid ROM file '%.*s'\n", STR8_VARG(path));
+    rom->mapperOps = mapper_get_ops(rom->mapper);
+    if (!rom->mapperOps) {
+        fprintf(stderr, "Unsupported mapper: %d\n", rom->mapper);
         return false;
     }
+    rom->isChrRam = (rom->chrSize == 0);
+    if (rom->isChrRam) {
+        rom->chrSize = (chrRamSize >= ROM_CHR_WINDOW_SIZE) ? chrRamSize : ROM_CHR_RAM_SIZE;
+        rom->chr = arena_push_zero(arena, rom->chrSize);
+    }
 
-    rom->prg = header + INES_HEADER_SIZE + trainerSize;
-    rom->chr = header + INES_HEADER_SIZE + trainerSize + rom->prgSize;
+    // 4 pixels per CHR byte, in both directions
+    if (rom->chrSize > (arena->cap - arena->pos) / 8) {
+        fprintf(stderr, "CHR of '%.*s' is too large\n", STR8_VARG(path));
+        return false;
+    }
+    rom->chrTiles = arena_push(arena, rom->chrSize * 4);
+    rom->chrTilesFlipped = arena_push(arena, rom->chrSize * 4);
+    for (int32_t offset = 0; offset < rom->chrSize; offset += 16) {
+        for (int32_t row = 0; row < 8; row++) {
+            rom_decode_chr_row(rom, offset + row);
+        }
+    }
+
+    // the trainer is loaded at $7000
+    if (trainerSize) {
+        prgRamSize = MAX(prgRamSize, ROM_PRG_RAM_SIZE);
+    }
+    rom->prgRamSize = prgRamSize;
+    rom->prgRam = prgRamSize ? arena_push_zero(arena, prgRamSize) : NULL;
+    load_trainer(rom);
+
+    rom->mapperState = (MapperState){};
+    memset(rom->prgWindowVersions, 0, sizeof(rom->prgWindowVersions));
+    rom->mapperOps->reset(rom);
 
     return true;
 }
 
-uint8_t
-rom_read(Rom *rom, uint16_t addr)
+// Shared saves are created (or grown) to the PRG RAM size and mapped over it, so game writes
+// persist without any copying. Private saves map an existing file copy-on-write, which keeps
+// its pages shared between instances until they write, and never touch the disk. The trainer
+// goes over the save either way (so a shared save file gets it written into it).
+bool
+rom_map_save(Arena *arena, Rom *rom, Str8 path, RomSaveMode mode)
 {
-    uint8_t result = 0;
-    switch (rom->mapper) {
-        case NROM: {
-            if (0x6000 <= addr && addr <= 0x7FFF) {
-                // RAM
-            }
-            else if (0x8000 <= addr && addr <= 0xBFFF) {
-                // ROM 1
-                result = rom->prg[addr - 0x8000];
+    ASSERT(rom->prgRam);
+
+    bool isShared = (mode == ROM_SAVE_SHARED);
+    ArenaBackup arenaBck = arena_backup(arena);
+    int32_t saveFd = open(str8_to_cstr(arenaBck.arena, path), isShared ? (O_RDWR | O_CREAT) : O_RDONLY, 0644);
+    arena_restore(&arenaBck);
+    if (saveFd < 0) {
+        if (!isShared && (errno == ENOENT)) {
+            // no save yet, PRG RAM starts zeroed
+            return true;
+        }
+        fprintf(stderr, "Failed to open file '%.*s': %s\n", STR8_VARG(path), strerror(errno));
+        return false;
+    }
+
+    struct stat saveStat;
+    if (fstat(saveFd, &saveStat) != 0) {
+        fprintf(stderr, "Failed to read save file '%.*s': %s\n", STR8_VARG(path), strerror(errno));
+        close(saveFd);
+        return false;
+    }
+
+    bool result = true;
+    if (saveStat.st_size < rom->prgRamSize) {
+        if (isShared) {
+            // a new (or truncated) save, the missing bytes read as zeros
+            result = (ftruncate(saveFd, rom->prgRamSize) == 0);
+        }
+        else {
+            // a private mapping can't reach past the end of the file, read what there is instead
+            result = (pread(saveFd, rom->prgRam, saveStat.st_size, 0) == saveStat.st_size);
+            close(saveFd);
+            if (result) {
+                load_trainer(rom);
             }
             else {
-                // ROM 2
-                result = rom->prg[addr - 0xC000];
+                fprintf(stderr, "Failed to read save file '%.*s': %s\n", STR8_VARG(path), strerror(errno));
             }
-        } break;
-        default: {
-            UNREACHABLE();
+            return result;
         }
     }
+
+    uint8_t *save = MAP_FAILED;
+    if (result) {
+        save = mmap(NULL, rom->prgRamSize, PROT_READ | PROT_WRITE, isShared ? MAP_SHARED : MAP_PRIVATE, saveFd, 0);
+        result = (save != MAP_FAILED);
+    }
+    if (!result) {
+        fprintf(stderr, "Failed to map save file '%.*s': %s\n", STR8_VARG(path), strerror(errno));
+    }
+    close(saveFd);
+
+    if (result) {
+        rom->prgRam = save;
+        rom->isSaveShared = isShared;
+        load_trainer(rom);
+    }
     return result;
 }
 
 void
-rom_write(Rom *rom, uint16_t addr, uint8_t value)
+rom_sync_save(Rom *rom, bool isBlocking)
+{
+    if (rom->isSaveShared && (msync(rom->prgRam, rom->prgRamSize, isBlocking ? MS_SYNC : MS_ASYNC) != 0)) {
+        fprintf(stderr, "Failed to sync save file: %s\n", strerror(errno));
+    }
+}
+
+uint8_t
+rom_read(Rom *rom, uint16_t addr)
 {
+    uint8_t result = 0;
+    if (addr >= 0x8000) {
+        result = rom->prgWindows[(addr - 0x8000) / ROM_PRG_WINDOW_SIZE][addr % ROM_PRG_WINDOW_SIZE];
+    }
+    else if ((addr >= 0x6000) && rom->prgRam) {
+        result = rom->prgRam[(addr - 0x6000) % rom->prgRamSize];
+    }
+    return result;
+}
 
+void
+rom_write(Rom *rom, uint16_t addr, uint8_t value)
+{
+    if (addr >= 0x8000) {
+        if (rom->mapperOps->write) {
+            rom->mapperOps->write(rom, addr, value);
+        }
+    }
+    else if ((addr >= 0x6000) && rom->prgRam) {
+        rom->prgRam[(addr - 0x6000) % rom->prgRamSize] = value;
+    }
 }
@@ -6,14 +6,35 @@
 #include "utils.h"
 #include "arena.h"
 #include "str8.h"
+#include "mapper.h"
 
-#define MAX_ROM_SIZE MB(1)
 #define INES_HEADER_SIZE 16
 
-typedef int32_t Mapper;
-enum Mapper
+// $8000-$FFFF split into the smallest PRG bank size any mapper switches
+#define ROM_PRG_WINDOW_SIZE KB(8)
+#define ROM_PRG_WINDOWS_COUNT 4
+// $0000-$1FFF of the PPU split the same way
+#define ROM_CHR_WINDOW_SIZE KB(1)
+#define ROM_CHR_WINDOWS_COUNT 8
+
+#define ROM_PRG_RAM_SIZE KB(8)
+#define ROM_CHR_RAM_SIZE KB(8)
+#define ROM_TRAINER_SIZE 512
+
+typedef int32_t Region;
+enum Region
+{
+    REGION_NTSC,
+    REGION_PAL,
+    REGION_MULTI,
+    REGION_DENDY,
+};
+
+typedef int32_t RomSaveMode;
+enum RomSaveMode
 {
-    NROM = 0,
+    ROM_SAVE_PRIVATE, // copy-on-write mapping of an existing save, the disk is never written
+    ROM_SAVE_SHARED,  // PRG RAM writes land in the save file
 };
 
 typedef int32_t Mirror;
@@ -22,6 +43,8 @@ enum Mirror
     HORIZONTAL,
     VERTICAL,
     FOUR_SCREEN,
+    SINGLE_SCREEN_LOW,
+    SINGLE_SCREEN_HIGH,
 };
 
 typedef struct Rom Rom;
@@ -32,13 +55,100 @@ struct Rom
 
     uint8_t *chr;
     int32_t chrSize;
+    bool isChrRam; // no CHR ROM in the image, `chr` is writable RAM
+    // `chr` decoded to one pixel (0-3) per byte, 64 per tile in the same order as the tiles,
+    // left to right and mirrored (for horizontally flipped sprites). Kept in sync by CHR RAM writes.
+    uint8_t *chrTiles;
+    uint8_t *chrTilesFlipped;
 
+    uint8_t *trainer; // 512 bytes loaded at $7000, NULL if the image has none
+    uint8_t *prgRam; // $6000-$7FFF, mirrored when smaller, NULL if the board has none
+    int32_t prgRamSize;
+    int32_t prgNvramSize; // battery-backed part of `prgRamSize`, the save file holds all of it
+    bool hasBattery;
+    bool isSaveShared; // `prgRam` is a shared mapping of the save file
+
+    uint32_t crc; // CRC-32 of the PRG and CHR ROM data, identifies the dump
+    bool isNes20;
     Mirror mirror;
     Mapper mapper;
+    int32_t submapper;
+    Region region;
+    const MapperOps *mapperOps;
+    MapperState mapperState;
+
+    // PRG bank mapped into each 8KB window of $8000-$FFFF
+    uint8_t *prgWindows[ROM_PRG_WINDOWS_COUNT];
+    // CHR bank mapped into each 1KB window of $0000-$1FFF
+    uint8_t *chrWindows[ROM_CHR_WINDOWS_COUNT];
+
+    // Bumped whenever a different bank gets mapped into the window, so that
+    // code decoded from the previous bank can be detected as stale.
+    uint32_t prgWindowVersions[ROM_PRG_WINDOWS_COUNT];
 };
 
 bool rom_load(Arena *arena, Rom *rom, Str8 path);
+// Parses an iNES image already in memory, `rom` keeps pointing into `image` which is never
+// written (it may be a read-only mapping).
+bool rom_load_image(Arena *arena, Rom *rom, uint8_t *image, int32_t imageSize, Str8 path);
+// Backs PRG RAM with the save file at `path`, must be called before the MMU maps it.
+bool rom_map_save(Arena *arena, Rom *rom, Str8 path, RomSaveMode mode);
+// Writes dirty save pages back, waiting for the disk only if `isBlocking`.
+void rom_sync_save(Rom *rom, bool isBlocking);
 uint8_t rom_read(Rom *rom, uint16_t addr);
 void rom_write(Rom *rom, uint16_t addr, uint8_t value);
 
+internal FORCE_INLINE uint8_t
+rom_read_chr(Rom *rom, uint16_t addr)
+{
+    uint8_t result = rom->chrWindows[addr / ROM_CHR_WINDOW_SIZE][addr % ROM_CHR_WINDOW_SIZE];
+    return result;
+}
+
+// Offset in `chr` of what is mapped at `addr`.
+internal FORCE_INLINE int32_t
+rom_chr_offset(Rom *rom, uint16_t addr)
+{
+    int32_t result = (int32_t)(rom->chrWindows[addr / ROM_CHR_WINDOW_SIZE] - rom->chr) + addr % ROM_CHR_WINDOW_SIZE;
+    return result;
+}
+
+// Re-decodes the pixel row whose planes hold the `chr` byte at `offset`. A tile is 16 bytes,
+// the low bit planes of its 8 rows, then the high ones.
+internal FORCE_INLINE void
+rom_decode_chr_row(Rom *rom, int32_t offset)
+{
+    int32_t tileOffset = offset & ~0x0F;
+    int32_t row = offset & 0x07;
+    uint8_t lo = rom->chr[tileOffset + row];
+    uint8_t hi = rom->chr[tileOffset + row + 8];
+    uint8_t *pixels = rom->chrTiles + tileOffset * 4 + row * 8;
+    uint8_t *flippedPixels = rom->chrTilesFlipped + tileOffset * 4 + row * 8;
+    for (int32_t i = 0; i < 8; i++) {
+        uint8_t pixel = (uint8_t)(((lo >> (7 - i)) & 1) | (((hi >> (7 - i)) & 1) << 1));
+        pixels[i] = pixel;
+        flippedPixels[7 - i] = pixel;
+    }
+}
+
+// The 8 decoded pixels of the tile row at pattern address `addr`.
+internal FORCE_INLINE uint8_t *
+rom_chr_tile_row(Rom *rom, uint16_t addr, bool isFlipped)
+{
+    int32_t offset = rom_chr_offset(rom, addr);
+    uint8_t *tiles = isFlipped ? rom->chrTilesFlipped : rom->chrTiles;
+    uint8_t *result = tiles + (offset & ~0x0F) * 4 + (offset & 0x07) * 8;
+    return result;
+}
+
+internal FORCE_INLINE void
+rom_write_chr(Rom *rom, uint16_t addr, uint8_t value)
+{
+    if (rom->isChrRam) {
+        int32_t offset = rom_chr_offset(rom, addr);
+        rom->chr[offset] = value;
+        rom_decode_chr_row(rom, offset);
+    }
+}
+
 #endif //ROM_H
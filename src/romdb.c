@@ -0,0 +1,32 @@
+#include <stddef.h>
+
+#include "romdb.h"
+
+// Sorted by CRC for the binary search. Empty until there are known-bad dumps to fix: an entry
+// holds the header of the same dump checked against a verified source, which `romdb ROM`
+// prints once the ROM's header has been corrected, e.g.
+//     {0x3337EC46, 0, 0, ROMDB_VERTICAL}, // Super Mario Bros. (World)
+global const RomDbEntry romDbEntries[] = {
+};
+
+const RomDbEntry *
+romdb_find(uint32_t crc)
+{
+    const RomDbEntry *result = NULL;
+    int32_t lo = 0;
+    int32_t hi = (int32_t)ARRAY_CAP(romDbEntries) - 1;
+    while (lo <= hi) {
+        int32_t mid = lo + (hi - lo) / 2;
+        if (romDbEntries[mid].crc < crc) {
+            lo = mid + 1;
+        }
+        else if (romDbEntries[mid].crc > crc) {
+            hi = mid - 1;
+        }
+        else {
+            result = &romDbEntries[mid];
+            break;
+        }
+    }
+    return result;
+}
@@ -0,0 +1,29 @@
+#ifndef ROMDB_H
+#define ROMDB_H
+
+#include <stdint.h>
+
+#include "utils.h"
+
+typedef int32_t RomDbFlags;
+enum RomDbFlags
+{
+    ROMDB_VERTICAL = (1 << 0),    // vertical mirroring (horizontal if not set)
+    ROMDB_FOUR_SCREEN = (1 << 1),
+    ROMDB_BATTERY = (1 << 2),
+};
+
+// Known-good header fields of a dump, keyed by the CRC-32 of its PRG+CHR data.
+typedef struct RomDbEntry RomDbEntry;
+struct RomDbEntry
+{
+    uint32_t crc;
+    uint16_t mapper;
+    uint8_t submapper;
+    uint8_t flags;
+};
+
+// NULL if the dump isn't in the database.
+const RomDbEntry *romdb_find(uint32_t crc);
+
+#endif //ROMDB_H
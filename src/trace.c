@@ -0,0 +1,136 @@
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include "trace.h"
+
+void
+trace_init(Arena *arena, Trace *trace, int32_t fd, TraceFormat format)
+{
+    trace->fd = fd;
+    trace->format = format;
+    trace->buf = arena_push(arena, TRACE_BUF_CAP);
+    trace->bufLength = 0;
+    trace->isSynced = false;
+
+    if (format == TRACE_BINARY) {
+        memcpy(trace->buf, TRACE_BINARY_MAGIC, TRACE_BINARY_MAGIC_SIZE);
+        trace->bufLength = TRACE_BINARY_MAGIC_SIZE;
+    }
+}
+
+internal void
+trace_cpu_binary(Trace *trace, Cpu *cpu)
+{
+    CpuTraceState state;
+    cpu_capture_trace_state(cpu, &state);
+
+    int32_t pcDelta = (int16_t)(state.pc - trace->pc);
+    uint64_t cyclesDelta = state.cyclesCount - trace->cyclesCount;
+    if (!trace->isSynced || (pcDelta < INT8_MIN) || (pcDelta > INT8_MAX) || (cyclesDelta >= TRACE_RECORD_SYNC)) {
+        uint8_t *record = trace->buf + trace->bufLength;
+        record[0] = TRACE_RECORD_SYNC;
+        record[1] = 0;
+        record[2] = (uint8_t)(state.pc & 0xFF);
+        record[3] = (uint8_t)(state.pc >> 8);
+        for (int32_t i = 0; i < 8; i++) {
+            record[4 + i] = (uint8_t)(state.cyclesCount >> (8 * i));
+        }
+        trace->bufLength += TRACE_RECORD_SIZE;
+
+        trace->isSynced = true;
+        pcDelta = 0;
+        cyclesDelta = 0;
+    }
+
+    uint8_t *record = trace->buf + trace->bufLength;
+    record[0] = (uint8_t)cyclesDelta;
+    record[1] = (uint8_t)pcDelta;
+    record[2] = state.opcode;
+    record[3] = state.operand[0];
+    record[4] = state.operand[1];
+    record[5] = state.a;
+    record[6] = state.x;
+    record[7] = state.y;
+    record[8] = state.p;
+    record[9] = state.sp;
+    record[10] = (uint8_t)(state.effectiveAddr & 0xFF);
+    record[11] = (uint8_t)(state.effectiveAddr >> 8);
+    trace->bufLength += TRACE_RECORD_SIZE;
+
+    trace->pc = state.pc;
+    trace->cyclesCount = state.cyclesCount;
+}
+
+void
+trace_cpu(Trace *trace, Cpu *cpu)
+{
+    // room for the longest line or a sync + instruction record
+    if (trace->bufLength + MAX(CPU_TRACE_LINE_CAP + 1, 2 * TRACE_RECORD_SIZE) > TRACE_BUF_CAP) {
+        trace_flush(trace);
+    }
+
+    switch (trace->format) {
+        case TRACE_TEXT: {
+            trace->bufLength += cpu_format_trace_line(cpu, trace->buf + trace->bufLength);
+            trace->buf[trace->bufLength++] = '\n';
+        } break;
+        case TRACE_BINARY: {
+            trace_cpu_binary(trace, cpu);
+        } break;
+        default: {
+            UNREACHABLE();
+        }
+    }
+}
+
+bool
+trace_flush(Trace *trace)
+{
+    int32_t writtenLength = 0;
+    while (writtenLength < trace->bufLength) {
+        ssize_t length = write(trace->fd, trace->buf + writtenLength, trace->bufLength - writtenLength);
+        if (length < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            fprintf(stderr, "Failed to write trace: %s\n", strerror(errno));
+            trace->bufLength = 0;
+            return false;
+        }
+        writtenLength += (int32_t)length;
+    }
+    trace->bufLength = 0;
+    return true;
+}
+
+bool
+trace_decode_record(TraceDecoder *decoder, uint8_t *record, CpuTraceState *state)
+{
+    if (record[0] == TRACE_RECORD_SYNC) {
+        decoder->isSynced = true;
+        decoder->pc = (uint16_t)((record[3] << 8) | record[2]);
+        decoder->cyclesCount = 0;
+        for (int32_t i = 0; i < 8; i++) {
+            decoder->cyclesCount |= (uint64_t)record[4 + i] << (8 * i);
+        }
+        return false;
+    }
+
+    decoder->pc = (uint16_t)(decoder->pc + (int8_t)record[1]);
+    decoder->cyclesCount += record[0];
+
+    state->pc = decoder->pc;
+    state->opcode = record[2];
+    state->operand[0] = record[3];
+    state->operand[1] = record[4];
+    state->a = record[5];
+    state->x = record[6];
+    state->y = record[7];
+    state->p = record[8];
+    state->sp = record[9];
+    state->effectiveAddr = (uint16_t)((record[11] << 8) | record[10]);
+    state->cyclesCount = decoder->cyclesCount;
+    return true;
+}
@@ -0,0 +1,64 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+
+#include "utils.h"
+#include "arena.h"
+#include "cpu.h"
+
+#define TRACE_BUF_CAP MB(1)
+
+// Binary traces start with the magic followed by fixed-size records:
+//   +-----+-----+----+----+----+---+---+---+---+----+----+----+
+//   |  0  |  1  |  2 |  3 |  4 | 5 | 6 | 7 | 8 |  9 | 10 | 11 |
+//   +-----+-----+----+----+----+---+---+---+---+----+----+----+
+//   | CYC | PC  | OP | LO | HI | A | X | Y | P | SP | EA      |
+//   +-----+-----+----+----+----+---+---+---+---+----+---------+
+// CYC is the cycles since the previous record and PC the signed distance from its pc. When
+// either doesn't fit (and for the first record) a sync record with CYC = TRACE_RECORD_SYNC
+// comes first, carrying the absolute pc (bytes 2-3) and cycles count (bytes 4-11).
+#define TRACE_BINARY_MAGIC "NESTRC01"
+#define TRACE_BINARY_MAGIC_SIZE 8
+#define TRACE_RECORD_SIZE 12
+#define TRACE_RECORD_SYNC 0xFF
+
+typedef int32_t TraceFormat;
+enum TraceFormat
+{
+    TRACE_TEXT,
+    TRACE_BINARY,
+};
+
+// Buffered instruction trace, written out with a single `write` whenever the buffer fills up
+// (and on `trace_flush`).
+typedef struct Trace Trace;
+struct Trace
+{
+    int32_t fd;
+    TraceFormat format;
+    uint8_t *buf;
+    int32_t bufLength;
+
+    // previous binary record, deltas are relative to it
+    bool isSynced;
+    uint16_t pc;
+    uint64_t cyclesCount;
+};
+
+// Expands binary records back into trace states.
+typedef struct TraceDecoder TraceDecoder;
+struct TraceDecoder
+{
+    bool isSynced;
+    uint16_t pc;
+    uint64_t cyclesCount;
+};
+
+void trace_init(Arena *arena, Trace *trace, int32_t fd, TraceFormat format);
+void trace_cpu(Trace *trace, Cpu *cpu);
+bool trace_flush(Trace *trace);
+// Returns true when `record` is an instruction (sync records only update the decoder).
+bool trace_decode_record(TraceDecoder *decoder, uint8_t *record, CpuTraceState *state);
+
+#endif //TRACE_H
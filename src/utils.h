@@ -6,6 +6,8 @@
 #define global static
 #define internal static
 
+#define FORCE_INLINE inline __attribute__((always_inline))
+
 #if BUILD_DEBUG
 #define ASSERT(cond)          \
     do {                      \
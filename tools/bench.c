@@ -0,0 +1,68 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h> // strcmp
+
+#include "utils.h"
+#include "arena.h"
+#include "str8.h"
+#include "nes.h"
+#include "tool_utils.h"
+
+#define DEFAULT_FRAMES_COUNT 600
+
+#if CPU_SWITCH_DISPATCH
+#define DISPATCH_NAME "switch"
+#else
+#define DISPATCH_NAME "table"
+#endif
+
+int32_t
+main(int32_t argc, char *argv[])
+{
+    bool isJit = (argc > 1) && (strcmp(argv[1], "--jit") == 0);
+    int32_t argsOffset = isJit ? 1 : 0;
+    if (argc - argsOffset < 2) {
+        fprintf(stderr, "Usage: %s [--jit] ROM [FRAMES]\n", argv[0]);
+        exit(1);
+    }
+    Str8 romPath = str8_from_cstr(argv[1 + argsOffset]);
+    int32_t framesCount = (argc - argsOffset > 2) ? atoi(argv[2 + argsOffset]) : DEFAULT_FRAMES_COUNT;
+
+    int32_t arenaBufCap = MB(64);
+    uint8_t *arenaBuf = (uint8_t *)malloc(arenaBufCap);
+    Arena permArena = arena_make(arenaBuf, arenaBufCap);
+
+    Nes nes = {};
+    if (!nes_init(&permArena, &nes, romPath)) {
+        fprintf(stderr, "Failed to initialize NES\n");
+        exit(1);
+    }
+    if (isJit && !cpu_set_jit(&nes.cpu, true)) {
+        fprintf(stderr, "JIT is not available\n");
+        exit(1);
+    }
+
+    uint64_t startNs = time_ns();
+    for (int32_t i = 0; i < framesCount && !nes.cpu.isJammed; i++) {
+        nes_run_frame(&nes, false);
+    }
+    uint64_t durationNs = MAX(time_ns() - startNs, 1);
+
+    double seconds = (double)durationNs / 1e9;
+    printf("dispatch: %-6s  instructions: %10lu  cycles: %11lu  idle: %11lu  time: %8.3f ms  %8.2f Minstr/s\n",
+           isJit ? "jit" : DISPATCH_NAME,
+           nes.cpu.instructionsCount,
+           nes.cpu.cyclesCount,
+           nes.cpu.idleCyclesCount,
+           seconds * 1e3,
+           (double)nes.cpu.instructionsCount / seconds / 1e6);
+
+#if CPU_PROFILE
+    nes_write_profile(&permArena, &nes, STR8_LITERAL("cpu_profile.csv"));
+#endif
+
+    free(arenaBuf);
+
+    return 0;
+}
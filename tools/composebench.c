@@ -0,0 +1,120 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "utils.h"
+#include "compose.h"
+#include "tool_utils.h"
+
+#define DEFAULT_LINES_COUNT 2000000
+#define LINES_COUNT 64 // distinct random scanlines, cycled through
+
+global uint8_t backgrounds[LINES_COUNT][COMPOSE_LINE_WIDTH_PX];
+global uint8_t sprites[LINES_COUNT][COMPOSE_LINE_WIDTH_PX];
+global uint8_t expectedLines[LINES_COUNT][COMPOSE_LINE_WIDTH_PX];
+global uint8_t lines[LINES_COUNT][COMPOSE_LINE_WIDTH_PX];
+global uint32_t expectedRows[LINES_COUNT][COMPOSE_LINE_WIDTH_PX];
+global uint32_t rows[LINES_COUNT][COMPOSE_LINE_WIDTH_PX];
+
+internal uint32_t
+next_random(uint32_t *seed)
+{
+    *seed = *seed * 1664525 + 1013904223;
+    uint32_t result = *seed >> 16;
+    return result;
+}
+
+// Times each compose kernel the CPU supports over random scanlines (about half the pixels
+// covered by sprites, some behind the background, sprite 0 here and there), then the
+// conversion of the result to RGBA, and checks that they all agree with the scalar ones.
+//   composebench [LINES]
+int32_t
+main(int32_t argc, char *argv[])
+{
+    int64_t linesCount = (argc > 1) ? atol(argv[1]) : DEFAULT_LINES_COUNT;
+
+    bool expectedHits[LINES_COUNT];
+    uint8_t palette[COMPOSE_PALETTE_COUNT];
+    uint32_t rgba[COMPOSE_COLORS_COUNT];
+
+    uint32_t seed = 0x12345678;
+    for (int32_t i = 0; i < COMPOSE_PALETTE_COUNT; i++) {
+        palette[i] = next_random(&seed) % COMPOSE_COLORS_COUNT;
+    }
+    for (int32_t i = 0; i < COMPOSE_COLORS_COUNT; i++) {
+        rgba[i] = (next_random(&seed) << 16) | next_random(&seed);
+    }
+    for (int32_t line = 0; line < LINES_COUNT; line++) {
+        for (int32_t x = 0; x < COMPOSE_LINE_WIDTH_PX; x++) {
+            uint32_t bits = next_random(&seed);
+            uint8_t pixel = bits & 0x03;
+            backgrounds[line][x] = (uint8_t)(pixel ? (((bits >> 2) & 0x0C) | pixel) : 0);
+            if (bits & 0x100) {
+                uint8_t spritePixel = (bits >> 9) & 0x03;
+                uint8_t flags = (uint8_t)(COMPOSE_SPRITE_PALETTE | ((bits >> 9) & 0x0C));
+                flags |= (bits & 0x800) ? COMPOSE_SPRITE_BEHIND_BACKGROUND : 0;
+                flags |= ((line % 4 == 0) && (bits & 0x1000)) ? COMPOSE_SPRITE_0 : 0;
+                sprites[line][x] = spritePixel ? (uint8_t)(flags | spritePixel) : 0;
+            }
+            else {
+                sprites[line][x] = 0;
+            }
+        }
+    }
+    // sprite 0 only at x = 255, which never hits
+    memset(sprites[1], 0, COMPOSE_LINE_WIDTH_PX);
+    sprites[1][COMPOSE_LINE_WIDTH_PX - 1] = COMPOSE_SPRITE_PALETTE | COMPOSE_SPRITE_0 | 1;
+    backgrounds[1][COMPOSE_LINE_WIDTH_PX - 1] = 1;
+
+    const ComposeKernels *scalar = compose_get(COMPOSE_SCALAR);
+    for (int32_t line = 0; line < LINES_COUNT; line++) {
+        expectedHits[line] = scalar->compose(backgrounds[line], sprites[line], palette, expectedLines[line]);
+        scalar->convert(expectedLines[line], rgba, expectedRows[line]);
+    }
+
+    bool isOk = true;
+    for (ComposeKernel kernel = 0; kernel < COMPOSE_KERNELS_COUNT; kernel++) {
+        const ComposeKernels *kernels = compose_get(kernel);
+        if (!kernels) {
+            printf("kernel %d not supported\n", kernel);
+            continue;
+        }
+
+        for (int32_t line = 0; line < LINES_COUNT; line++) {
+            bool isHit = kernels->compose(backgrounds[line], sprites[line], palette, lines[line]);
+            kernels->convert(expectedLines[line], rgba, rows[line]);
+            if ((isHit != expectedHits[line]) ||
+                memcmp(lines[line], expectedLines[line], sizeof(lines[line])) ||
+                memcmp(rows[line], expectedRows[line], sizeof(rows[line]))) {
+                printf("%s: scanline %d differs from the scalar kernels\n", kernels->name, line);
+                isOk = false;
+                break;
+            }
+        }
+
+        int32_t hitsCount = 0;
+        uint64_t startNs = time_ns();
+        for (int64_t i = 0; i < linesCount; i++) {
+            int32_t line = (int32_t)(i % LINES_COUNT);
+            hitsCount += kernels->compose(backgrounds[line], sprites[line], palette, lines[line]);
+        }
+        uint64_t composeNs = MAX(time_ns() - startNs, 1);
+
+        startNs = time_ns();
+        for (int64_t i = 0; i < linesCount; i++) {
+            int32_t line = (int32_t)(i % LINES_COUNT);
+            kernels->convert(lines[line], rgba, rows[line]);
+        }
+        uint64_t convertNs = MAX(time_ns() - startNs, 1);
+
+        double pixelsCount = (double)(linesCount * COMPOSE_LINE_WIDTH_PX);
+        printf("%-6s  compose: %7.3f pixels/ns  convert: %7.3f pixels/ns  (%d hits)\n",
+               kernels->name,
+               pixelsCount / (double)composeNs,
+               pixelsCount / (double)convertNs,
+               hitsCount);
+    }
+
+    return isOk ? 0 : 1;
+}
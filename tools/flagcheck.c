@@ -0,0 +1,74 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "utils.h"
+#include "arena.h"
+#include "str8.h"
+#include "nes.h"
+
+#define DEFAULT_INSTRUCTIONS_COUNT 100000
+
+// Runs the eager and the lazy flags CPU in lockstep and stops at the first instruction
+// after which their status registers (or any other register) disagree.
+//   flagcheck nestest.nes 8991 C000
+int32_t
+main(int32_t argc, char *argv[])
+{
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s ROM [INSTRUCTIONS] [START_PC]\n", argv[0]);
+        exit(1);
+    }
+    Str8 romPath = str8_from_cstr(argv[1]);
+    int64_t instructionsCount = (argc > 2) ? atol(argv[2]) : DEFAULT_INSTRUCTIONS_COUNT;
+
+    int32_t arenaBufCap = MB(64);
+    uint8_t *arenaBuf = (uint8_t *)malloc(arenaBufCap);
+    Arena permArena = arena_make(arenaBuf, arenaBufCap);
+
+    Nes *eager = arena_push_zero(&permArena, sizeof(Nes));
+    Nes *lazy = arena_push_zero(&permArena, sizeof(Nes));
+    if (!nes_init(&permArena, eager, romPath) || !nes_init(&permArena, lazy, romPath)) {
+        fprintf(stderr, "Failed to initialize NES\n");
+        exit(1);
+    }
+    cpu_set_lazy_flags(&eager->cpu, false);
+    cpu_set_lazy_flags(&lazy->cpu, true);
+    if (argc > 3) {
+        eager->cpu.pc = lazy->cpu.pc = (uint16_t)strtol(argv[3], NULL, 16);
+    }
+
+    Cpu *ecpu = &eager->cpu;
+    Cpu *lcpu = &lazy->cpu;
+    int64_t i = 0;
+    for (; i < instructionsCount && !ecpu->isJammed; i++) {
+        ArenaBackup arenaBck = arena_backup(&permArena);
+        Str8 before = cpu_sprint(arenaBck.arena, ecpu);
+
+        cpu_step(ecpu);
+        cpu_step(lcpu);
+
+        bool isSame = (cpu_status(ecpu) == cpu_status(lcpu)) &&
+                      (ecpu->pc == lcpu->pc) &&
+                      (ecpu->a == lcpu->a) &&
+                      (ecpu->x == lcpu->x) &&
+                      (ecpu->y == lcpu->y) &&
+                      (ecpu->sp == lcpu->sp) &&
+                      (ecpu->cyclesCount == lcpu->cyclesCount);
+        if (!isSame) {
+            Str8 eagerState = cpu_sprint(arenaBck.arena, ecpu);
+            Str8 lazyState = cpu_sprint(arenaBck.arena, lcpu);
+            printf("Mismatch after instruction %ld:\n", i + 1);
+            printf("      %.*s\n", STR8_VARG(before));
+            printf("eager %.*s\n", STR8_VARG(eagerState));
+            printf("lazy  %.*s\n", STR8_VARG(lazyState));
+            exit(1);
+        }
+        arena_restore(&arenaBck);
+    }
+    printf("OK: %ld instructions, eager and lazy flags match\n", i);
+
+    free(arenaBuf);
+
+    return 0;
+}
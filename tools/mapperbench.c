@@ -0,0 +1,203 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "utils.h"
+#include "arena.h"
+#include "str8.h"
+#include "rom.h"
+#include "mmu.h"
+#include "tool_utils.h"
+
+#define DEFAULT_READS_COUNT 200000000
+#define ADDRS_COUNT KB(64)
+#define SWITCHES_COUNT 10000000
+#define MAX_WRITES_COUNT 16
+
+typedef struct MapperWrite MapperWrite;
+struct MapperWrite
+{
+    uint16_t addr;
+    uint8_t value;
+};
+
+// A synthetic cartridge, banked by `writes`. Every byte of PRG/CHR holds the number of its
+// 8KB/1KB bank xor its offset, so the first byte of each window tells which bank is mapped.
+typedef struct BenchCase BenchCase;
+struct BenchCase
+{
+    char *name;
+    Mapper mapper;
+    int32_t prgSize;
+    int32_t chrSize;
+    MapperWrite writes[MAX_WRITES_COUNT];
+    int32_t prgBanks[ROM_PRG_WINDOWS_COUNT];
+    int32_t chrBank; // 1KB bank at $0000
+    MapperWrite switchWrites[2]; // alternated to time bank switches
+};
+
+// MMC1 loads its registers one bit per write, LSB first
+#define MMC1_WRITES(addr, value)                                                                  \
+    {addr, (value) & 1}, {addr, ((value) >> 1) & 1}, {addr, ((value) >> 2) & 1}, {addr, ((value) >> 3) & 1}, \
+    {addr, ((value) >> 4) & 1}
+
+global BenchCase benchCases[] = {
+    {
+        .name = "NROM",
+        .mapper = NROM,
+        .prgSize = KB(32),
+        .chrSize = KB(8),
+        .prgBanks = {0, 1, 2, 3},
+        .chrBank = 0,
+    },
+    {
+        .name = "UxROM",
+        .mapper = UXROM,
+        .prgSize = KB(128),
+        .chrSize = 0,
+        .writes = {{0x8000, 5}},
+        .prgBanks = {10, 11, 14, 15},
+        .chrBank = 0,
+        .switchWrites = {{0x8000, 1}, {0x8000, 2}},
+    },
+    {
+        .name = "CNROM",
+        .mapper = CNROM,
+        .prgSize = KB(32),
+        .chrSize = KB(32),
+        .writes = {{0x8000, 2}},
+        .prgBanks = {0, 1, 2, 3},
+        .chrBank = 16,
+        .switchWrites = {{0x8000, 1}, {0x8000, 3}},
+    },
+    {
+        .name = "MMC1",
+        .mapper = MMC1,
+        .prgSize = KB(256),
+        .chrSize = KB(128),
+        .writes = {MMC1_WRITES(0x8000, 0x1C), MMC1_WRITES(0xA000, 5), MMC1_WRITES(0xE000, 3)},
+        .prgBanks = {6, 7, 30, 31},
+        .chrBank = 20,
+        .switchWrites = {{0xE000, 0}, {0xE000, 1}},
+    },
+    {
+        .name = "MMC3",
+        .mapper = MMC3,
+        .prgSize = KB(256),
+        .chrSize = KB(256),
+        .writes = {{0x8000, 0}, {0x8001, 40}, {0x8000, 7}, {0x8001, 12}, {0x8000, 6}, {0x8001, 9}},
+        .prgBanks = {9, 12, 30, 31},
+        .chrBank = 40,
+        .switchWrites = {{0x8001, 9}, {0x8001, 10}},
+    },
+};
+
+internal uint8_t *
+make_image(Arena *arena, BenchCase *benchCase, int32_t *imageSize)
+{
+    *imageSize = INES_HEADER_SIZE + benchCase->prgSize + benchCase->chrSize;
+    uint8_t *image = arena_push_zero(arena, *imageSize);
+    memcpy(image, "NES\x1A", 4);
+    image[4] = (uint8_t)(benchCase->prgSize / KB(16));
+    image[5] = (uint8_t)(benchCase->chrSize / KB(8));
+    image[6] = (uint8_t)((benchCase->mapper & 0x0F) << 4);
+    image[7] = (uint8_t)(benchCase->mapper & 0xF0);
+
+    uint8_t *prg = image + INES_HEADER_SIZE;
+    for (int32_t i = 0; i < benchCase->prgSize; i++) {
+        prg[i] = (uint8_t)((i / ROM_PRG_WINDOW_SIZE) ^ i);
+    }
+    uint8_t *chr = prg + benchCase->prgSize;
+    for (int32_t i = 0; i < benchCase->chrSize; i++) {
+        chr[i] = (uint8_t)((i / ROM_CHR_WINDOW_SIZE) ^ i);
+    }
+    return image;
+}
+
+// Times random reads of $8000-$FFFF through the CPU bus and of $0000-$1FFF through the CHR
+// windows, which should cost the same whatever the mapper, and mapper register writes.
+//   mapperbench [READS]
+int32_t
+main(int32_t argc, char *argv[])
+{
+    int64_t readsCount = (argc > 1) ? atol(argv[1]) : DEFAULT_READS_COUNT;
+
+    int32_t arenaBufCap = MB(64);
+    uint8_t *arenaBuf = (uint8_t *)malloc(arenaBufCap);
+    Arena permArena = arena_make(arenaBuf, arenaBufCap);
+
+    uint16_t *addrs = arena_push(&permArena, ADDRS_COUNT * sizeof(uint16_t));
+    uint32_t seed = 0x12345678;
+    for (int32_t i = 0; i < ADDRS_COUNT; i++) {
+        seed = seed * 1664525 + 1013904223;
+        addrs[i] = (uint16_t)(seed >> 16);
+    }
+
+    bool isOk = true;
+    for (int32_t caseIdx = 0; caseIdx < (int32_t)ARRAY_CAP(benchCases); caseIdx++) {
+        BenchCase *benchCase = &benchCases[caseIdx];
+        ArenaBackup arenaBck = arena_backup(&permArena);
+
+        int32_t imageSize = 0;
+        uint8_t *image = make_image(arenaBck.arena, benchCase, &imageSize);
+        Rom *rom = arena_push_zero(arenaBck.arena, sizeof(Rom));
+        Mmu *mmu = arena_push_zero(arenaBck.arena, sizeof(Mmu));
+        if (!rom_load_image(arenaBck.arena, rom, image, imageSize, str8_from_cstr(benchCase->name))) {
+            exit(1);
+        }
+        mmu_init(mmu, rom);
+        for (int32_t i = 0; (i < MAX_WRITES_COUNT) && benchCase->writes[i].addr; i++) {
+            mmu_cpu_write(mmu, benchCase->writes[i].addr, benchCase->writes[i].value);
+        }
+
+        for (int32_t window = 0; window < ROM_PRG_WINDOWS_COUNT; window++) {
+            uint8_t bank = mmu_cpu_read(mmu, (uint16_t)(0x8000 + window * ROM_PRG_WINDOW_SIZE));
+            if (bank != benchCase->prgBanks[window]) {
+                printf("%s: PRG bank %d mapped at $%04X, expected %d\n",
+                       benchCase->name, bank, 0x8000 + window * ROM_PRG_WINDOW_SIZE, benchCase->prgBanks[window]);
+                isOk = false;
+            }
+        }
+        if (rom_read_chr(rom, 0) != benchCase->chrBank) {
+            printf("%s: CHR bank %d mapped at $0000, expected %d\n", benchCase->name, rom_read_chr(rom, 0), benchCase->chrBank);
+            isOk = false;
+        }
+
+        uint32_t checksum = 0;
+        uint64_t startNs = time_ns();
+        for (int64_t i = 0; i < readsCount; i++) {
+            checksum += mmu_cpu_read(mmu, addrs[i % ADDRS_COUNT] | 0x8000);
+        }
+        uint64_t prgNs = MAX(time_ns() - startNs, 1);
+
+        startNs = time_ns();
+        for (int64_t i = 0; i < readsCount; i++) {
+            checksum += rom_read_chr(rom, addrs[i % ADDRS_COUNT] & 0x1FFF);
+        }
+        uint64_t chrNs = MAX(time_ns() - startNs, 1);
+
+        double switchNs = 0.0;
+        if (benchCase->switchWrites[0].addr) {
+            startNs = time_ns();
+            for (int32_t i = 0; i < SWITCHES_COUNT; i++) {
+                MapperWrite *write = &benchCase->switchWrites[i & 1];
+                mmu_cpu_write(mmu, write->addr, write->value);
+            }
+            switchNs = (double)(time_ns() - startNs) / SWITCHES_COUNT;
+        }
+
+        printf("%-6s  PRG read: %6.3f ns  CHR read: %6.3f ns  register write: %7.3f ns  (checksum %08X)\n",
+               benchCase->name,
+               (double)prgNs / (double)readsCount,
+               (double)chrNs / (double)readsCount,
+               switchNs,
+               checksum);
+
+        arena_restore(&arenaBck);
+    }
+
+    free(arenaBuf);
+
+    return isOk ? 0 : 1;
+}
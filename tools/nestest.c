@@ -0,0 +1,206 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "utils.h"
+#include "arena.h"
+#include "str8.h"
+#include "nes.h"
+#include "tool_utils.h"
+
+#define NESTEST_START_PC 0xC000
+#define CONTEXT_LINES_COUNT 8
+#define LINE_CAP 256
+
+typedef int32_t Backend;
+enum Backend
+{
+    BACKEND_STEP, // cpu_step, the reference interpreter
+    BACKEND_RUN,  // cpu_run one instruction at a time (block cache executors)
+    BACKEND_JIT,  // same with the JIT on
+};
+
+typedef struct RegisterState RegisterState;
+struct RegisterState
+{
+    uint32_t pc;
+    uint32_t a;
+    uint32_t x;
+    uint32_t y;
+    uint32_t p;
+    uint32_t sp;
+    uint64_t cyclesCount;
+};
+
+internal bool
+parse_hex(char *line, char *key, int32_t digitsCount, uint32_t *value)
+{
+    char *at = strstr(line, key);
+    if (!at) {
+        return false;
+    }
+    at += strlen(key);
+
+    uint32_t result = 0;
+    for (int32_t i = 0; i < digitsCount; i++) {
+        char c = at[i];
+        uint32_t digit = 0;
+        if ((c >= '0') && (c <= '9')) {
+            digit = (uint32_t)(c - '0');
+        }
+        else if ((c >= 'A') && (c <= 'F')) {
+            digit = (uint32_t)(c - 'A' + 10);
+        }
+        else {
+            return false;
+        }
+        result = (result << 4) | digit;
+    }
+    *value = result;
+    return true;
+}
+
+// Accepts both the nestest.log layout and our own trace lines, only the register fields matter:
+//   C000  4C F5 C5  JMP $C5F5                       A:00 X:00 Y:00 P:24 SP:FD PPU:  0, 21 CYC:7
+internal bool
+parse_line(char *line, RegisterState *state)
+{
+    char *cycles = strstr(line, "CYC:");
+    bool result = parse_hex(line, "", 4, &state->pc) &&
+                  parse_hex(line, "A:", 2, &state->a) &&
+                  parse_hex(line, "X:", 2, &state->x) &&
+                  parse_hex(line, "Y:", 2, &state->y) &&
+                  parse_hex(line, "P:", 2, &state->p) &&
+                  parse_hex(line, "SP:", 2, &state->sp) &&
+                  cycles;
+    if (result) {
+        state->cyclesCount = strtoull(cycles + 4, NULL, 10);
+    }
+    return result;
+}
+
+// Runs nestest in automation mode (from $C000) and compares the registers before every
+// instruction with a reference log that is streamed line by line. Stops at the first
+// divergence. Any CPU backend can be checked against the same log:
+//   nestest [--run | --jit] nestest.nes nestest.log
+int32_t
+main(int32_t argc, char *argv[])
+{
+    Backend backend = BACKEND_STEP;
+    int32_t argsOffset = 0;
+    if ((argc > 1) && (strcmp(argv[1], "--run") == 0)) {
+        backend = BACKEND_RUN;
+        argsOffset = 1;
+    }
+    else if ((argc > 1) && (strcmp(argv[1], "--jit") == 0)) {
+        backend = BACKEND_JIT;
+        argsOffset = 1;
+    }
+    if (argc - argsOffset < 3) {
+        fprintf(stderr, "Usage: %s [--run | --jit] ROM LOG\n", argv[0]);
+        exit(1);
+    }
+    Str8 romPath = str8_from_cstr(argv[1 + argsOffset]);
+    char *logPath = argv[2 + argsOffset];
+
+    int32_t arenaBufCap = MB(64);
+    uint8_t *arenaBuf = (uint8_t *)malloc(arenaBufCap);
+    Arena permArena = arena_make(arenaBuf, arenaBufCap);
+
+    Nes *nes = arena_push_zero(&permArena, sizeof(Nes));
+    if (!nes_init(&permArena, nes, romPath)) {
+        fprintf(stderr, "Failed to initialize NES\n");
+        exit(1);
+    }
+    Cpu *cpu = &nes->cpu;
+    if ((backend == BACKEND_JIT) && !cpu_set_jit(cpu, true)) {
+        fprintf(stderr, "JIT is not available\n");
+        exit(1);
+    }
+    cpu->pc = NESTEST_START_PC;
+
+    FILE *logFile = fopen(logPath, "rb");
+    if (!logFile) {
+        fprintf(stderr, "Failed to open file '%s': %s\n", logPath, strerror(errno));
+        exit(1);
+    }
+
+    // the last matching lines, printed as context of a divergence
+    char contextLines[CONTEXT_LINES_COUNT][LINE_CAP];
+    int64_t linesCount = 0;
+
+    uint64_t startNs = time_ns();
+    char line[LINE_CAP];
+    while (fgets(line, sizeof(line), logFile)) {
+        line[strcspn(line, "\r\n")] = '\0';
+        if (line[0] == '\0') {
+            continue;
+        }
+
+        RegisterState expected = {};
+        if (!parse_line(line, &expected)) {
+            fprintf(stderr, "%s:%ld: can't parse '%s'\n", logPath, linesCount + 1, line);
+            exit(1);
+        }
+
+        RegisterState actual = {
+            .pc = cpu->pc,
+            .a = cpu->a,
+            .x = cpu->x,
+            .y = cpu->y,
+            .p = cpu_status(cpu),
+            .sp = cpu->sp,
+            .cyclesCount = cpu->cyclesCount,
+        };
+        bool isSame = (expected.pc == actual.pc) &&
+                      (expected.a == actual.a) &&
+                      (expected.x == actual.x) &&
+                      (expected.y == actual.y) &&
+                      (expected.p == actual.p) &&
+                      (expected.sp == actual.sp) &&
+                      (expected.cyclesCount == actual.cyclesCount);
+        if (!isSame) {
+            printf("Divergence at instruction %ld:\n", linesCount + 1);
+            for (int64_t i = MAX(linesCount - CONTEXT_LINES_COUNT, 0); i < linesCount; i++) {
+                printf("           %s\n", contextLines[i % CONTEXT_LINES_COUNT]);
+            }
+            uint8_t actualLine[CPU_TRACE_LINE_CAP];
+            int32_t actualLineLength = cpu_format_trace_line(cpu, actualLine);
+            printf("expected > %s\n", line);
+            printf("actual   > %.*s\n", actualLineLength, actualLine);
+            exit(1);
+        }
+        memcpy(contextLines[linesCount % CONTEXT_LINES_COUNT], line, sizeof(line));
+        linesCount++;
+
+        // a DMA stall is a step of its own, the log charges it to the next instruction
+        bool isStalled = (cpu->pendingCyclesCount != 0);
+        for (int32_t i = 0; i < (isStalled ? 2 : 1); i++) {
+            if (backend == BACKEND_STEP) {
+                cpu_step(cpu);
+            }
+            else {
+                cpu_run(cpu, 1);
+            }
+        }
+    }
+    if (ferror(logFile)) {
+        fprintf(stderr, "Failed to read file '%s': %s\n", logPath, strerror(errno));
+        exit(1);
+    }
+    uint64_t durationNs = time_ns() - startNs;
+    fclose(logFile);
+
+    // nestest reports the first failed official/unofficial opcode test in $02/$03
+    printf("OK: %ld instructions match in %.3f ms ($02=%02X $03=%02X)\n",
+           linesCount,
+           (double)durationNs / 1e6,
+           nes->mmu.cpuRam[0x02],
+           nes->mmu.cpuRam[0x03]);
+
+    free(arenaBuf);
+
+    return 0;
+}
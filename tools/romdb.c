@@ -0,0 +1,80 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "utils.h"
+#include "arena.h"
+#include "str8.h"
+#include "rom.h"
+#include "crc32.h"
+#include "romdb.h"
+#include "tool_utils.h"
+
+// Prints the ROM database entry of each ROM as the loader sees it (after any fixup from the
+// database), ready to be pasted into romdb.c for dumps with a verified header. The load time
+// includes decompression for zipped/gzipped ROMs, to compare with loading them raw:
+//   romdb game.nes...
+int32_t
+main(int32_t argc, char *argv[])
+{
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s ROM...\n", argv[0]);
+        exit(1);
+    }
+
+    int32_t arenaBufCap = MB(64);
+    uint8_t *arenaBuf = (uint8_t *)malloc(arenaBufCap);
+    Arena permArena = arena_make(arenaBuf, arenaBufCap);
+
+    int32_t exitCode = 0;
+    for (int32_t i = 1; i < argc; i++) {
+        ArenaBackup arenaBck = arena_backup(&permArena);
+
+        Rom rom = {};
+        uint64_t loadStartNs = time_ns();
+        bool isLoaded = rom_load(arenaBck.arena, &rom, str8_from_cstr(argv[i]));
+        uint64_t loadNs = time_ns() - loadStartNs;
+        if (!isLoaded) {
+            exitCode = 1;
+            arena_restore(&arenaBck);
+            continue;
+        }
+
+        int32_t dataSize = rom.prgSize + (rom.isChrRam ? 0 : rom.chrSize);
+        uint64_t hashStartNs = time_ns();
+        uint32_t crc = crc32_update(0, rom.prg, dataSize);
+        uint64_t hashNs = time_ns() - hashStartNs;
+
+        Str8List flags = {};
+        if (rom.mirror == FOUR_SCREEN) {
+            str8_list_append(arenaBck.arena, &flags, STR8_LITERAL("ROMDB_FOUR_SCREEN"));
+        }
+        else if (rom.mirror == VERTICAL) {
+            str8_list_append(arenaBck.arena, &flags, STR8_LITERAL("ROMDB_VERTICAL"));
+        }
+        if (rom.hasBattery) {
+            str8_list_append(arenaBck.arena, &flags, STR8_LITERAL("ROMDB_BATTERY"));
+        }
+        if (flags.count == 0) {
+            str8_list_append(arenaBck.arena, &flags, STR8_LITERAL("0"));
+        }
+        Str8 flagsStr = str8_list_join(arenaBck.arena, flags, '|');
+
+        printf("{0x%08X, %d, %d, %.*s}, // %s (%d KB, loaded in %.1f us, hashed in %.1f us%s)\n",
+               crc,
+               rom.mapper,
+               rom.submapper,
+               STR8_VARG(flagsStr),
+               argv[i],
+               dataSize / KB(1),
+               (double)loadNs / 1e3,
+               (double)hashNs / 1e3,
+               romdb_find(crc) ? ", in database" : "");
+
+        arena_restore(&arenaBck);
+    }
+
+    free(arenaBuf);
+
+    return exitCode;
+}
@@ -0,0 +1,18 @@
+#ifndef TOOL_UTILS_H
+#define TOOL_UTILS_H
+
+#include <stdint.h>
+#include <time.h>
+
+#include "utils.h"
+
+internal uint64_t
+time_ns()
+{
+    struct timespec ts;
+    timespec_get(&ts, TIME_UTC);
+    uint64_t result = (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+    return result;
+}
+
+#endif //TOOL_UTILS_H
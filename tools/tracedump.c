@@ -0,0 +1,73 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "utils.h"
+#include "cpu.h"
+#include "trace.h"
+
+#define RECORDS_PER_READ 4096
+
+// Expands a binary trace (`nes --trace-bin FILE`) into the text trace format, optionally
+// with the effective address of every instruction appended.
+int32_t
+main(int32_t argc, char *argv[])
+{
+    bool isEffectiveAddr = (argc > 1) && (strcmp(argv[1], "--ea") == 0);
+    int32_t argsOffset = isEffectiveAddr ? 1 : 0;
+    if (argc - argsOffset < 2) {
+        fprintf(stderr, "Usage: %s [--ea] TRACE\n", argv[0]);
+        exit(1);
+    }
+    char *tracePath = argv[1 + argsOffset];
+
+    FILE *traceFile = fopen(tracePath, "rb");
+    if (!traceFile) {
+        fprintf(stderr, "Failed to open file '%s': %s\n", tracePath, strerror(errno));
+        exit(1);
+    }
+
+    uint8_t magic[TRACE_BINARY_MAGIC_SIZE];
+    if ((fread(magic, 1, sizeof(magic), traceFile) != sizeof(magic)) ||
+        (memcmp(magic, TRACE_BINARY_MAGIC, TRACE_BINARY_MAGIC_SIZE) != 0)) {
+        fprintf(stderr, "Not a binary trace file '%s'\n", tracePath);
+        fclose(traceFile);
+        exit(1);
+    }
+
+    static uint8_t records[RECORDS_PER_READ * TRACE_RECORD_SIZE];
+    static uint8_t lines[RECORDS_PER_READ * (CPU_TRACE_LINE_CAP + 9)];
+
+    TraceDecoder decoder = {};
+    size_t recordsCount = 0;
+    while ((recordsCount = fread(records, TRACE_RECORD_SIZE, RECORDS_PER_READ, traceFile)) > 0) {
+        int32_t linesLength = 0;
+        for (size_t i = 0; i < recordsCount; i++) {
+            CpuTraceState state;
+            if (!trace_decode_record(&decoder, &records[i * TRACE_RECORD_SIZE], &state)) {
+                continue;
+            }
+            if (!decoder.isSynced) {
+                fprintf(stderr, "Trace doesn't start with a sync record\n");
+                fclose(traceFile);
+                exit(1);
+            }
+            linesLength += cpu_format_trace_state(&state, lines + linesLength);
+            if (isEffectiveAddr) {
+                linesLength += sprintf((char *)lines + linesLength, " EA:%04X", state.effectiveAddr);
+            }
+            lines[linesLength++] = '\n';
+        }
+        fwrite(lines, 1, linesLength, stdout);
+    }
+    if (ferror(traceFile)) {
+        fprintf(stderr, "Failed to read trace file '%s': %s\n", tracePath, strerror(errno));
+        fclose(traceFile);
+        exit(1);
+    }
+
+    fclose(traceFile);
+    return 0;
+}
@@ -0,0 +1,181 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "utils.h"
+#include "arena.h"
+#include "str8.h"
+#include "crc32.h"
+#include "nes.h"
+
+#define DEFAULT_FRAMES_COUNT 300
+#define HITS_PER_POP 256
+
+typedef int32_t Backend;
+enum Backend
+{
+    BACKEND_STEP, // cpu_step, the reference interpreter
+    BACKEND_RUN,  // cpu_run (block cache executors, idle loops)
+    BACKEND_JIT,  // same with the JIT on
+
+    BACKENDS_COUNT,
+};
+
+global const char *backendNames[BACKENDS_COUNT] = {"step", "run", "jit"};
+
+typedef struct Watch Watch;
+struct Watch
+{
+    uint16_t addr;
+    int32_t count;
+    MmuWatchFlags flags;
+};
+
+// RAM watchpoints keep the JIT off, the PRG ones let it compile and leave the watched reads
+// to the interpreter. Code at the NMI handler is watched in both (its address is filled in
+// from the vector).
+typedef struct WatchSet WatchSet;
+struct WatchSet
+{
+    const char *name;
+    Watch watches[3];
+};
+
+global WatchSet watchSets[] = {
+    {"ram", {{0x0000, 0x100, MMU_WATCH_READ}, {0x0200, 0x100, MMU_WATCH_WRITE}, {0, 16, MMU_WATCH_EXECUTE}}},
+    {"prg", {{0x8000, 0x8000, MMU_WATCH_READ}, {0x6000, 0x2000, MMU_WATCH_WRITE}, {0, 16, MMU_WATCH_EXECUTE}}},
+};
+
+typedef struct HitsSummary HitsSummary;
+struct HitsSummary
+{
+    uint32_t crc; // of every hit in order
+    int64_t readsCount;
+    int64_t writesCount;
+    int64_t executesCount;
+    uint64_t droppedCount;
+    uint64_t cyclesCount;
+    uint64_t instructionsCount;
+    bool isSkipped; // backend not available here
+};
+
+// Drains the hits after every CPU run of nes_run_frame, so that the queue doesn't overflow.
+internal void
+pop_hits(Nes *nes, void *data)
+{
+    HitsSummary *summary = data;
+    MmuWatchHit hits[HITS_PER_POP];
+    int32_t hitsCount = 0;
+    while ((hitsCount = mmu_pop_watch_hits(&nes->mmu, hits, HITS_PER_POP)) > 0) {
+        for (int32_t i = 0; i < hitsCount; i++) {
+            MmuWatchHit *hit = &hits[i];
+            uint8_t record[12] = {
+                (uint8_t)(hit->cyclesCount >> 0), (uint8_t)(hit->cyclesCount >> 8),
+                (uint8_t)(hit->cyclesCount >> 16), (uint8_t)(hit->cyclesCount >> 24),
+                (uint8_t)(hit->cyclesCount >> 32), (uint8_t)(hit->cyclesCount >> 40),
+                (uint8_t)(hit->cyclesCount >> 48), (uint8_t)(hit->cyclesCount >> 56),
+                (uint8_t)(hit->addr & 0xFF), (uint8_t)(hit->addr >> 8), hit->value, hit->access,
+            };
+            summary->crc = crc32_update(summary->crc, record, sizeof(record));
+            summary->readsCount += (hit->access == MMU_WATCH_READ);
+            summary->writesCount += (hit->access == MMU_WATCH_WRITE);
+            summary->executesCount += (hit->access == MMU_WATCH_EXECUTE);
+        }
+    }
+}
+
+internal bool
+run_backend(Arena *arena, Str8 romPath, WatchSet *set, Backend backend, int32_t framesCount, HitsSummary *summary)
+{
+    ArenaBackup arenaBck = arena_backup(arena);
+
+    Nes *nes = arena_push_zero(arenaBck.arena, sizeof(Nes));
+    if (!nes_init(arenaBck.arena, nes, romPath)) {
+        fprintf(stderr, "Failed to initialize NES\n");
+        arena_restore(&arenaBck);
+        return false;
+    }
+    *summary = (HitsSummary){};
+    if ((backend == BACKEND_JIT) && !cpu_set_jit(&nes->cpu, true)) {
+        summary->isSkipped = true;
+        arena_restore(&arenaBck);
+        return true;
+    }
+    nes->isStepping = (backend == BACKEND_STEP);
+    nes->cpuRunHook = pop_hits;
+    nes->cpuRunHookData = summary;
+
+    uint16_t nmiAddr = mmu_cpu_read16(&nes->mmu, 0xFFFA);
+    for (int32_t i = 0; i < (int32_t)ARRAY_CAP(set->watches); i++) {
+        Watch *watch = &set->watches[i];
+        uint16_t addr = (watch->flags == MMU_WATCH_EXECUTE) ? nmiAddr : watch->addr;
+        mmu_set_watch(&nes->mmu, addr, watch->count, watch->flags);
+    }
+
+    for (int32_t i = 0; i < framesCount; i++) {
+        nes_run_frame(nes, false);
+    }
+    summary->droppedCount = nes->mmu.watchHitsDroppedCount;
+    summary->cyclesCount = nes->cpu.cyclesCount;
+    summary->instructionsCount = nes->cpu.instructionsCount;
+
+    arena_restore(&arenaBck);
+    return true;
+}
+
+// Runs a ROM headless with RAM and then PRG watchpoints through each CPU backend, and checks
+// that they all report the same hits in the same order:
+//   watchcheck game.nes [FRAMES]
+int32_t
+main(int32_t argc, char *argv[])
+{
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s ROM [FRAMES]\n", argv[0]);
+        exit(1);
+    }
+    Str8 romPath = str8_from_cstr(argv[1]);
+    int32_t framesCount = (argc > 2) ? atoi(argv[2]) : DEFAULT_FRAMES_COUNT;
+
+    int32_t arenaBufCap = MB(64);
+    uint8_t *arenaBuf = (uint8_t *)malloc(arenaBufCap);
+    Arena permArena = arena_make(arenaBuf, arenaBufCap);
+
+    bool isOk = true;
+    for (int32_t setIdx = 0; setIdx < (int32_t)ARRAY_CAP(watchSets); setIdx++) {
+        WatchSet *set = &watchSets[setIdx];
+        HitsSummary summaries[BACKENDS_COUNT];
+        for (Backend backend = 0; backend < BACKENDS_COUNT; backend++) {
+            HitsSummary *summary = &summaries[backend];
+            if (!run_backend(&permArena, romPath, set, backend, framesCount, summary)) {
+                exit(1);
+            }
+            if (summary->isSkipped) {
+                printf("%s %-4s  not available\n", set->name, backendNames[backend]);
+                continue;
+            }
+
+            HitsSummary *expected = &summaries[BACKEND_STEP];
+            bool isSame = (summary->crc == expected->crc) &&
+                          (summary->readsCount == expected->readsCount) &&
+                          (summary->writesCount == expected->writesCount) &&
+                          (summary->executesCount == expected->executesCount) &&
+                          (summary->droppedCount == expected->droppedCount) &&
+                          (summary->cyclesCount == expected->cyclesCount) &&
+                          (summary->instructionsCount == expected->instructionsCount);
+            printf("%s %-4s  reads: %8ld  writes: %8ld  executes: %8ld  dropped: %6lu  crc: %08X%s\n",
+                   set->name,
+                   backendNames[backend],
+                   summary->readsCount,
+                   summary->writesCount,
+                   summary->executesCount,
+                   summary->droppedCount,
+                   summary->crc,
+                   isSame ? "" : "  MISMATCH");
+            isOk = isOk && isSame;
+        }
+    }
+
+    free(arenaBuf);
+
+    return isOk ? 0 : 1;
+}